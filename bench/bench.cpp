@@ -0,0 +1,380 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#endif
+
+#include "../rltl/impl/action_value_table.h"
+#include "../rltl/impl/exploration.h"
+#include "../rltl/impl/sarsa.h"
+#include "../rltl/impl/expected_sarsa.h"
+#include "../rltl/impl/q_learning.h"
+#include "../rltl/impl/deep_q_network.h"
+#include "../rltl/impl/deep_reinforce.h"
+#include "../rltl/impl/deep_actor_critic.h"
+#include "../rltl/impl/action_value_net.h"
+#include "../rltl/impl/state_value_net.h"
+#include "../rltl/impl/policy_net.h"
+#include "../rltl/impl/trainer.h"
+#include "../test/env/cliff_walking.h"
+#include "../test/env/mountain_car.h"
+#include "../test/env/cart_pole.h"
+#include "bench_environment.h"
+
+//usage: rltl_bench [--steps N] [--seconds S] [--seed N] [--threads N] [--filter substring] [--out file.json]
+//rss_growth_kb is the resident memory a case added, peak_rss_kb the peak of the whole run; run one case with --filter for its own peak
+
+struct BenchConfig
+{
+	uint64_t m_steps{ 20000 };
+	double m_seconds{ 30 };
+	uint32_t m_seed{ 1 };
+	int m_threads{ 1 };
+	std::string m_filter;
+	std::string m_out;
+public:
+	bool selected(const std::string& name) const
+	{
+		return m_filter.empty() || name.find(m_filter) != std::string::npos;
+	}
+};
+
+struct BenchResult
+{
+	std::string m_agent;
+	std::string m_environment;
+	rltl::impl::TrainStats m_stats;
+	double m_p50Ns;
+	double m_p99Ns;
+	size_t m_rssGrowthKB;
+};
+
+//time between beginStep and endStep, i.e. environment step plus agent step
+class StepLatency : public rltl::impl::Callback
+{
+public:
+	StepLatency(uint64_t capacity)
+	{
+		m_latencies.reserve(capacity);
+	}
+public:
+	void beginStep(uint32_t episode, uint32_t step) override
+	{
+		m_begin = std::chrono::steady_clock::now();
+	}
+	void endStep(uint32_t episode, uint32_t step, float reward) override
+	{
+		m_latencies.push_back(float(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - m_begin).count()));
+	}
+	double percentile(double p)
+	{
+		if (m_latencies.empty())
+		{
+			return 0;
+		}
+		size_t index = std::min(size_t(p * m_latencies.size()), m_latencies.size() - 1);
+		std::nth_element(m_latencies.begin(), m_latencies.begin() + index, m_latencies.end());
+		return m_latencies[index];
+	}
+protected:
+	std::chrono::steady_clock::time_point m_begin;
+	std::vector<float> m_latencies;
+};
+
+//high-water mark of the whole process, every case after a large one would report its peak
+size_t PeakRssKB()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.PeakWorkingSetSize / 1024;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+//resident memory now, the difference around a case is what it holds, whatever ran before it
+size_t CurrentRssKB()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.WorkingSetSize / 1024;
+#elif defined(__APPLE__)
+	mach_task_basic_info_data_t info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (KERN_SUCCESS != task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count))
+	{
+		return 0;
+	}
+	return info.resident_size / 1024;
+#else
+	size_t pages = 0;
+	size_t residentPages = 0;
+	std::ifstream statm("/proc/self/statm");
+	if (!(statm >> pages >> residentPages))
+	{
+		return 0;
+	}
+	return residentPages * size_t(sysconf(_SC_PAGESIZE)) / 1024;
+#endif
+}
+
+template<typename Env_t, typename AgentPtr_t>
+void RunBench(std::vector<BenchResult>& results, const BenchConfig& config, const std::string& agentName, const std::string& environmentName,
+	const std::function<AgentPtr_t(paf::SharedPtr<Env_t>)>& makeAgent)
+{
+	if (!config.selected(agentName + "/" + environmentName))
+	{
+		return;
+	}
+	//every case starts from the same generators, so its result does not depend on --filter or on the cases before it
+	srand(config.m_seed);
+	torch::manual_seed(config.m_seed);
+	rltl::impl::Random::seed(config.m_seed);
+	size_t rssBefore = CurrentRssKB();
+	auto env = paf::SharedPtr<Env_t>::Make();
+	AgentPtr_t agent = makeAgent(env);
+
+	StepLatency latency(config.m_steps);
+	rltl::impl::TrainBudget budget;
+	budget.maxSteps(config.m_steps).maxSeconds(config.m_seconds);
+	typedef typename Env_t::State_t State_t;
+	typedef typename Env_t::Action_t Action_t;
+	BenchResult result;
+	result.m_agent = agentName;
+	result.m_environment = environmentName;
+	result.m_stats = rltl::impl::Trainer<State_t, Action_t>::TrainSteps(agent.get(), env.get(), budget, &latency);
+	result.m_p50Ns = latency.percentile(0.5);
+	result.m_p99Ns = latency.percentile(0.99);
+	size_t rssAfter = CurrentRssKB();
+	result.m_rssGrowthKB = rssAfter > rssBefore ? rssAfter - rssBefore : 0;
+	std::cerr << agentName << "/" << environmentName << ": " << uint64_t(result.m_stats.stepsPerSecond()) << " steps/s" << std::endl;
+	results.push_back(result);
+}
+
+template<typename Env_t>
+void BenchTabular(std::vector<BenchResult>& results, const BenchConfig& config, const std::string& environmentName)
+{
+	typedef uint32_t State_t;
+	typedef typename Env_t::Action_t Action_t;
+	typedef rltl::impl::ActionValueTable<State_t, Action_t> Table_t;
+	typedef rltl::impl::EpsilonGreedy<State_t, Action_t> EpsilonGreedy_t;
+	auto makeTable = [](paf::SharedPtr<Env_t> env)
+	{
+		paf::SharedPtr<rltl::impl::IndexSpace<State_t>> stateSpace = env->stateSpace();
+		paf::SharedPtr<rltl::impl::IndexSpace<Action_t>> actionSpace = env->actionSpace();
+		return paf::SharedPtr<Table_t>::Make(uint32_t(stateSpace->count()), uint32_t(actionSpace->count()));
+	};
+	auto makePolicy = [](paf::SharedPtr<Table_t> table)
+	{
+		return EpsilonGreedy_t::Make(rltl::impl::GreedyAction<State_t, Action_t>::Make(table), 0.1f);
+	};
+
+	typedef typename rltl::impl::QLearning<State_t, Action_t>::QLearningPtr QLearningPtr;
+	RunBench<Env_t, QLearningPtr>(results, config, "q_learning", environmentName, [&](paf::SharedPtr<Env_t> env)
+		{
+			auto table = makeTable(env);
+			return rltl::impl::QLearning<State_t, Action_t>::Make(table, makePolicy(table), 0.1f, 0.98f);
+		});
+	typedef typename rltl::impl::Sarsa<State_t, Action_t>::SarsaPtr SarsaPtr;
+	RunBench<Env_t, SarsaPtr>(results, config, "sarsa", environmentName, [&](paf::SharedPtr<Env_t> env)
+		{
+			auto table = makeTable(env);
+			return rltl::impl::Sarsa<State_t, Action_t>::Make(table, makePolicy(table), 0.1f, 0.98f);
+		});
+	typedef typename rltl::impl::ExpectedSarsa<State_t, Action_t>::ExpectedSarsaPtr ExpectedSarsaPtr;
+	RunBench<Env_t, ExpectedSarsaPtr>(results, config, "expected_sarsa", environmentName, [&](paf::SharedPtr<Env_t> env)
+		{
+			auto table = makeTable(env);
+			return rltl::impl::ExpectedSarsa<State_t, Action_t>::Make(table, makePolicy(table), 0.1f, 0.98f);
+		});
+}
+
+template<typename Env_t>
+void BenchDeep(std::vector<BenchResult>& results, const BenchConfig& config, const std::string& environmentName)
+{
+	typedef typename Env_t::State_t State_t;
+	typedef typename Env_t::Action_t Action_t;
+	typedef rltl::impl::MLPActionValueNet<State_t, Action_t> ActionValueNet;
+	typedef rltl::impl::MLPPolicyNet<State_t, Action_t> PolicyNet;
+	typedef rltl::impl::MLPStateValueNet<State_t> StateValueNet;
+	typedef rltl::impl::DeepQNetwork<rltl::impl::TargetEvaluationMethod::q_learning, ActionValueNet> DQN;
+	typedef rltl::impl::DeepActorCritic<PolicyNet, StateValueNet> ActorCritic;
+	typedef rltl::impl::DeepReinforce<State_t, Action_t> Reinforce;
+	const uint32_t stateDim = uint32_t(State_t::t_size);
+	auto actionCount = [](paf::SharedPtr<Env_t> env)
+	{
+		paf::SharedPtr<rltl::impl::IndexSpace<Action_t>> actionSpace = env->actionSpace();
+		return uint32_t(actionSpace->count());
+	};
+
+	struct DQNMode
+	{
+		const char* m_name;
+		rltl::impl::ExperienceReplay m_experienceReplay;
+		float m_targetNetTau;
+		uint32_t m_prefetchBatches;
+	};
+	const DQNMode dqnModes[] = {
+		{ "dqn", rltl::impl::ExperienceReplay::no_experience_replay, 0, 0 },
+		{ "dqn_replay", rltl::impl::ExperienceReplay::experience_replay, 0, 0 },
+		{ "dqn_replay_soft_target", rltl::impl::ExperienceReplay::experience_replay, 0.005f, 0 },
+		{ "dqn_prioritized_replay", rltl::impl::ExperienceReplay::prioritized_experience_replay, 0, 0 },
+		{ "dqn_replay_prefetch", rltl::impl::ExperienceReplay::experience_replay, 0, 2 },
+		{ "dqn_prioritized_replay_prefetch", rltl::impl::ExperienceReplay::prioritized_experience_replay, 0, 2 },
+	};
+	for (const DQNMode& mode : dqnModes)
+	{
+		RunBench<Env_t, typename DQN::DeepQNetworkPtr>(results, config, mode.m_name, environmentName, [&](paf::SharedPtr<Env_t> env)
+			{
+				auto valueNet = ActionValueNet::Make(stateDim, actionCount(env), 128, 1, false);
+				std::shared_ptr<torch::optim::AdamW> optimizer(new torch::optim::AdamW((*valueNet)->parameters(), torch::optim::AdamWOptions(1e-3)));
+				auto policy = rltl::impl::EpsilonGreedy<State_t, Action_t>::Make(rltl::impl::GreedyAction<State_t, Action_t>::Make(valueNet), 0.1f);
+				rltl::impl::DeepQLearningOptions options(0.98, 64, false);
+				options.targetNetwork(5);
+				options.softTargetNetwork(mode.m_targetNetTau);
+				options.prefetchBatches(mode.m_prefetchBatches);
+				switch (mode.m_experienceReplay)
+				{
+				case rltl::impl::ExperienceReplay::experience_replay:
+					options.experienceReplay(10000, 500, 5);
+					break;
+				case rltl::impl::ExperienceReplay::prioritized_experience_replay:
+					options.prioritizedExperienceReplay(10000, 500, 5, 0.6f, 0.4f);
+					break;
+				default:
+					break;
+				}
+				return DQN::Make(valueNet, optimizer, policy, options);
+			});
+	}
+	RunBench<Env_t, typename ActorCritic::DeepActorCriticPtr>(results, config, "actor_critic", environmentName, [&](paf::SharedPtr<Env_t> env)
+		{
+			auto actorNet = PolicyNet::Make(stateDim, actionCount(env), 128, 1);
+			auto criticNet = StateValueNet::Make(stateDim, 128, 1);
+			std::shared_ptr<torch::optim::Adam> optimizer(new torch::optim::Adam({
+				torch::optim::OptimizerParamGroup((*actorNet)->parameters(), std::make_unique<torch::optim::AdamOptions>(torch::optim::AdamOptions(1e-3))),
+				torch::optim::OptimizerParamGroup((*criticNet)->parameters(), std::make_unique<torch::optim::AdamOptions>(torch::optim::AdamOptions(1e-3)))
+				}));
+			rltl::impl::DeepActorCriticOptions options(0.98, 16);
+			return ActorCritic::Make(actorNet, criticNet, optimizer, actorNet, options);
+		});
+	RunBench<Env_t, typename Reinforce::DeepReinforcePtr>(results, config, "reinforce", environmentName, [&](paf::SharedPtr<Env_t> env)
+		{
+			auto policyNet = PolicyNet::Make(stateDim, actionCount(env), 128, 1);
+			std::shared_ptr<torch::optim::Adam> optimizer(new torch::optim::Adam((*policyNet)->parameters(), torch::optim::AdamOptions(1e-3)));
+			return Reinforce::Make(policyNet, optimizer, policyNet, rltl::impl::ReinforceOptions(0.98f));
+		});
+}
+
+void WriteJson(std::ostream& stream, const BenchConfig& config, const std::vector<BenchResult>& results)
+{
+	stream << "{\n";
+	stream << "  \"steps\": " << config.m_steps << ",\n";
+	stream << "  \"seconds\": " << config.m_seconds << ",\n";
+	stream << "  \"seed\": " << config.m_seed << ",\n";
+	stream << "  \"threads\": " << config.m_threads << ",\n";
+	stream << "  \"peak_rss_kb\": " << PeakRssKB() << ",\n";
+	stream << "  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const BenchResult& result = results[i];
+		stream << "    {\"agent\": \"" << result.m_agent << "\", \"environment\": \"" << result.m_environment << "\""
+			<< ", \"steps\": " << result.m_stats.m_numSteps
+			<< ", \"episodes\": " << result.m_stats.m_numEpisodes
+			<< ", \"updates\": " << result.m_stats.m_numUpdates
+			<< ", \"seconds\": " << result.m_stats.m_seconds
+			<< ", \"steps_per_second\": " << result.m_stats.stepsPerSecond()
+			<< ", \"updates_per_second\": " << result.m_stats.updatesPerSecond()
+			<< ", \"step_latency_p50_ns\": " << result.m_p50Ns
+			<< ", \"step_latency_p99_ns\": " << result.m_p99Ns
+			<< ", \"rss_growth_kb\": " << result.m_rssGrowthKB
+			<< "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	stream << "  ]\n";
+	stream << "}\n";
+}
+
+int main(int argc, char* argv[])
+{
+	BenchConfig config;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (0 == strcmp(argv[i], "--steps"))
+		{
+			config.m_steps = strtoull(argv[i + 1], nullptr, 10);
+		}
+		else if (0 == strcmp(argv[i], "--seconds"))
+		{
+			config.m_seconds = atof(argv[i + 1]);
+		}
+		else if (0 == strcmp(argv[i], "--seed"))
+		{
+			config.m_seed = uint32_t(atoi(argv[i + 1]));
+		}
+		else if (0 == strcmp(argv[i], "--threads"))
+		{
+			config.m_threads = atoi(argv[i + 1]);
+		}
+		else if (0 == strcmp(argv[i], "--filter"))
+		{
+			config.m_filter = argv[i + 1];
+		}
+		else if (0 == strcmp(argv[i], "--out"))
+		{
+			config.m_out = argv[i + 1];
+		}
+	}
+	torch::set_num_threads(config.m_threads);
+
+	std::vector<BenchResult> results;
+	try
+	{
+		BenchTabular<DiscretizedEnvironment<NullEnvironment<>>>(results, config, "null");
+		BenchTabular<DiscretizedEnvironment<CartPole>>(results, config, "cart_pole");
+		BenchTabular<DiscretizedEnvironment<MountainCar>>(results, config, "mountain_car");
+		BenchTabular<CliffWalking>(results, config, "cliff_walking");
+		BenchDeep<NullEnvironment<>>(results, config, "null");
+		BenchDeep<CartPole>(results, config, "cart_pole");
+		BenchDeep<MountainCar>(results, config, "mountain_car");
+		BenchDeep<OneHotEnvironment<CliffWalking, 4 * 12>>(results, config, "cliff_walking");
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	if (config.m_out.empty())
+	{
+		WriteJson(std::cout, config, results);
+	}
+	else
+	{
+		std::ofstream stream(config.m_out);
+		WriteJson(stream, config, results);
+	}
+	return 0;
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include "../rltl/impl/environment.h"
+#include "../rltl/impl/array.h"
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+//does no work at all, isolates the per-step cost of the framework
+template<size_t t_stateDim = 4>
+class NullEnvironment : public rltl::impl::Environment<rltl::impl::Array<float, t_stateDim>, uint32_t>
+{
+public:
+	typedef rltl::impl::Array<float, t_stateDim> State_t;
+	typedef uint32_t Action_t;
+	typedef rltl::impl::Environment<State_t, Action_t> Environment_t;
+	typedef typename Environment_t::StateSpacePtr StateSpacePtr;
+	typedef typename Environment_t::ActionSpacePtr ActionSpacePtr;
+	typedef rltl::impl::VectorSpace<State_t> ConcreteStateSpace_t;
+	typedef rltl::impl::IndexSpace<Action_t> ConcreteActionSpace_t;
+	typedef paf::SharedPtr<ConcreteStateSpace_t> ConcreteStateSpacePtr;
+	typedef paf::SharedPtr<ConcreteActionSpace_t> ConcreteActionSpacePtr;
+public:
+	NullEnvironment(uint32_t maxStep = 200, uint32_t actionCount = 2) :
+		m_maxStep(maxStep),
+		m_step(0)
+	{
+		State_t low, high;
+		for (size_t i = 0; i < t_stateDim; ++i)
+		{
+			low[i] = -1;
+			high[i] = 1;
+			m_state[i] = 0;
+		}
+		m_stateSpace = ConcreteStateSpacePtr::Make(low, high);
+		m_actionSpace = ConcreteActionSpacePtr::Make(actionCount);
+	}
+public:
+	StateSpacePtr stateSpace() override
+	{
+		return m_stateSpace;
+	}
+	ActionSpacePtr actionSpace() override
+	{
+		return m_actionSpace;
+	}
+	State_t reset(int seed = 0) override
+	{
+		m_step = 0;
+		return m_state;
+	}
+	rltl::impl::EnvironmentStatus step(float& reward, State_t& nextState, const Action_t& action) override
+	{
+		reward = 1;
+		nextState = m_state;
+		return ++m_step < m_maxStep ? rltl::impl::EnvironmentStatus::es_normal : rltl::impl::EnvironmentStatus::es_truncated;
+	}
+	void close() override
+	{}
+protected:
+	ConcreteStateSpacePtr m_stateSpace;
+	ConcreteActionSpacePtr m_actionSpace;
+	State_t m_state;
+	uint32_t m_maxStep;
+	uint32_t m_step;
+};
+
+//maps a vector state to a table index, every dimension is squashed by tanh and split into t_bins bins
+template<typename Environment_t, size_t t_bins = 6>
+class DiscretizedEnvironment : public rltl::impl::Environment<uint32_t, typename Environment_t::Action_t>
+{
+public:
+	typedef typename Environment_t::State_t SrcState_t;
+	typedef uint32_t State_t;
+	typedef typename Environment_t::Action_t Action_t;
+	typedef rltl::impl::Environment<State_t, Action_t> Base_t;
+	typedef typename Base_t::StateSpacePtr StateSpacePtr;
+	typedef typename Base_t::ActionSpacePtr ActionSpacePtr;
+	typedef rltl::impl::IndexSpace<State_t> ConcreteStateSpace_t;
+	typedef paf::SharedPtr<ConcreteStateSpace_t> ConcreteStateSpacePtr;
+	static const size_t t_stateDim = SrcState_t::t_size;
+public:
+	DiscretizedEnvironment()
+	{
+		uint32_t count = 1;
+		for (size_t i = 0; i < t_stateDim; ++i)
+		{
+			count *= t_bins;
+		}
+		m_stateSpace = ConcreteStateSpacePtr::Make(count);
+	}
+public:
+	StateSpacePtr stateSpace() override
+	{
+		return m_stateSpace;
+	}
+	ActionSpacePtr actionSpace() override
+	{
+		return m_environment.actionSpace();
+	}
+	State_t reset(int seed = 0) override
+	{
+		return toIndex(m_environment.reset(seed));
+	}
+	rltl::impl::EnvironmentStatus step(float& reward, State_t& nextState, const Action_t& action) override
+	{
+		SrcState_t srcNextState;
+		rltl::impl::EnvironmentStatus status = m_environment.step(reward, srcNextState, action);
+		nextState = toIndex(srcNextState);
+		return status;
+	}
+	void close() override
+	{
+		m_environment.close();
+	}
+protected:
+	State_t toIndex(const SrcState_t& state) const
+	{
+		State_t index = 0;
+		for (size_t i = 0; i < t_stateDim; ++i)
+		{
+			float unit = (tanhf(float(state[i])) + 1.0f) * 0.5f;
+			State_t bin = std::min(State_t(unit * t_bins), State_t(t_bins - 1));
+			index = index * t_bins + bin;
+		}
+		return index;
+	}
+protected:
+	Environment_t m_environment;
+	ConcreteStateSpacePtr m_stateSpace;
+};
+
+//maps a table index state to a one-hot vector so that the neural network agents can run on it
+template<typename Environment_t, size_t t_stateCount>
+class OneHotEnvironment : public rltl::impl::Environment<rltl::impl::Array<float, t_stateCount>, typename Environment_t::Action_t>
+{
+public:
+	typedef typename Environment_t::State_t SrcState_t;
+	typedef rltl::impl::Array<float, t_stateCount> State_t;
+	typedef typename Environment_t::Action_t Action_t;
+	typedef rltl::impl::Environment<State_t, Action_t> Base_t;
+	typedef typename Base_t::StateSpacePtr StateSpacePtr;
+	typedef typename Base_t::ActionSpacePtr ActionSpacePtr;
+	typedef rltl::impl::VectorSpace<State_t> ConcreteStateSpace_t;
+	typedef paf::SharedPtr<ConcreteStateSpace_t> ConcreteStateSpacePtr;
+public:
+	OneHotEnvironment()
+	{
+		State_t low, high;
+		for (size_t i = 0; i < t_stateCount; ++i)
+		{
+			low[i] = 0;
+			high[i] = 1;
+		}
+		m_stateSpace = ConcreteStateSpacePtr::Make(low, high);
+	}
+public:
+	StateSpacePtr stateSpace() override
+	{
+		return m_stateSpace;
+	}
+	ActionSpacePtr actionSpace() override
+	{
+		return m_environment.actionSpace();
+	}
+	State_t reset(int seed = 0) override
+	{
+		return toOneHot(m_environment.reset(seed));
+	}
+	rltl::impl::EnvironmentStatus step(float& reward, State_t& nextState, const Action_t& action) override
+	{
+		SrcState_t srcNextState;
+		rltl::impl::EnvironmentStatus status = m_environment.step(reward, srcNextState, action);
+		nextState = toOneHot(srcNextState);
+		return status;
+	}
+	void close() override
+	{
+		m_environment.close();
+	}
+protected:
+	static State_t toOneHot(const SrcState_t& state)
+	{
+		assert(state < t_stateCount);
+		State_t oneHot;
+		for (size_t i = 0; i < t_stateCount; ++i)
+		{
+			oneHot[i] = 0;
+		}
+		oneHot[state] = 1;
+		return oneHot;
+	}
+protected:
+	Environment_t m_environment;
+	ConcreteStateSpacePtr m_stateSpace;
+};
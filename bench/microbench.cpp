@@ -0,0 +1,827 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+
+#include "../rltl/impl/trajectory_buffer.h"
+#include "../rltl/impl/sequential_trajectory_buffer.h"
+#include "../rltl/impl/concurrent_trajectory_buffer.h"
+#include "../rltl/impl/sharded_trajectory_buffer.h"
+#include "../rltl/impl/replay_service.h"
+#include "../rltl/impl/multi_step_buffer.h"
+#include "../rltl/impl/neural_network.h"
+#include "../rltl/impl/action_value_net.h"
+#include "../rltl/impl/policy_net.h"
+
+//usage: rltl_microbench [--min-capacity N] [--max-capacity N] [--max-bytes N] [--iterations N] [--out file.json]
+//capacity is swept in powers of ten from 1e3 to 1e8 by default, configurations whose buffer would exceed --max-bytes are skipped
+//sum_tree_* ops time the binary and wide priority trees alone at 1M and 100M leaves
+//append_concurrent and append_mutex report wall time per append, their batch_size column is the writer thread count
+//append_sharded spreads the same writers over 4 shards, sample_batch_sharded splits each batch over the 4 shards
+//service_* ops go through a ReplayServer and ReplayClient in this process over a unix socket, posix only
+//action_* ops time single state action selection on CartPole sized MLPs, their capacity column is the hidden width
+
+struct MicroBenchConfig
+{
+	uint64_t m_minCapacity{ 1000 };
+	uint64_t m_maxCapacity{ 100000000 };
+	uint64_t m_maxBytes{ uint64_t(1) << 31 };
+	uint64_t m_iterations{ 1000000 };
+	std::string m_out;
+};
+
+struct MicroBenchResult
+{
+	std::string m_op;
+	std::string m_state;
+	uint64_t m_capacity;
+	uint32_t m_batchSize;
+	double m_nsPerOp;
+	double m_bytesPerOp;
+};
+
+//exposes the sum tree of TrajectoryBuffer so it can be timed without the tensor copies
+template<typename State_t>
+class TrajectoryBufferProbe : public rltl::impl::TrajectoryBuffer<State_t, uint32_t>
+{
+public:
+	typedef rltl::impl::TrajectoryBuffer<State_t, uint32_t> Base_t;
+	using Base_t::sampleIndexSumTree;
+	using Base_t::updatePriority;
+	using Base_t::m_capacity;
+	using Base_t::m_sumTree;
+};
+
+template<typename Func_t>
+double TimeNsPerOp(uint64_t ops, Func_t func)
+{
+	auto start = std::chrono::steady_clock::now();
+	func();
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	return ops > 0 ? ns / double(ops) : 0;
+}
+
+//keeps the optimizer from dropping the timed loops
+static volatile uint64_t s_sink;
+
+template<typename State_t>
+void BenchTrajectoryBuffer(std::vector<MicroBenchResult>& results, const MicroBenchConfig& config, const char* stateName)
+{
+	typedef uint32_t Action_t;
+	const double transitionBytes = double(sizeof(State_t) * 2 + sizeof(Action_t) + sizeof(float) * 2);
+	const uint32_t batchSizes[] = { 32, 256, 1024 };
+	for (uint64_t capacity = config.m_minCapacity; capacity <= config.m_maxCapacity; capacity *= 10)
+	{
+		uint64_t alignedCapacity = 2;
+		while (alignedCapacity < capacity)
+		{
+			alignedCapacity *= 2;
+		}
+		double bufferBytes = double(alignedCapacity) * (transitionBytes + sizeof(float) + sizeof(double));
+		if (bufferBytes > double(config.m_maxBytes))
+		{
+			std::cerr << "skip " << stateName << " capacity " << capacity << ": " << uint64_t(bufferBytes) << " bytes" << std::endl;
+			continue;
+		}
+		double treeDepth = std::log2(double(alignedCapacity));
+		TrajectoryBufferProbe<State_t> buffer;
+		double ns = TimeNsPerOp(1, [&]()
+			{
+				buffer.initialize(uint32_t(capacity), false, true);
+			});
+		results.push_back({ "initialize", stateName, capacity, 1, ns, double(buffer.allocatedBytes()) });
+		State_t state{};
+		ns = TimeNsPerOp(alignedCapacity, [&]()
+			{
+				for (uint64_t i = 0; i < alignedCapacity; ++i)
+				{
+					buffer.append(state, Action_t(i & 1), 1.0f, state, 0.99f);
+				}
+			});
+		results.push_back({ "append", stateName, capacity, 1, ns, transitionBytes + sizeof(float) + treeDepth * sizeof(double) });
+		results.push_back({ "allocated_bytes", stateName, capacity, 1, 0, double(buffer.allocatedBytes()) });
+
+		std::vector<uint32_t> indices(config.m_iterations);
+		for (auto& index : indices)
+		{
+			index = rltl::impl::Random::randuint(buffer.size());
+		}
+		ns = TimeNsPerOp(config.m_iterations, [&]()
+			{
+				for (uint64_t i = 0; i < config.m_iterations; ++i)
+				{
+					buffer.updatePriority(indices[i], float(i % 97) + 0.5f);
+				}
+			});
+		results.push_back({ "update_priority", stateName, capacity, 1, ns, sizeof(float) + treeDepth * sizeof(double) * 3 });
+
+		ns = TimeNsPerOp(config.m_iterations, [&]()
+			{
+				uint64_t sum = 0;
+				for (uint64_t i = 0; i < config.m_iterations; ++i)
+				{
+					sum += buffer.sampleIndexSumTree();
+				}
+				s_sink = sum;
+			});
+		results.push_back({ "sample_index", stateName, capacity, 1, ns, treeDepth * sizeof(double) + sizeof(float) });
+
+		//stratified batch descent, reported per sampled index
+		for (uint32_t batchSize : batchSizes)
+		{
+			std::vector<uint32_t> batchIndices(batchSize);
+			std::vector<float> batchPriorities(batchSize);
+			uint64_t batches = std::max<uint64_t>(config.m_iterations / batchSize, 1);
+			ns = TimeNsPerOp(batches * batchSize, [&]()
+				{
+					uint64_t sum = 0;
+					for (uint64_t i = 0; i < batches; ++i)
+					{
+						buffer.m_sumTree.sample(batchIndices.data(), batchPriorities.data(), batchSize, buffer.size());
+						sum += batchIndices[0];
+					}
+					s_sink = sum;
+				});
+			results.push_back({ "sample_index_batch", stateName, capacity, batchSize, ns, treeDepth * sizeof(double) + sizeof(float) });
+		}
+
+		for (uint32_t batchSize : batchSizes)
+		{
+			if (batchSize > buffer.size())
+			{
+				continue;
+			}
+			std::vector<uint32_t> sampleIndices(batchSize);
+			torch::Tensor stateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+			torch::Tensor actionTensor = rltl::impl::NN_makeTensor<Action_t>(torch::kInt64, batchSize);
+			torch::Tensor rewardTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			torch::Tensor nextStateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+			torch::Tensor nextDiscountTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			torch::Tensor weightTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			uint64_t batches = std::max<uint64_t>(config.m_iterations / batchSize, 1);
+			ns = TimeNsPerOp(batches, [&]()
+				{
+					for (uint64_t i = 0; i < batches; ++i)
+					{
+						buffer.sample(sampleIndices, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor, batchSize, 0.4f);
+					}
+				});
+			double tensorBytes = double(State_t::t_size * sizeof(float) * 2 + sizeof(int64_t) + sizeof(float) * 3);
+			results.push_back({ "sample_batch", stateName, capacity, batchSize, ns, batchSize * (transitionBytes + tensorBytes) });
+		}
+	}
+}
+
+//same sample_batch as above on the columnar layout, batches are gathered with index_select
+template<typename State_t>
+void BenchColumnarTrajectoryBuffer(std::vector<MicroBenchResult>& results, const MicroBenchConfig& config, const char* stateName)
+{
+	typedef uint32_t Action_t;
+	const double transitionBytes = double(State_t::t_size * sizeof(float) * 2 + sizeof(int64_t) + sizeof(float) * 2);
+	const uint32_t batchSizes[] = { 32, 256, 1024 };
+	for (uint64_t capacity = config.m_minCapacity; capacity <= config.m_maxCapacity; capacity *= 10)
+	{
+		uint64_t alignedCapacity = 2;
+		while (alignedCapacity < capacity)
+		{
+			alignedCapacity *= 2;
+		}
+		double bufferBytes = double(alignedCapacity) * (transitionBytes + sizeof(float) + sizeof(double));
+		if (bufferBytes > double(config.m_maxBytes))
+		{
+			continue;
+		}
+		rltl::impl::TrajectoryBuffer<State_t, Action_t> buffer;
+		buffer.initialize(uint32_t(capacity), false, true, true);
+		State_t state{};
+		double ns = TimeNsPerOp(alignedCapacity, [&]()
+			{
+				for (uint64_t i = 0; i < alignedCapacity; ++i)
+				{
+					buffer.append(state, Action_t(i & 1), 1.0f, state, 0.99f);
+				}
+			});
+		results.push_back({ "append_columnar", stateName, capacity, 1, ns, transitionBytes });
+
+		for (uint32_t batchSize : batchSizes)
+		{
+			if (batchSize > buffer.size())
+			{
+				continue;
+			}
+			std::vector<uint32_t> sampleIndices(batchSize);
+			torch::Tensor stateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+			torch::Tensor actionTensor = rltl::impl::NN_makeTensor<Action_t>(torch::kInt64, batchSize);
+			torch::Tensor rewardTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			torch::Tensor nextStateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+			torch::Tensor nextDiscountTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			torch::Tensor weightTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			uint64_t batches = std::max<uint64_t>(config.m_iterations / batchSize, 1);
+			ns = TimeNsPerOp(batches, [&]()
+				{
+					for (uint64_t i = 0; i < batches; ++i)
+					{
+						buffer.sample(sampleIndices, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor, batchSize, 0.4f);
+					}
+				});
+			results.push_back({ "sample_batch_columnar", stateName, capacity, batchSize, ns, batchSize * transitionBytes * 2 });
+		}
+	}
+}
+
+//sequential storage of the same transitions, episodes of 200 steps with 3-step targets rebuilt at sample time
+template<typename State_t>
+void BenchSequentialTrajectoryBuffer(std::vector<MicroBenchResult>& results, const MicroBenchConfig& config, const char* stateName)
+{
+	typedef uint32_t Action_t;
+	const uint32_t episodeLength = 200;
+	const double slotBytes = double(sizeof(State_t) + sizeof(Action_t) + sizeof(float) + sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint64_t));
+	const uint32_t batchSizes[] = { 32, 256, 1024 };
+	for (uint64_t capacity = config.m_minCapacity; capacity <= config.m_maxCapacity; capacity *= 10)
+	{
+		uint64_t alignedCapacity = 2;
+		while (alignedCapacity < capacity)
+		{
+			alignedCapacity *= 2;
+		}
+		double bufferBytes = double(alignedCapacity) * (slotBytes + sizeof(float) + sizeof(double));
+		if (bufferBytes > double(config.m_maxBytes))
+		{
+			continue;
+		}
+		rltl::impl::SequentialTrajectoryBuffer<State_t, Action_t> buffer;
+		buffer.initialize(uint32_t(capacity), 3, false, 0.99f, true);
+		State_t state{};
+		double ns = TimeNsPerOp(alignedCapacity, [&]()
+			{
+				for (uint64_t i = 0; i < alignedCapacity; ++i)
+				{
+					if (episodeLength - 1 == i % episodeLength)
+					{
+						buffer.endEpisode(0, state, true);
+					}
+					else
+					{
+						buffer.append(0, state, Action_t(i & 1), 1.0f);
+					}
+				}
+			});
+		results.push_back({ "append_sequential", stateName, capacity, 1, ns, slotBytes });
+		results.push_back({ "allocated_bytes_sequential", stateName, capacity, 1, 0, double(buffer.allocatedBytes()) });
+
+		for (uint32_t batchSize : batchSizes)
+		{
+			if (batchSize > buffer.size())
+			{
+				continue;
+			}
+			std::vector<uint32_t> sampleIndices(batchSize);
+			torch::Tensor stateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+			torch::Tensor actionTensor = rltl::impl::NN_makeTensor<Action_t>(torch::kInt64, batchSize);
+			torch::Tensor rewardTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			torch::Tensor nextStateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+			torch::Tensor nextDiscountTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			torch::Tensor weightTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			uint64_t batches = std::max<uint64_t>(config.m_iterations / batchSize, 1);
+			ns = TimeNsPerOp(batches, [&]()
+				{
+					for (uint64_t i = 0; i < batches; ++i)
+					{
+						buffer.sample(sampleIndices, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor, batchSize, 0.4f);
+					}
+				});
+			double tensorBytes = double(State_t::t_size * sizeof(float) * 2 + sizeof(int64_t) + sizeof(float) * 3);
+			results.push_back({ "sample_batch_sequential", stateName, capacity, batchSize, ns, batchSize * (slotBytes * 4 + tensorBytes) });
+		}
+	}
+}
+
+//prioritized appends from 1, 8 and 32 threads into ConcurrentTrajectoryBuffer and into a TrajectoryBuffer behind one mutex
+template<typename State_t>
+void BenchConcurrentTrajectoryBuffer(std::vector<MicroBenchResult>& results, const MicroBenchConfig& config, const char* stateName)
+{
+	typedef uint32_t Action_t;
+	const double transitionBytes = double(sizeof(State_t) * 2 + sizeof(Action_t) + sizeof(float) * 2);
+	const uint32_t writerCounts[] = { 1, 8, 32 };
+	for (uint64_t capacity = config.m_minCapacity; capacity <= config.m_maxCapacity; capacity *= 10)
+	{
+		double bufferBytes = double(capacity) * (transitionBytes + sizeof(uint64_t) + sizeof(double) * 2);
+		if (bufferBytes > double(config.m_maxBytes))
+		{
+			continue;
+		}
+		for (uint32_t writerCount : writerCounts)
+		{
+			uint64_t appendsPerWriter = std::max<uint64_t>(config.m_iterations / writerCount, 1);
+			State_t state{};
+			std::vector<std::thread> writers;
+			rltl::impl::ConcurrentTrajectoryBuffer<State_t, Action_t> concurrentBuffer;
+			concurrentBuffer.initialize(uint32_t(capacity), true);
+			double ns = TimeNsPerOp(appendsPerWriter * writerCount, [&]()
+				{
+					for (uint32_t i = 0; i < writerCount; ++i)
+					{
+						writers.emplace_back([&]()
+							{
+								for (uint64_t j = 0; j < appendsPerWriter; ++j)
+								{
+									concurrentBuffer.append(state, Action_t(j & 1), 1.0f, state, 0.99f);
+								}
+							});
+					}
+					for (std::thread& writer : writers)
+					{
+						writer.join();
+					}
+				});
+			results.push_back({ "append_concurrent", stateName, capacity, writerCount, ns, transitionBytes });
+
+			writers.clear();
+			std::mutex mutex;
+			rltl::impl::TrajectoryBuffer<State_t, Action_t> buffer;
+			buffer.initialize(uint32_t(capacity), false, true);
+			ns = TimeNsPerOp(appendsPerWriter * writerCount, [&]()
+				{
+					for (uint32_t i = 0; i < writerCount; ++i)
+					{
+						writers.emplace_back([&]()
+							{
+								for (uint64_t j = 0; j < appendsPerWriter; ++j)
+								{
+									std::lock_guard<std::mutex> lock(mutex);
+									buffer.append(state, Action_t(j & 1), 1.0f, state, 0.99f);
+								}
+							});
+					}
+					for (std::thread& writer : writers)
+					{
+						writer.join();
+					}
+				});
+			results.push_back({ "append_mutex", stateName, capacity, writerCount, ns, transitionBytes });
+		}
+	}
+}
+
+//prioritized appends from 1, 8 and 32 threads into a ShardedTrajectoryBuffer of 4 shards, writer i appends to shard i % 4,
+//then prioritized batches drawn from all shards followed by their priority update
+template<typename State_t>
+void BenchShardedTrajectoryBuffer(std::vector<MicroBenchResult>& results, const MicroBenchConfig& config, const char* stateName)
+{
+	typedef uint32_t Action_t;
+	const uint32_t numShards = 4;
+	const double transitionBytes = double(sizeof(State_t) * 2 + sizeof(Action_t) + sizeof(float) * 2);
+	const uint32_t writerCounts[] = { 1, 8, 32 };
+	const uint32_t batchSizes[] = { 32, 256 };
+	for (uint64_t capacity = config.m_minCapacity; capacity <= config.m_maxCapacity; capacity *= 10)
+	{
+		double bufferBytes = double(capacity) * (transitionBytes + sizeof(float) + sizeof(double) * 2);
+		if (bufferBytes > double(config.m_maxBytes))
+		{
+			continue;
+		}
+		State_t state{};
+		rltl::impl::ShardedTrajectoryBuffer<State_t, Action_t> buffer;
+		buffer.initialize(numShards, uint32_t(capacity), false, true);
+		for (uint32_t writerCount : writerCounts)
+		{
+			uint64_t appendsPerWriter = std::max<uint64_t>(config.m_iterations / writerCount, 1);
+			std::vector<std::thread> writers;
+			double ns = TimeNsPerOp(appendsPerWriter * writerCount, [&]()
+				{
+					for (uint32_t i = 0; i < writerCount; ++i)
+					{
+						writers.emplace_back([&, i]()
+							{
+								uint32_t shard = buffer.shardOf(i);
+								buffer.pinToShard(shard);
+								for (uint64_t j = 0; j < appendsPerWriter; ++j)
+								{
+									buffer.append(shard, state, Action_t(j & 1), 1.0f, state, 0.99f);
+								}
+							});
+					}
+					for (std::thread& writer : writers)
+					{
+						writer.join();
+					}
+				});
+			results.push_back({ "append_sharded", stateName, capacity, writerCount, ns, transitionBytes });
+		}
+		for (uint32_t batchSize : batchSizes)
+		{
+			std::vector<uint32_t> sampleIndices(batchSize);
+			torch::Tensor stateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+			torch::Tensor actionTensor = rltl::impl::NN_makeTensor<Action_t>(torch::kInt64, batchSize);
+			torch::Tensor rewardTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			torch::Tensor nextStateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+			torch::Tensor nextDiscountTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			torch::Tensor weightTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+			torch::Tensor deltaTensor = torch::ones({ int64_t(batchSize), 1 });
+			uint64_t batches = std::max<uint64_t>(config.m_iterations / batchSize, 1);
+			double ns = TimeNsPerOp(batches, [&]()
+				{
+					for (uint64_t i = 0; i < batches; ++i)
+					{
+						buffer.sample(sampleIndices, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor, batchSize, 0.4f);
+						buffer.updatePriorities(sampleIndices, deltaTensor, batchSize, 0.6f, 1e-3f);
+					}
+				});
+			double tensorBytes = double(State_t::t_size * sizeof(float) * 2 + sizeof(int64_t) + sizeof(float) * 3);
+			results.push_back({ "sample_batch_sharded", stateName, capacity, batchSize, ns, batchSize * (transitionBytes + tensorBytes) });
+		}
+	}
+}
+
+#ifndef _WIN32
+//loopback replay service: inserts are reported per transition with batch_size transitions per insert,
+//samples per batch including the priority update which follows each one
+template<typename State_t>
+void BenchReplayService(std::vector<MicroBenchResult>& results, const MicroBenchConfig& config, const char* stateName)
+{
+	typedef uint32_t Action_t;
+	const char* socketPath = "/tmp/rltl_microbench.sock";
+	const uint32_t batchSizes[] = { 32, 256 };
+	const double transitionBytes = double(sizeof(State_t) * 2 + sizeof(Action_t) + sizeof(float) * 2);
+	//the largest capacity of the sweep whose buffer fits in --max-bytes
+	uint64_t capacity = config.m_maxCapacity;
+	while (double(capacity) * (transitionBytes + sizeof(float) + sizeof(double)) > double(config.m_maxBytes))
+	{
+		capacity /= 10;
+		if (capacity < config.m_minCapacity)
+		{
+			return;
+		}
+	}
+	rltl::impl::ReplayServer<State_t, Action_t> server;
+	if (!server.start(socketPath, uint32_t(capacity), true))
+	{
+		std::cerr << "skip service " << stateName << ": can not listen on " << socketPath << std::endl;
+		return;
+	}
+	rltl::impl::ReplayClient<State_t, Action_t> client;
+	if (!client.connect(socketPath, 8, 256))
+	{
+		std::cerr << "skip service " << stateName << ": can not connect" << std::endl;
+		return;
+	}
+	State_t state{};
+	for (uint32_t batchSize : batchSizes)
+	{
+		rltl::impl::TransitionBatch<State_t, Action_t> batch;
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			batch.append(state, Action_t(i & 1), 1.0f, state, 0.99f);
+		}
+		uint64_t inserts = std::max<uint64_t>(config.m_iterations / batchSize, 1);
+		double ns = TimeNsPerOp(inserts * batchSize, [&]()
+			{
+				for (uint64_t i = 0; i < inserts; ++i)
+				{
+					client.appendTransitions(batch);
+				}
+				//the last pipelined inserts are waited for by the size request
+				s_sink = client.size();
+			});
+		results.push_back({ "service_insert", stateName, capacity, batchSize, ns, transitionBytes });
+	}
+	for (uint32_t batchSize : batchSizes)
+	{
+		std::vector<uint32_t> sampleIndices(batchSize);
+		torch::Tensor stateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+		torch::Tensor actionTensor = rltl::impl::NN_makeTensor<Action_t>(torch::kInt64, batchSize);
+		torch::Tensor rewardTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+		torch::Tensor nextStateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+		torch::Tensor nextDiscountTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+		torch::Tensor weightTensor = rltl::impl::NN_makeTensor<float>(torch::kFloat32, batchSize);
+		torch::Tensor deltaTensor = torch::ones({ int64_t(batchSize), 1 });
+		uint64_t batches = std::max<uint64_t>(config.m_iterations / batchSize / 10, 1);
+		double ns = TimeNsPerOp(batches, [&]()
+			{
+				for (uint64_t i = 0; i < batches; ++i)
+				{
+					client.sample(sampleIndices, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor, batchSize, 0.4f);
+					client.updatePriorities(sampleIndices, deltaTensor, batchSize, 0.6f, 1e-3f);
+				}
+				s_sink = client.size();
+			});
+		double tensorBytes = double(State_t::t_size * sizeof(float) * 2 + sizeof(int64_t) + sizeof(float) * 3);
+		results.push_back({ "service_sample_batch", stateName, capacity, batchSize, ns, batchSize * (transitionBytes + tensorBytes * 2) });
+	}
+	client.close();
+	server.stop();
+}
+#endif
+
+//binary and wide sum trees alone at 1M and 100M leaves, state column is the tree layout
+template<typename SumTree_t>
+void BenchSumTree(std::vector<MicroBenchResult>& results, const MicroBenchConfig& config, const char* treeName)
+{
+	const uint64_t capacities[] = { 1000000, 100000000 };
+	const uint32_t batchSize = 512;
+	for (uint64_t capacity : capacities)
+	{
+		SumTree_t tree;
+		tree.initialize(SumTree_t::AlignCapacity(uint32_t(capacity)));
+		//both layouts keep a float leaf and about one double per leaf above it
+		if (double(tree.capacity()) * (sizeof(float) + sizeof(double)) > double(config.m_maxBytes))
+		{
+			std::cerr << "skip " << treeName << " capacity " << capacity << std::endl;
+			continue;
+		}
+		for (uint64_t i = 0; i < capacity; ++i)
+		{
+			tree.update(i, float(i % 97) + 0.5f);
+		}
+		results.push_back({ "sum_tree_allocated_bytes", treeName, capacity, 1, 0, double(tree.allocatedBytes()) });
+		std::vector<uint32_t> indices(config.m_iterations);
+		for (auto& index : indices)
+		{
+			index = rltl::impl::Random::randuint(uint32_t(capacity));
+		}
+		double ns = TimeNsPerOp(config.m_iterations, [&]()
+			{
+				for (uint64_t i = 0; i < config.m_iterations; ++i)
+				{
+					tree.update(indices[i], float(i % 89) + 0.5f);
+				}
+			});
+		results.push_back({ "sum_tree_update", treeName, capacity, 1, ns, 0 });
+		//bulk update of sorted batches as they come back from the stratified sample
+		std::vector<uint32_t> updateIndices(batchSize);
+		std::vector<float> updatePriorities(batchSize);
+		uint64_t updateBatches = std::max<uint64_t>(config.m_iterations / batchSize, 1);
+		double updateNs = 0;
+		for (uint64_t i = 0; i < updateBatches; ++i)
+		{
+			tree.sample(updateIndices.data(), updatePriorities.data(), batchSize, uint32_t(capacity));
+			for (uint32_t j = 0; j < batchSize; ++j)
+			{
+				updatePriorities[j] = float((i + j) % 89) + 0.5f;
+			}
+			updateNs += TimeNsPerOp(1, [&]()
+				{
+					tree.update(updateIndices.data(), updatePriorities.data(), batchSize);
+				});
+		}
+		results.push_back({ "sum_tree_update_batch", treeName, capacity, batchSize, updateNs / double(updateBatches * batchSize), 0 });
+		ns = TimeNsPerOp(config.m_iterations, [&]()
+			{
+				uint64_t sum = 0;
+				for (uint64_t i = 0; i < config.m_iterations; ++i)
+				{
+					sum += tree.sample(uint32_t(capacity));
+				}
+				s_sink = sum;
+			});
+		results.push_back({ "sum_tree_sample", treeName, capacity, 1, ns, 0 });
+		std::vector<uint32_t> batchIndices(batchSize);
+		std::vector<float> batchPriorities(batchSize);
+		uint64_t batches = std::max<uint64_t>(config.m_iterations / batchSize, 1);
+		ns = TimeNsPerOp(batches * batchSize, [&]()
+			{
+				uint64_t sum = 0;
+				for (uint64_t i = 0; i < batches; ++i)
+				{
+					tree.sample(batchIndices.data(), batchPriorities.data(), batchSize, uint32_t(capacity));
+					sum += batchIndices[0];
+				}
+				s_sink = sum;
+			});
+		results.push_back({ "sum_tree_sample_batch", treeName, capacity, batchSize, ns, 0 });
+	}
+}
+
+template<typename State_t>
+void BenchTensorAssign(std::vector<MicroBenchResult>& results, const MicroBenchConfig& config, const char* stateName)
+{
+	const uint32_t batchSizes[] = { 1, 32, 256, 1024 };
+	for (uint32_t batchSize : batchSizes)
+	{
+		double bytes = double(batchSize) * (sizeof(State_t) + State_t::t_size * sizeof(float));
+		if (bytes * 2 > double(config.m_maxBytes))
+		{
+			continue;
+		}
+		std::vector<State_t> states(batchSize);
+		torch::Tensor stateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+		uint64_t batches = std::max<uint64_t>(config.m_iterations / batchSize, 1);
+		double ns = TimeNsPerOp(batches, [&]()
+			{
+				for (uint64_t i = 0; i < batches; ++i)
+				{
+					auto stateAccessor = stateTensor.accessor<float, rltl::impl::Array_Dimension<State_t>::dim() + 1>();
+					for (uint32_t j = 0; j < batchSize; ++j)
+					{
+						rltl::impl::Tensor_Assign(stateAccessor[j], states[j]);
+					}
+				}
+			});
+		results.push_back({ "tensor_assign", stateName, 0, batchSize, ns, bytes });
+	}
+}
+
+template<typename State_t>
+void BenchMultiStepBuffer(std::vector<MicroBenchResult>& results, const MicroBenchConfig& config, const char* stateName)
+{
+	typedef uint32_t Action_t;
+	typedef typename rltl::impl::MultiStepBuffer<State_t, Action_t>::SAR SAR;
+	const uint32_t multiSteps[] = { 3, 5, 10 };
+	for (uint32_t multiStep : multiSteps)
+	{
+		rltl::impl::MultiStepBuffer<State_t, Action_t> buffer;
+		buffer.initialize(multiStep);
+		State_t state{};
+		double ns = TimeNsPerOp(config.m_iterations, [&]()
+			{
+				for (uint64_t i = 0; i < config.m_iterations; ++i)
+				{
+					buffer.append(state, Action_t(i & 1), 1.0f, 0.99f);
+				}
+			});
+		results.push_back({ "multi_step_append", stateName, multiStep, 1, ns, double(sizeof(SAR) + (multiStep - 1) * sizeof(float) * 2) });
+	}
+}
+
+template<typename State_t>
+void BenchState(std::vector<MicroBenchResult>& results, const MicroBenchConfig& config, const char* stateName)
+{
+	BenchTrajectoryBuffer<State_t>(results, config, stateName);
+	BenchColumnarTrajectoryBuffer<State_t>(results, config, stateName);
+	BenchSequentialTrajectoryBuffer<State_t>(results, config, stateName);
+	BenchConcurrentTrajectoryBuffer<State_t>(results, config, stateName);
+	BenchShardedTrajectoryBuffer<State_t>(results, config, stateName);
+#ifndef _WIN32
+	BenchReplayService<State_t>(results, config, stateName);
+#endif
+	BenchTensorAssign<State_t>(results, config, stateName);
+	BenchMultiStepBuffer<State_t>(results, config, stateName);
+}
+
+//the per step path before the input tensor was reused: fresh input tensor, grad mode forward, argmax tensor
+template<typename Net_t, typename State_t>
+uint32_t LegacyActionByArgmax(Net_t& net, const State_t& state)
+{
+	torch::Tensor stateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, 1);
+	auto stateAccessor = stateTensor.accessor<float, rltl::impl::Array_Dimension<State_t>::dim() + 1>();
+	rltl::impl::Tensor_Assign(stateAccessor[0], state);
+	torch::Tensor actionTensor = net->actionValue(stateTensor).argmax(1);
+	return uint32_t(actionTensor.accessor<int64_t, 1>()[0]);
+}
+
+template<typename Net_t, typename State_t>
+uint32_t LegacyActionBySoftmax(Net_t& net, const State_t& state)
+{
+	torch::Tensor stateTensor = rltl::impl::NN_makeTensor<State_t>(torch::kFloat32, 1);
+	auto stateAccessor = stateTensor.accessor<float, rltl::impl::Array_Dimension<State_t>::dim() + 1>();
+	rltl::impl::Tensor_Assign(stateAccessor[0], state);
+	torch::Tensor probTensor = torch::nn::functional::softmax(net->logitAction(stateTensor), 1);
+	auto probAccessor = probTensor.accessor<float, 2>();
+	float rnd = rltl::impl::Random::rand();
+	uint32_t count = uint32_t(probTensor.size(1));
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (rnd <= probAccessor[0][i])
+		{
+			return i;
+		}
+		rnd -= probAccessor[0][i];
+	}
+	return count - 1;
+}
+
+void BenchActionSelection(std::vector<MicroBenchResult>& results, const MicroBenchConfig& config)
+{
+	typedef rltl::impl::Array<float, 4> State_t;
+	typedef uint32_t Action_t;
+	const uint32_t hiddenDims[] = { 32, 128, 256 };
+	uint64_t iterations = std::max<uint64_t>(config.m_iterations / 10, 1);
+	std::vector<State_t> states(1024);
+	for (auto& state : states)
+	{
+		for (size_t i = 0; i < State_t::t_size; ++i)
+		{
+			state[i] = rltl::impl::Random::rand() - 0.5f;
+		}
+	}
+	for (uint32_t hiddenDim : hiddenDims)
+	{
+		auto valueNet = rltl::impl::MLPActionValueNet<State_t, Action_t>::Make(4, 2, hiddenDim, 2, false);
+		auto policyNet = rltl::impl::MLPPolicyNet<State_t, Action_t>::Make(4, 2, hiddenDim, 2);
+		double ns = TimeNsPerOp(iterations, [&]()
+			{
+				uint64_t sum = 0;
+				for (uint64_t i = 0; i < iterations; ++i)
+				{
+					sum += LegacyActionByArgmax(*valueNet, states[i & 1023]);
+				}
+				s_sink = sum;
+			});
+		results.push_back({ "action_argmax_legacy", "4", hiddenDim, 1, ns, double(sizeof(State_t)) });
+		ns = TimeNsPerOp(iterations, [&]()
+			{
+				uint64_t sum = 0;
+				for (uint64_t i = 0; i < iterations; ++i)
+				{
+					sum += valueNet->maxAction(states[i & 1023]);
+				}
+				s_sink = sum;
+			});
+		results.push_back({ "action_argmax", "4", hiddenDim, 1, ns, double(sizeof(State_t)) });
+		ns = TimeNsPerOp(iterations, [&]()
+			{
+				uint64_t sum = 0;
+				for (uint64_t i = 0; i < iterations; ++i)
+				{
+					sum += LegacyActionBySoftmax(*policyNet, states[i & 1023]);
+				}
+				s_sink = sum;
+			});
+		results.push_back({ "action_softmax_legacy", "4", hiddenDim, 1, ns, double(sizeof(State_t)) });
+		ns = TimeNsPerOp(iterations, [&]()
+			{
+				uint64_t sum = 0;
+				for (uint64_t i = 0; i < iterations; ++i)
+				{
+					sum += policyNet->takeAction(states[i & 1023]);
+				}
+				s_sink = sum;
+			});
+		results.push_back({ "action_softmax", "4", hiddenDim, 1, ns, double(sizeof(State_t)) });
+	}
+}
+
+void WriteJson(std::ostream& stream, const MicroBenchConfig& config, const std::vector<MicroBenchResult>& results)
+{
+	stream << "{\n";
+	stream << "  \"iterations\": " << config.m_iterations << ",\n";
+	stream << "  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const MicroBenchResult& result = results[i];
+		stream << "    {\"op\": \"" << result.m_op << "\", \"state\": \"" << result.m_state << "\""
+			<< ", \"capacity\": " << result.m_capacity
+			<< ", \"batch_size\": " << result.m_batchSize
+			<< ", \"ns_per_op\": " << result.m_nsPerOp
+			<< ", \"bytes_per_op\": " << result.m_bytesPerOp
+			<< "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	stream << "  ]\n";
+	stream << "}\n";
+}
+
+int main(int argc, char* argv[])
+{
+	MicroBenchConfig config;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (0 == strcmp(argv[i], "--min-capacity"))
+		{
+			config.m_minCapacity = strtoull(argv[i + 1], nullptr, 10);
+		}
+		else if (0 == strcmp(argv[i], "--max-capacity"))
+		{
+			config.m_maxCapacity = strtoull(argv[i + 1], nullptr, 10);
+		}
+		else if (0 == strcmp(argv[i], "--max-bytes"))
+		{
+			config.m_maxBytes = strtoull(argv[i + 1], nullptr, 10);
+		}
+		else if (0 == strcmp(argv[i], "--iterations"))
+		{
+			config.m_iterations = strtoull(argv[i + 1], nullptr, 10);
+		}
+		else if (0 == strcmp(argv[i], "--out"))
+		{
+			config.m_out = argv[i + 1];
+		}
+	}
+	config.m_maxCapacity = std::min<uint64_t>(config.m_maxCapacity, 100000000);
+
+	std::vector<MicroBenchResult> results;
+	BenchState<rltl::impl::Array<float, 4>>(results, config, "4");
+	BenchState<rltl::impl::Array<float, 128>>(results, config, "128");
+	BenchState<rltl::impl::Array<float, 4, 84, 84>>(results, config, "4x84x84");
+	BenchSumTree<rltl::impl::PrioritySumTree<>>(results, config, "binary");
+	BenchSumTree<rltl::impl::WidePrioritySumTree<float, double, 4>>(results, config, "wide4");
+	BenchSumTree<rltl::impl::WidePrioritySumTree<float, double, 8>>(results, config, "wide8");
+	BenchActionSelection(results, config);
+
+	if (config.m_out.empty())
+	{
+		WriteJson(std::cout, config, results);
+	}
+	else
+	{
+		std::ofstream stream(config.m_out);
+		WriteJson(stream, config, results);
+	}
+	return 0;
+}
@@ -144,8 +144,13 @@ public:
 	Action_t maxAction(const State_t& state, bool firstMax = true) override
 	{
 		return NN_actionByArgmax<decltype(*this), State_t, Action_t>(*this, state);
-	}	
-	
+	}
+
+	void maxActions(std::vector<Action_t>& actions, const std::vector<State_t>& states, bool firstMax = true) override
+	{
+		NN_actionsByArgmax<decltype(*this), State_t, Action_t>(actions, *this, states);
+	}
+
 	void getValues(std::vector<float>& values, const State_t& state) override
 	{
 		NN_getStateValues<decltype(*this), State_t>(values, *this, state);
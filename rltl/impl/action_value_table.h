@@ -40,8 +40,12 @@ public:
 		assert(state < m_stateCount);
 		return firstMaxAction(state);
 	}
+	Action_t maxAction(const State_t& state, bool firstMax = true) override
+	{
+		return firstMax ? firstMaxAction(state) : randomMaxAction(state);
+	}
 	//expected sarsa
-	void getValues(std::vector<float>& values, const State_t& state) const
+	void getValues(std::vector<float>& values, const State_t& state) override
 	{
 		values.resize(m_actionCount);
 		for (uint32_t i = 0; i < m_actionCount; ++i)
@@ -80,7 +84,7 @@ public:
 	{
 		return m_stateCount;
 	}
-	uint32_t actionCount() const
+	uint32_t actionCount() const override
 	{
 		return m_actionCount;
 	}
@@ -4,9 +4,55 @@
 #include <assert.h>
 #include <vector>
 #include "../arg.h"
+#include "multi_step_buffer.h"
 
 BEGIN_RLTL_IMPL
 
+//per-slot episode bookkeeping for the batched steps of an agent, one slot per environment of a VectorEnvironment
+template<typename State_t, typename Action_t>
+class AgentSlots
+{
+public:
+	void initialize(size_t count, uint32_t multiStep = 0)
+	{
+		if (m_states.size() != count)
+		{
+			m_states.resize(count);
+			m_actions.resize(count);
+			m_nextActions.resize(count);
+			m_stepCounts.resize(count);
+			m_multiStepBuffers.clear();
+			m_multiStepBuffers.resize(count);
+			if (multiStep > 1)
+			{
+				for (auto& multiStepBuffer : m_multiStepBuffers)
+				{
+					multiStepBuffer.initialize(multiStep);
+				}
+			}
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			beginEpisode(i);
+		}
+	}
+	size_t size() const
+	{
+		return m_states.size();
+	}
+	void beginEpisode(size_t slot)
+	{
+		m_stepCounts[slot] = 0;
+		m_multiStepBuffers[slot].reset();
+	}
+public:
+	std::vector<State_t> m_states;
+	std::vector<Action_t> m_actions;
+	std::vector<Action_t> m_nextActions;//for sarsa
+	std::vector<uint32_t> m_stepCounts;
+	std::vector<MultiStepBuffer<State_t, Action_t>> m_multiStepBuffers;
+};
+
 //struct AgentOptions
 //{
 //	AgentOptions(float learningRate, float discountRate) :
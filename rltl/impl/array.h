@@ -417,6 +417,22 @@ struct Array_Shape
 	}
 };
 
+template<typename T>
+struct Array_Size
+{
+	constexpr static size_t size()
+	{
+		if constexpr (std::is_arithmetic_v<T>)
+		{
+			return 1;
+		}
+		else
+		{
+			return T::t_size;
+		}
+	}
+};
+
 // template<typename Element_t, size_t t_size_0>
 // inline size_t Vector_dimension(const Array<Element_t, t_size_0>& arg)
 // {
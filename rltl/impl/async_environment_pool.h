@@ -0,0 +1,266 @@
+#pragma once
+#include "utility.h"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+BEGIN_RLTL_IMPL
+
+//runs every environment on its own worker thread, finished environments are reset automatically like VectorEnvironment
+//all methods must be called from the same thread
+template<typename State_t, typename Action_t>
+class AsyncEnvironmentPool : public paf::Introspectable
+{
+public:
+	typedef Environment<State_t, Action_t> Environment_t;
+	typedef paf::SharedPtr<Environment_t> EnvironmentPtr;
+	typedef typename Environment_t::StateSpacePtr StateSpacePtr;
+	typedef typename Environment_t::ActionSpacePtr ActionSpacePtr;
+	typedef paf::SharedPtr<AsyncEnvironmentPool> AsyncEnvironmentPoolPtr;
+public:
+	//m_nextState is the last state of an episode if m_status != es_normal,
+	//in that case the environment has been reset and its first state is m_resetState
+	struct StepResult
+	{
+		float m_reward;
+		State_t m_nextState;
+		EnvironmentStatus m_status;
+		State_t m_resetState;
+	};
+	struct StepHandle
+	{
+		size_t m_index;
+	};
+protected:
+	enum class Job
+	{
+		none,
+		reset,
+		step,
+		stop,
+	};
+	struct Worker
+	{
+		EnvironmentPtr m_environment;
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		Job m_job{ Job::none };
+		Action_t m_action;
+		int m_seed{};
+		StepResult m_result;
+		bool m_pending{};//touched by the calling thread only
+	};
+public:
+	AsyncEnvironmentPool(const std::vector<EnvironmentPtr>& environments)
+	{
+		assert(!environments.empty());
+		size_t count = environments.size();
+		m_workers.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_workers.push_back(std::make_unique<Worker>());
+			m_workers[i]->m_environment = environments[i];
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_workers[i]->m_thread = std::thread(&AsyncEnvironmentPool::run, this, i);
+		}
+	}
+	~AsyncEnvironmentPool()
+	{
+		waitAll();
+		for (auto& worker : m_workers)
+		{
+			post(*worker, Job::stop);
+		}
+		for (auto& worker : m_workers)
+		{
+			worker->m_thread.join();
+		}
+	}
+public:
+	size_t size() const
+	{
+		return m_workers.size();
+	}
+	Environment_t* environment(size_t index)
+	{
+		assert(index < m_workers.size());
+		return m_workers[index]->m_environment.get();
+	}
+	StateSpacePtr stateSpace()
+	{
+		return m_workers[0]->m_environment->stateSpace();
+	}
+	ActionSpacePtr actionSpace()
+	{
+		return m_workers[0]->m_environment->actionSpace();
+	}
+	//resets all environments in parallel and waits for them
+	void reset(std::vector<State_t>& states, int seed = 0)
+	{
+		waitAll();
+		size_t count = m_workers.size();
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_workers[i]->m_seed = seed == 0 ? 0 : seed + int(i);
+			m_workers[i]->m_pending = true;
+			++m_numPending;
+			post(*m_workers[i], Job::reset);
+		}
+		waitAll();
+		states.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			states[i] = m_workers[i]->m_result.m_resetState;
+		}
+	}
+	StepHandle stepAsync(size_t index, const Action_t& action)
+	{
+		assert(index < m_workers.size());
+		Worker& worker = *m_workers[index];
+		assert(!worker.m_pending);
+		worker.m_action = action;
+		worker.m_pending = true;
+		++m_numPending;
+		post(worker, Job::step);
+		return StepHandle{ index };
+	}
+	//blocks until the step of the handle is finished
+	const StepResult& wait(StepHandle handle)
+	{
+		Worker& worker = *m_workers[handle.m_index];
+		if (worker.m_pending)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [&]() { return std::find(m_completed.begin(), m_completed.end(), handle.m_index) != m_completed.end(); });
+			m_completed.erase(std::find(m_completed.begin(), m_completed.end(), handle.m_index));
+			lock.unlock();
+			complete(worker);
+		}
+		return worker.m_result;
+	}
+	//blocks until any pending step is finished and returns the index of its environment
+	size_t waitAny()
+	{
+		assert(m_numPending > 0);
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_condition.wait(lock, [&]() { return !m_completed.empty(); });
+		size_t index = m_completed.front();
+		m_completed.pop_front();
+		lock.unlock();
+		complete(*m_workers[index]);
+		return index;
+	}
+	void waitAll()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_condition.wait(lock, [&]() { return m_completed.size() == m_numPending; });
+		while (!m_completed.empty())
+		{
+			m_workers[m_completed.front()]->m_pending = false;
+			m_completed.pop_front();
+		}
+		m_numPending = 0;
+	}
+	bool pending(size_t index) const
+	{
+		return m_workers[index]->m_pending;
+	}
+	size_t numPending() const
+	{
+		return m_numPending;
+	}
+	const StepResult& result(size_t index) const
+	{
+		assert(!m_workers[index]->m_pending);
+		return m_workers[index]->m_result;
+	}
+	void close()
+	{
+		waitAll();
+		for (auto& worker : m_workers)
+		{
+			worker->m_environment->close();
+		}
+	}
+protected:
+	void post(Worker& worker, Job job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(worker.m_mutex);
+			worker.m_job = job;
+		}
+		worker.m_condition.notify_one();
+	}
+	void complete(Worker& worker)
+	{
+		worker.m_pending = false;
+		--m_numPending;
+	}
+	void run(size_t index)
+	{
+		Worker& worker = *m_workers[index];
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(worker.m_mutex);
+				worker.m_condition.wait(lock, [&]() { return Job::none != worker.m_job; });
+				job = worker.m_job;
+				worker.m_job = Job::none;
+			}
+			if (Job::stop == job)
+			{
+				return;
+			}
+			StepResult& result = worker.m_result;
+			if (Job::reset == job)
+			{
+				result.m_resetState = worker.m_environment->reset(worker.m_seed);
+			}
+			else
+			{
+				result.m_status = worker.m_environment->step(result.m_reward, result.m_nextState, worker.m_action);
+				if (EnvironmentStatus::es_normal != result.m_status)
+				{
+					result.m_resetState = worker.m_environment->reset();
+				}
+			}
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_completed.push_back(index);
+			}
+			m_condition.notify_all();
+		}
+	}
+protected:
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<size_t> m_completed;
+	size_t m_numPending{};
+public:
+	static AsyncEnvironmentPoolPtr Make(const std::vector<EnvironmentPtr>& environments)
+	{
+		return AsyncEnvironmentPoolPtr::Make(environments);
+	}
+	template<typename ConcreteEnvironment_t, typename... Args_t>
+	static AsyncEnvironmentPoolPtr Make(size_t count, Args_t&&... args)
+	{
+		std::vector<EnvironmentPtr> environments;
+		environments.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			environments.push_back(paf::SharedPtr<ConcreteEnvironment_t>::Make(args...));
+		}
+		return AsyncEnvironmentPoolPtr::Make(environments);
+	}
+};
+
+END_RLTL_IMPL
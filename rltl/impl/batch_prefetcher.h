@@ -0,0 +1,198 @@
+#pragma once
+#include "utility.h"
+#include "neural_network.h"
+#include "random.h"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+BEGIN_RLTL_IMPL
+
+//one sampled batch of transitions, the cpu tensors are written by the replay buffer and
+//the device tensors are what the learner reads, they are the same tensors on the cpu
+struct ReplayBatch
+{
+public:
+	template<typename State_t, typename Action_t>
+	void allocate(uint32_t batchSize, bool needNextAction)
+	{
+		if (m_stateTensor.defined() && m_stateTensor.size(0) == batchSize)
+		{
+			return;
+		}
+		m_stateTensor = NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+		m_actionTensor = NN_makeTensor<Action_t>(torch::kInt64, batchSize);
+		m_rewardTensor = NN_makeTensor<float>(torch::kFloat32, batchSize);
+		m_nextStateTensor = NN_makeTensor<State_t>(torch::kFloat32, batchSize);
+		m_nextDiscountTensor = NN_makeTensor<float>(torch::kFloat32, batchSize);
+		m_weightTensor = NN_makeTensor<float>(torch::kFloat32, batchSize);
+		if (needNextAction)
+		{
+			m_nextActionTensor = NN_makeTensor<Action_t>(torch::kInt64, batchSize);
+		}
+		m_indices.resize(batchSize);
+		m_serials.resize(batchSize);
+	}
+	void upload(torch::Device device)
+	{
+		m_deviceStateTensor = m_stateTensor.to(device);
+		m_deviceActionTensor = m_actionTensor.to(device);
+		m_deviceRewardTensor = m_rewardTensor.to(device);
+		m_deviceNextStateTensor = m_nextStateTensor.to(device);
+		m_deviceNextDiscountTensor = m_nextDiscountTensor.to(device);
+		m_deviceWeightTensor = m_weightTensor.to(device);
+		if (m_nextActionTensor.defined())
+		{
+			m_deviceNextActionTensor = m_nextActionTensor.to(device);
+		}
+	}
+	uint32_t size() const
+	{
+		return m_stateTensor.defined() ? uint32_t(m_stateTensor.size(0)) : 0;
+	}
+public:
+	Tensor m_stateTensor;
+	Tensor m_actionTensor;
+	Tensor m_rewardTensor;
+	Tensor m_nextStateTensor;
+	Tensor m_nextDiscountTensor;
+	Tensor m_nextActionTensor;
+	Tensor m_weightTensor;
+	std::vector<uint32_t> m_indices;
+	std::vector<uint64_t> m_serials;//write serials of the sampled slots, for the priority update of a prefetched batch
+	bool m_sampled{ false };//false if the fill found no batch, e.g. the remote replay is gone
+
+	Tensor m_deviceStateTensor;
+	Tensor m_deviceActionTensor;
+	Tensor m_deviceRewardTensor;
+	Tensor m_deviceNextStateTensor;
+	Tensor m_deviceNextDiscountTensor;
+	Tensor m_deviceNextActionTensor;
+	Tensor m_deviceWeightTensor;
+};
+
+//keeps up to numBatches batches filled ahead of the learner on a background thread.
+//the fill function runs on that thread and has to lock whatever it samples from.
+//a batch is held by the learner from acquire() to release(), then goes back to be refilled,
+//so a prefetched batch was sampled at most numBatches learner updates before it is used
+template<typename Batch_t>
+class BatchPrefetcher
+{
+public:
+	typedef std::function<void(Batch_t&)> Fill_t;
+public:
+	BatchPrefetcher() = default;
+	BatchPrefetcher(const BatchPrefetcher&) = delete;
+	BatchPrefetcher& operator=(const BatchPrefetcher&) = delete;
+	~BatchPrefetcher()
+	{
+		stop();
+	}
+public:
+	void start(uint32_t numBatches, Fill_t fill)
+	{
+		stop();
+		assert(numBatches > 0);
+		m_fill = std::move(fill);
+		m_batches.clear();
+		m_free.clear();
+		m_ready.clear();
+		for (uint32_t i = 0; i < numBatches; ++i)
+		{
+			m_batches.push_back(std::make_unique<Batch_t>());
+			m_free.push_back(m_batches.back().get());
+		}
+		m_stopping = false;
+		m_thread = std::thread([this]() { run(); });
+	}
+	//the batches filled but not acquired yet are discarded, they may come from what the fill read before
+	void stop()
+	{
+		if (!m_thread.joinable())
+		{
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_freeCondition.notify_all();
+		m_thread.join();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_free.insert(m_free.end(), m_ready.begin(), m_ready.end());
+		m_ready.clear();
+	}
+	bool running() const
+	{
+		return m_thread.joinable();
+	}
+	//oldest ready batch, waits only if the sampler has fallen behind
+	Batch_t& acquire()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_ready.empty())
+		{
+			++m_waitCount;
+			m_readyCondition.wait(lock, [this]() { return !m_ready.empty(); });
+		}
+		Batch_t* batch = m_ready.front();
+		m_ready.pop_front();
+		return *batch;
+	}
+	void release(Batch_t& batch)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_free.push_back(&batch);
+		}
+		m_freeCondition.notify_one();
+	}
+	//number of acquire() calls which found no ready batch
+	uint64_t waitCount() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_waitCount;
+	}
+protected:
+	void run()
+	{
+		Random::seedThread(RandomStream::prefetcher, 0);
+		while (true)
+		{
+			Batch_t* batch;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_freeCondition.wait(lock, [this]() { return m_stopping || !m_free.empty(); });
+				if (m_stopping)
+				{
+					return;
+				}
+				batch = m_free.front();
+				m_free.pop_front();
+			}
+			m_fill(*batch);
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_ready.push_back(batch);
+			}
+			m_readyCondition.notify_one();
+		}
+	}
+protected:
+	Fill_t m_fill;
+	std::vector<std::unique_ptr<Batch_t>> m_batches;
+	std::deque<Batch_t*> m_free;
+	std::deque<Batch_t*> m_ready;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_freeCondition;
+	std::condition_variable m_readyCondition;
+	std::thread m_thread;
+	bool m_stopping{ false };
+	uint64_t m_waitCount{ 0 };
+};
+
+END_RLTL_IMPL
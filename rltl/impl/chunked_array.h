@@ -0,0 +1,69 @@
+#pragma once
+#include "utility.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+BEGIN_RLTL_IMPL
+
+//fixed size array split into chunks of 2^t_chunkShift elements, a chunk is allocated and value-initialized
+//on its first non-const access, so memory grows with the highest written index instead of the capacity.
+//const reads of a chunk which was never touched return a value-initialized element
+template<typename T, size_t t_chunkShift = 16>
+class ChunkedArray
+{
+public:
+	static constexpr size_t t_chunkSize = size_t(1) << t_chunkShift;
+	static constexpr size_t t_chunkMask = t_chunkSize - 1;
+public:
+	void initialize(size_t size)
+	{
+		m_size = size;
+		m_chunks.clear();
+		m_chunks.resize((size + t_chunkMask) >> t_chunkShift);
+	}
+	void clear()
+	{
+		m_size = 0;
+		m_chunks.clear();
+	}
+	T& operator[](size_t index)
+	{
+		assert(index < m_size);
+		std::unique_ptr<T[]>& chunk = m_chunks[index >> t_chunkShift];
+		if (!chunk)
+		{
+			size_t first = index & ~t_chunkMask;
+			chunk.reset(new T[std::min(t_chunkSize, m_size - first)]());
+		}
+		return chunk[index & t_chunkMask];
+	}
+	const T& operator[](size_t index) const
+	{
+		assert(index < m_size);
+		const std::unique_ptr<T[]>& chunk = m_chunks[index >> t_chunkShift];
+		return chunk ? chunk[index & t_chunkMask] : s_zero;
+	}
+	size_t size() const
+	{
+		return m_size;
+	}
+	size_t allocatedChunks() const
+	{
+		return std::count_if(m_chunks.begin(), m_chunks.end(), [](const std::unique_ptr<T[]>& chunk) { return bool(chunk); });
+	}
+	size_t allocatedBytes() const
+	{
+		return allocatedChunks() * t_chunkSize * sizeof(T);
+	}
+	explicit operator bool() const
+	{
+		return 0 != m_size;
+	}
+protected:
+	std::vector<std::unique_ptr<T[]>> m_chunks;
+	size_t m_size{ 0 };
+	inline static const T s_zero{};
+};
+
+END_RLTL_IMPL
@@ -0,0 +1,370 @@
+#pragma once
+#include "utility.h"
+#include "random.h"
+#include "neural_network.h"
+#include "trajectory_buffer.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <cmath>
+
+BEGIN_RLTL_IMPL
+
+//replay ring shared by many writer threads and one sampler thread without a buffer wide lock.
+//writers reserve slots by taking tickets from an atomic cursor, slot = ticket % capacity.
+//every slot has a sequence word which is odd while the slot is locked and 2 * (ticket + 1) once the
+//transition of that ticket is published, so a transition is only ever read or overwritten as a whole.
+//the sampler sees the tickets [cursor - capacity, cursor) that existed when it read the cursor,
+//slots in that range whose writer has not finished yet still hold their previous transition.
+//the priority tree is lock free: a leaf is exchanged and the difference is added to every ancestor.
+//the tree holds fixed point priorities in units of 2^-24, so the added differences are exact integers and
+//the inner sums never drift from their leaves as floating point sums under concurrent adds would.
+//prioritized weights are normalized by the smallest priority of each batch instead of the global minimum
+template<typename State_t, typename Action_t, typename Priority_t = float, typename PrioritySum_t = double>
+class ConcurrentTrajectoryBuffer
+{
+public:
+	ConcurrentTrajectoryBuffer() = default;
+	ConcurrentTrajectoryBuffer(const ConcurrentTrajectoryBuffer&) = delete;
+	ConcurrentTrajectoryBuffer& operator=(const ConcurrentTrajectoryBuffer&) = delete;
+public:
+	//not thread safe, call before any writer or sampler starts
+	void initialize(uint32_t capacity, bool needPriority)
+	{
+		assert(capacity > 0);
+		m_capacity = capacity;
+		m_cursor.store(0, std::memory_order_relaxed);
+		//allocated up front, a lazily allocated chunk would race between writers
+		m_states.assign(capacity, State_t{});
+		m_actions.assign(capacity, Action_t{});
+		m_rewards.assign(capacity, 0.0f);
+		m_nextStates.assign(capacity, State_t{});
+		m_nextDiscounts.assign(capacity, 0.0f);
+		m_sequences.reset(new std::atomic<uint64_t>[capacity]);
+		for (uint32_t i = 0; i < capacity; ++i)
+		{
+			m_sequences[i].store(0, std::memory_order_relaxed);
+		}
+		m_leafCount = 0;
+		m_nodes.reset();
+		if (needPriority)
+		{
+			m_leafCount = 1;
+			while (m_leafCount < capacity)
+			{
+				m_leafCount *= 2;
+			}
+			m_nodes.reset(new std::atomic<uint64_t>[m_leafCount * 2]);
+			for (uint32_t i = 0; i < m_leafCount * 2; ++i)
+			{
+				m_nodes[i].store(0, std::memory_order_relaxed);
+			}
+			m_maxPriority.store(1, std::memory_order_relaxed);
+			//a full tree of the largest leaves still fits the root
+			m_maxFixedPriority = (UINT64_MAX >> 1) / m_leafCount;
+		}
+	}
+public:
+	uint32_t capacity() const
+	{
+		return m_capacity;
+	}
+	uint32_t size() const
+	{
+		return uint32_t(std::min<uint64_t>(m_cursor.load(std::memory_order_acquire), m_capacity));
+	}
+	//tickets handed out so far, including the ones still being written
+	uint64_t appendCount() const
+	{
+		return m_cursor.load(std::memory_order_acquire);
+	}
+	bool needPriority() const
+	{
+		return 0 != m_leafCount;
+	}
+public:
+	//any thread
+	uint32_t append(
+		const State_t& state,
+		const Action_t& action,
+		float reward,
+		const State_t& nextState,
+		float nextDiscount)
+	{
+		uint64_t ticket = m_cursor.fetch_add(1, std::memory_order_acq_rel);
+		return store(ticket, state, action, reward, nextState, nextDiscount);
+	}
+	//any thread, the whole batch takes consecutive tickets with one atomic add
+	void append(const TransitionBatch<State_t, Action_t>& batch)
+	{
+		uint32_t count = uint32_t(batch.size());
+		if (0 == count)
+		{
+			return;
+		}
+		uint64_t ticket = m_cursor.fetch_add(count, std::memory_order_acq_rel);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			store(ticket + i, batch.m_states[i], batch.m_actions[i], batch.m_rewards[i], batch.m_nextStates[i], batch.m_nextDiscounts[i]);
+		}
+	}
+public:
+	//sampler thread
+	void sample(
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		uint32_t batchSize)
+	{
+		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
+		auto rewards = rewardTensor.accessor<float, 2>();
+		auto nextStates = nextStateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto nextDiscounts = nextDiscountTensor.accessor<float, 2>();
+		uint64_t end = m_cursor.load(std::memory_order_acquire);
+		uint64_t begin = end > m_capacity ? end - m_capacity : 0;
+		assert(0 < batchSize && begin < end);
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			while (true)
+			{
+				uint32_t slot = uint32_t((begin + Random::randuint(uint32_t(end - begin))) % m_capacity);
+				uint64_t sequence = lock(slot);
+				if (0 != sequence)
+				{
+					Tensor_Assign(states[i], m_states[slot]);
+					Tensor_Assign(actions[i], m_actions[slot]);
+					Tensor_Assign(rewards[i], m_rewards[slot]);
+					Tensor_Assign(nextStates[i], m_nextStates[slot]);
+					Tensor_Assign(nextDiscounts[i], m_nextDiscounts[slot]);
+				}
+				unlock(slot, sequence);
+				if (0 != sequence)
+				{
+					break;
+				}
+			}
+		}
+	}
+	//sampler thread, for prioritized experience replay.
+	//weights are normalized by the smallest priority in the batch, a global minimum is not kept
+	//because it cannot be maintained lock free under concurrent appends. the largest weight of every batch
+	//is therefore 1, where TrajectoryBuffer divides by the global minimum and its weights are smaller by
+	//(batch minimum / global minimum)^beta. that factor changes from batch to batch like a slightly varying
+	//learning rate, the relative weights within a batch are the same as with the global minimum
+	void sample(
+		std::vector<uint32_t>& indices,
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		Tensor& weightTensor,
+		uint32_t batchSize,
+		float prioritizedBeta)
+	{
+		assert(needPriority() && 0 < batchSize && 0 < size());
+		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
+		auto rewards = rewardTensor.accessor<float, 2>();
+		auto nextStates = nextStateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto nextDiscounts = nextDiscountTensor.accessor<float, 2>();
+		auto weights = weightTensor.accessor<float, 2>();
+		indices.resize(batchSize);
+		m_sampleSequences.resize(batchSize);
+		Priority_t minPriority = 0;
+		uint64_t total = m_nodes[1].load(std::memory_order_acquire);
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			//stratified like PrioritySumTree::sample, a draw which lands on an empty leaf because the tree
+			//changed under the descent is redrawn from the whole range
+			uint64_t target = uint64_t((PrioritySum_t(i) + PrioritySum_t(Random::rand())) * PrioritySum_t(total) / PrioritySum_t(batchSize));
+			while (true)
+			{
+				Priority_t priority;
+				uint32_t slot = find(target, priority);
+				if (slot < m_capacity && priority > 0)
+				{
+					uint64_t sequence = lock(slot);
+					if (0 != sequence)
+					{
+						Tensor_Assign(states[i], m_states[slot]);
+						Tensor_Assign(actions[i], m_actions[slot]);
+						Tensor_Assign(rewards[i], m_rewards[slot]);
+						Tensor_Assign(nextStates[i], m_nextStates[slot]);
+						Tensor_Assign(nextDiscounts[i], m_nextDiscounts[slot]);
+					}
+					unlock(slot, sequence);
+					if (0 != sequence)
+					{
+						indices[i] = slot;
+						m_sampleSequences[i] = sequence;
+						weights[i][0] = priority;
+						minPriority = 0 == i ? priority : std::min(minPriority, priority);
+						break;
+					}
+				}
+				total = m_nodes[1].load(std::memory_order_acquire);
+				target = uint64_t(PrioritySum_t(Random::rand()) * PrioritySum_t(total));
+			}
+		}
+		//w = (min / p) ^ beta
+		weightTensor.reciprocal_().mul_(minPriority).pow_(prioritizedBeta);
+	}
+	//sampler thread, indices and the slot sequences come from the last prioritized sample(),
+	//a slot which was overwritten since then keeps the priority of its new transition
+	void updatePriorities(const std::vector<uint32_t>& indices, const Tensor& deltaTensor, uint32_t batchSize, float prioritizedAlpha, float prioritizedEpsilon)
+	{
+		assert(needPriority() && indices.size() >= batchSize && m_sampleSequences.size() >= batchSize);
+		NN_prioritiesFromDeltas(m_priorityTensor, deltaTensor, prioritizedAlpha, prioritizedEpsilon);
+		auto priorities = m_priorityTensor.accessor<float, 2>();
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			uint32_t slot = indices[i];
+			assert(slot < m_capacity);
+			Priority_t priority = priorities[i][0];
+			uint64_t sequence = lock(slot);
+			if (sequence == m_sampleSequences[i])
+			{
+				setPriority(slot, priority);
+				updateMaxPriority(priority);
+			}
+			unlock(slot, sequence);
+		}
+	}
+	Priority_t totalPriority() const
+	{
+		return needPriority() ? Priority_t(FromFixed(m_nodes[1].load(std::memory_order_acquire))) : 0;
+	}
+	Priority_t priority(uint32_t slot) const
+	{
+		assert(needPriority() && slot < m_capacity);
+		return Priority_t(FromFixed(m_nodes[m_leafCount + slot].load(std::memory_order_acquire)));
+	}
+protected:
+	uint32_t store(uint64_t ticket, const State_t& state, const Action_t& action, float reward, const State_t& nextState, float nextDiscount)
+	{
+		uint32_t slot = uint32_t(ticket % m_capacity);
+		uint64_t sequence = lock(slot);
+		uint64_t published = (ticket + 1) * 2;
+		//a writer which was lapped by a newer ticket for the same slot drops its transition
+		if (sequence < published)
+		{
+			m_states[slot] = state;
+			m_actions[slot] = action;
+			m_rewards[slot] = reward;
+			m_nextStates[slot] = nextState;
+			m_nextDiscounts[slot] = nextDiscount;
+			if (needPriority())
+			{
+				setPriority(slot, m_maxPriority.load(std::memory_order_relaxed));
+			}
+			sequence = published;
+		}
+		unlock(slot, sequence);
+		return slot;
+	}
+	//returns the published sequence the slot held, 0 if it was never written
+	uint64_t lock(uint32_t slot)
+	{
+		std::atomic<uint64_t>& word = m_sequences[slot];
+		uint64_t sequence = word.load(std::memory_order_relaxed);
+		while (true)
+		{
+			if (0 == (sequence & 1) && word.compare_exchange_weak(sequence, sequence | 1, std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				return sequence;
+			}
+			std::this_thread::yield();
+			sequence = word.load(std::memory_order_relaxed);
+		}
+	}
+	void unlock(uint32_t slot, uint64_t sequence)
+	{
+		m_sequences[slot].store(sequence, std::memory_order_release);
+	}
+	void setPriority(uint32_t slot, Priority_t priority)
+	{
+		size_t node = m_leafCount + slot;
+		uint64_t fixedPriority = toFixed(priority);
+		//unsigned wrap around makes a decrease an add of the two's complement
+		uint64_t delta = fixedPriority - m_nodes[node].exchange(fixedPriority, std::memory_order_acq_rel);
+		if (0 == delta)
+		{
+			return;
+		}
+		for (node /= 2; node > 0; node /= 2)
+		{
+			m_nodes[node].fetch_add(delta, std::memory_order_acq_rel);
+		}
+	}
+	//rounded to the nearest unit, a positive priority keeps at least one unit so its slot stays sampleable
+	uint64_t toFixed(Priority_t priority) const
+	{
+		if (!(priority > 0))
+		{
+			return 0;
+		}
+		double fixedPriority = std::round(double(priority) * double(t_fixedOne));
+		if (fixedPriority < 1)
+		{
+			return 1;
+		}
+		return fixedPriority < double(m_maxFixedPriority) ? uint64_t(fixedPriority) : m_maxFixedPriority;
+	}
+	static double FromFixed(uint64_t fixedPriority)
+	{
+		return double(fixedPriority) / double(t_fixedOne);
+	}
+	void updateMaxPriority(Priority_t priority)
+	{
+		Priority_t expected = m_maxPriority.load(std::memory_order_relaxed);
+		while (priority > expected && !m_maxPriority.compare_exchange_weak(expected, priority, std::memory_order_relaxed))
+		{
+		}
+	}
+	//the sums are read while writers add to them, so a child may momentarily not add up to its parent,
+	//a target which runs past the end lands on an empty or padding leaf and is redrawn by the caller
+	uint32_t find(uint64_t target, Priority_t& priority) const
+	{
+		size_t node = 1;
+		while (node < m_leafCount)
+		{
+			uint64_t left = m_nodes[node * 2].load(std::memory_order_acquire);
+			if (target < left)
+			{
+				node = node * 2;
+			}
+			else
+			{
+				target -= left;
+				node = node * 2 + 1;
+			}
+		}
+		priority = Priority_t(FromFixed(m_nodes[node].load(std::memory_order_acquire)));
+		return uint32_t(node - m_leafCount);
+	}
+protected:
+	static constexpr uint64_t t_fixedOne = uint64_t(1) << 24;
+protected:
+	uint32_t m_capacity{ 0 };
+	uint32_t m_leafCount{ 0 };
+	alignas(64) std::atomic<uint64_t> m_cursor{ 0 };
+	alignas(64) std::atomic<Priority_t> m_maxPriority{ 1 };
+	std::unique_ptr<std::atomic<uint64_t>[]> m_sequences;
+	std::vector<State_t> m_states;
+	std::vector<Action_t> m_actions;
+	std::vector<float> m_rewards;
+	std::vector<State_t> m_nextStates;
+	std::vector<float> m_nextDiscounts;
+	//binary heap layout, node 1 is the root and leaf i is node m_leafCount + i
+	std::unique_ptr<std::atomic<uint64_t>[]> m_nodes;
+	uint64_t m_maxFixedPriority{ 0 };
+	std::vector<uint64_t> m_sampleSequences;
+	Tensor m_priorityTensor;
+};
+
+END_RLTL_IMPL
@@ -15,6 +15,7 @@ struct DeepActorCriticOptions
 		m_batchSize(batchSize)
 	{
 		m_targetNetUpdateFreq = 0;// target network enabled if > 1
+		m_targetNetTau = 0;// soft target network updated on every learn step if > 0
 		m_multiStep = 0;// enabled if > 1
 		m_multiStepCompound = false;
 		m_experienceReplay = ExperienceReplay::no_experience_replay;
@@ -24,6 +25,8 @@ struct DeepActorCriticOptions
 		m_prioritizedEpsilon = FLT_EPSILON;
 		m_prioritizedAlpha = 1.0f;
 		m_prioritizedBeta = 1.0f;
+		m_columnarReplay = false;
+		m_replayResume = false;
 	}
 public:	
 	DeepActorCriticOptions& targetNetwork(uint32_t targetNetUpdateFreq)
@@ -31,6 +34,19 @@ public:
 		m_targetNetUpdateFreq = targetNetUpdateFreq;
 		return *this;
 	}
+	DeepActorCriticOptions& softTargetNetwork(float targetNetTau)
+	{
+		m_targetNetTau = targetNetTau;
+		return *this;
+	}
+	//keeps the replay memory in a memory-mapped file, resume reuses the transitions of an existing file.
+	//initialize throws std::runtime_error if the file can not be mapped
+	DeepActorCriticOptions& mappedReplay(const std::string& replayFilename, bool replayResume)
+	{
+		m_replayFilename = replayFilename;
+		m_replayResume = replayResume;
+		return *this;
+	}
 	DeepActorCriticOptions& multiStep(uint32_t step, bool compound)
 	{
 		m_multiStep = step;
@@ -60,6 +76,7 @@ public:
 	RLTL_ARG(float, discountRate);
 	RLTL_ARG(uint32_t, batchSize);
 	RLTL_ARG(uint32_t, targetNetUpdateFreq);
+	RLTL_ARG(float, targetNetTau);
 	RLTL_ARG(uint32_t, multiStep);
 	RLTL_ARG(bool, multiStepCompound);
 	RLTL_ARG(ExperienceReplay, experienceReplay);	
@@ -69,6 +86,9 @@ public:
 	RLTL_ARG(float, prioritizedEpsilon);
 	RLTL_ARG(float, prioritizedAlpha);
 	RLTL_ARG(float, prioritizedBeta);
+	RLTL_ARG(bool, columnarReplay);
+	RLTL_ARG(std::string, replayFilename);
+	RLTL_ARG(bool, replayResume);
 };
 
 
@@ -98,6 +118,7 @@ public:
 		m_discountRate(options.discountRate()),
 		m_batchSize(options.batchSize()),
 		m_targetNetUpdateFreq(options.targetNetUpdateFreq()),
+		m_targetNetTau(options.targetNetTau()),
 		m_multiStepCompound(options.multiStepCompound()),
 		m_experienceReplay(options.experienceReplay()),
 		m_replayMemorySize(options.replayMemorySize()),
@@ -131,11 +152,24 @@ public:
 		{
 			bufferCapacity = std::max(m_replayMemorySize, m_warmUpSize);
 		}
-		m_trajectoryBuffer.initialize(bufferCapacity, false, ExperienceReplay::prioritized_experience_replay == m_experienceReplay);
+		bool needPriority = ExperienceReplay::prioritized_experience_replay == m_experienceReplay;
+		if (!options.replayFilename().empty())
+		{
+			//as in DeepQNetwork, a requested replay file is not silently replaced by heap storage
+			if (!m_trajectoryBuffer.initializeMapped(options.replayFilename(), bufferCapacity, false, needPriority, options.replayResume()))
+			{
+				throw std::runtime_error("can not map the replay file " + options.replayFilename());
+			}
+		}
+		else
+		{
+			m_trajectoryBuffer.initialize(bufferCapacity, false, needPriority, options.columnarReplay());
+		}
 		if (ExperienceReplay::prioritized_experience_replay == m_experienceReplay)
 		{
 			m_sampleIndices.resize(m_batchSize);
 		}
+		allocateBatchTensors(m_batchSize);
 	}
 public:
 	Action_t firstStep(const State_t& firstState)
@@ -147,60 +181,128 @@ public:
 	}
 	Action_t nextStep(float reward, const State_t& nextState)
 	{
-		if (m_multiStepBuffer)
+		appendTransition(m_trajectoryBuffer, m_multiStepBuffer, m_state, m_action, reward, nextState, false, false);
+		learn(false);
+		m_state = nextState;
+		m_action = m_policy->takeAction(nextState);
+		return m_action;
+	}
+
+	void lastStep(float reward, const State_t& nextState, bool terminated)
+	{
+		appendTransition(m_trajectoryBuffer, m_multiStepBuffer, m_state, m_action, reward, nextState, true, terminated);
+		learn(true);
+	}
+
+public:
+	void firstSteps(std::vector<Action_t>& actions, const std::vector<State_t>& firstStates) override
+	{
+		m_slots.initialize(firstStates.size(), m_multiStepBuffer.multiStep());
+		m_slots.m_states = firstStates;
+		m_policy->takeActions(m_slots.m_actions, m_slots.m_states);
+		actions = m_slots.m_actions;
+	}
+
+	void nextSteps(
+		std::vector<Action_t>& actions,
+		const std::vector<float>& rewards,
+		const std::vector<State_t>& nextStates,
+		const std::vector<EnvironmentStatus>& statuses,
+		const std::vector<State_t>& resetStates) override
+	{
+		size_t count = m_slots.size();
+		assert(rewards.size() == count && nextStates.size() == count && statuses.size() == count);
+		m_transitionBatch.clear();
+		for (size_t i = 0; i < count; ++i)
 		{
-			m_multiStepBuffer.append(m_state, m_action, reward, m_discountRate);
-			if (m_multiStepCompound)
+			bool lastStep = EnvironmentStatus::es_normal != statuses[i];
+			appendTransition(m_transitionBatch, m_slots.m_multiStepBuffers[i], m_slots.m_states[i], m_slots.m_actions[i], rewards[i], nextStates[i], lastStep, EnvironmentStatus::es_terminated == statuses[i]);
+			if (lastStep)
 			{
-				uint32_t count = std::min(m_multiStepBuffer.stepCount(), m_multiStepBuffer.multiStep());
-				for (size_t i = 0; i < count; ++i)
-				{
-					auto sar = m_multiStepBuffer.get(m_multiStepBuffer.stepCount() - count + i);
-					m_trajectoryBuffer.append(sar->state, sar->action, sar->accReward, nextState, sar->accDiscountRate);
-				}
+				m_slots.beginEpisode(i);
+				m_slots.m_states[i] = resetStates[i];
 			}
 			else
 			{
-				if (m_multiStepBuffer.stepCount() >= m_multiStepBuffer.multiStep())
-				{
-					auto sar = m_multiStepBuffer.getHead();
-					m_trajectoryBuffer.append(sar->state, sar->action, sar->accReward, nextState, sar->accDiscountRate);
-				}
+				++m_slots.m_stepCounts[i];
+				m_slots.m_states[i] = nextStates[i];
 			}
 		}
-		else
+		m_trajectoryBuffer.append(m_transitionBatch);
+		for (size_t i = 0; i < count; ++i)
 		{
-			m_trajectoryBuffer.append(m_state, m_action, reward, nextState, m_discountRate);
+			learn(EnvironmentStatus::es_normal != statuses[i]);
 		}
-		learn(false);
-		m_state = nextState;
-		m_action = m_policy->takeAction(nextState);
-		return m_action;
+		m_policy->takeActions(m_slots.m_actions, m_slots.m_states);
+		actions = m_slots.m_actions;
 	}
-
-	void lastStep(float reward, const State_t& nextState, bool terminated)
+	void beginSlotSteps(size_t count) override
+	{
+		m_slots.initialize(count, m_multiStepBuffer.multiStep());
+	}
+	Action_t firstSlotStep(size_t slot, const State_t& firstState) override
 	{
-		if (m_multiStepBuffer)
+		m_slots.beginEpisode(slot);
+		m_slots.m_states[slot] = firstState;
+		m_slots.m_actions[slot] = m_policy->takeAction(firstState);
+		return m_slots.m_actions[slot];
+	}
+	Action_t nextSlotStep(size_t slot, float reward, const State_t& nextState, EnvironmentStatus status, const State_t& resetState) override
+	{
+		bool lastStep = EnvironmentStatus::es_normal != status;
+		appendTransition(m_trajectoryBuffer, m_slots.m_multiStepBuffers[slot], m_slots.m_states[slot], m_slots.m_actions[slot], reward, nextState, lastStep, EnvironmentStatus::es_terminated == status);
+		learn(lastStep);
+		if (lastStep)
 		{
-			m_multiStepBuffer.append(m_state, m_action, reward, m_discountRate);
-			uint32_t count = std::min(m_multiStepBuffer.stepCount(), m_multiStepBuffer.multiStep());
-			for (size_t i = 0; i < count; ++i)
+			return firstSlotStep(slot, resetState);
+		}
+		++m_slots.m_stepCounts[slot];
+		m_slots.m_states[slot] = nextState;
+		m_slots.m_actions[slot] = m_policy->takeAction(nextState);
+		return m_slots.m_actions[slot];
+	}
+	uint64_t learnCount() const override
+	{
+		return m_learnCount;
+	}
+protected:
+	template<typename Transitions_t>
+	void appendTransition(
+		Transitions_t& transitions,
+		MultiStepBuffer<State_t, Action_t>& multiStepBuffer,
+		const State_t& state,
+		const Action_t& action,
+		float reward,
+		const State_t& nextState,
+		bool lastStep,
+		bool terminated)
+	{
+		if (multiStepBuffer)
+		{
+			multiStepBuffer.append(state, action, reward, m_discountRate);
+			if (lastStep || m_multiStepCompound)
+			{
+				uint32_t count = std::min(multiStepBuffer.stepCount(), multiStepBuffer.multiStep());
+				for (size_t i = 0; i < count; ++i)
+				{
+					auto sar = multiStepBuffer.get(multiStepBuffer.stepCount() - count + i);
+					transitions.append(sar->state, sar->action, sar->accReward, nextState, terminated ? 0 : sar->accDiscountRate);
+				}
+			}
+			else if (multiStepBuffer.stepCount() >= multiStepBuffer.multiStep())
 			{
-				auto sar = m_multiStepBuffer.get(m_multiStepBuffer.stepCount() - count + i);
-				m_trajectoryBuffer.append(sar->state, sar->action, sar->accReward, nextState, terminated ? 0 : sar->accDiscountRate);
+				auto sar = multiStepBuffer.getHead();
+				transitions.append(sar->state, sar->action, sar->accReward, nextState, sar->accDiscountRate);
 			}
 		}
 		else
 		{
-			m_trajectoryBuffer.append(m_state, m_action, reward, nextState, terminated ? 0 : m_discountRate);
+			transitions.append(state, action, reward, nextState, terminated ? 0 : m_discountRate);
 		}
-		learn(true);
 	}
-
-protected:
 	bool useTargetNet() const
 	{
-		return m_targetNetUpdateFreq > 1;
+		return m_targetNetUpdateFreq > 1 || m_targetNetTau > 0;
 	}
 	void learn(bool lastStep)
 	{
@@ -230,68 +332,59 @@ protected:
 		}
 		++m_learnCount;
 
-		Tensor stateTensor = MakeTensor<State_t>(torch::kFloat32, batchSize);
-		Tensor actionTensor = MakeTensor<Action_t>(torch::kInt64, batchSize);
-		Tensor rewardTensor = MakeTensor<float>(torch::kFloat32, batchSize);
-		Tensor nextStateTensor = MakeTensor<State_t>(torch::kFloat32, batchSize);
-		Tensor nextDiscountTensor = MakeTensor<float>(torch::kFloat32, batchSize);
-		Tensor weightTensor = MakeTensor<float>(torch::kFloat32, batchSize);
-
+		allocateBatchTensors(batchSize);
 		switch (m_experienceReplay)
 		{
 		case ExperienceReplay::no_experience_replay:
-			m_trajectoryBuffer.pop(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, batchSize);
+			m_trajectoryBuffer.pop(m_stateTensor, m_actionTensor, m_rewardTensor, m_nextStateTensor, m_nextDiscountTensor, batchSize);
 			break;
 		case ExperienceReplay::experience_replay:
 			assert(batchSize == m_batchSize);
-			m_trajectoryBuffer.sample(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, batchSize);
+			m_trajectoryBuffer.sample(m_stateTensor, m_actionTensor, m_rewardTensor, m_nextStateTensor, m_nextDiscountTensor, batchSize);
 			break;
 		case ExperienceReplay::prioritized_experience_replay:
 			assert(batchSize == m_batchSize);
-			m_trajectoryBuffer.sample(m_sampleIndices, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor, batchSize, m_prioritizedBeta);
+			m_trajectoryBuffer.sample(m_sampleIndices, m_stateTensor, m_actionTensor, m_rewardTensor, m_nextStateTensor, m_nextDiscountTensor, m_weightTensor, batchSize, m_prioritizedBeta);
 			break;
 		default:
 			return;
 		}
 
-		Tensor valueTensor = m_criticNet->forward(stateTensor);
+		Tensor valueTensor = m_criticNet->forward(m_stateTensor);
 		assert(valueTensor.dim() == 2 && valueTensor.size(0) == batchSize && valueTensor.size(1) == 1);
 
-		Tensor nextValueTensor;
-		if (useTargetNet())
-		{
-			torch::NoGradGuard nograd;
-			nextValueTensor = m_criticTargetNet->forward(nextStateTensor);
-		}
-		else
 		{
+			//semi gradient, target and delta are written into the persistent tensors without recording a graph
 			torch::NoGradGuard nograd;
-			nextValueTensor = m_criticNet->forward(nextStateTensor).detach();//semi gradient
+			if (useTargetNet())
+			{
+				m_nextValueTensor.copy_(m_criticTargetNet->forward(m_nextStateTensor));
+			}
+			else
+			{
+				m_nextValueTensor.copy_(m_criticNet->forward(m_nextStateTensor));
+			}
+			assert(m_nextValueTensor.dim() == 2 && m_nextValueTensor.size(0) == batchSize && m_nextValueTensor.size(1) == 1);
+			torch::mul_out(m_targetTensor, m_nextValueTensor, m_nextDiscountTensor);
+			m_targetTensor.add_(m_rewardTensor);
+			torch::sub_out(m_deltaTensor, valueTensor, m_targetTensor);//neg
 		}
-		assert(nextValueTensor.dim() == 2 && nextValueTensor.size(0) == batchSize && nextValueTensor.size(1) == 1);
-
-		Tensor targetTensor = rewardTensor + nextValueTensor * nextDiscountTensor;
-		assert(targetTensor.dim() == 2 && targetTensor.size(0) == batchSize && targetTensor.size(1) == 1);
-		Tensor deltaTensor = valueTensor - targetTensor;//neg
-		assert(deltaTensor.dim() == 2 && deltaTensor.size(0) == batchSize && deltaTensor.size(1) == 1);
 
 		Tensor criticLossTensor;
 		if (ExperienceReplay::prioritized_experience_replay == m_experienceReplay)
 		{
-			Tensor deltaTensor = targetTensor - valueTensor;
-			assert(deltaTensor.dim() == 2 && deltaTensor.size(0) == m_batchSize && deltaTensor.size(1) == 1);
-			m_trajectoryBuffer.updatePriorities(m_sampleIndices, deltaTensor, m_batchSize, m_prioritizedAlpha, m_prioritizedEpsilon);
-			Tensor costTensor = torch::nn::functional::mse_loss(valueTensor, targetTensor, torch::nn::functional::MSELossFuncOptions().reduction(torch::kNone)) * weightTensor;
+			m_trajectoryBuffer.updatePriorities(m_sampleIndices, m_deltaTensor, m_batchSize, m_prioritizedAlpha, m_prioritizedEpsilon);
+			Tensor costTensor = torch::nn::functional::mse_loss(valueTensor, m_targetTensor, torch::nn::functional::MSELossFuncOptions().reduction(torch::kNone)) * m_weightTensor;
 			assert(costTensor.dim() == 2 && costTensor.size(0) == m_batchSize && costTensor.size(1) == 1);
 			criticLossTensor = torch::mean(costTensor);
 		}
 		else
 		{
-			criticLossTensor = torch::mean(torch::nn::functional::mse_loss(valueTensor, targetTensor));
+			criticLossTensor = torch::mean(torch::nn::functional::mse_loss(valueTensor, m_targetTensor));
 		}
 
-		Tensor logProbTensor = torch::nn::functional::log_softmax(m_actorNet->forward(stateTensor), 1);
-		Tensor actorLossTensor = torch::sum(logProbTensor.gather(1, actionTensor) * deltaTensor.detach());
+		Tensor logProbTensor = torch::nn::functional::log_softmax(m_actorNet->forward(m_stateTensor), 1);
+		Tensor actorLossTensor = torch::sum(logProbTensor.gather(1, m_actionTensor) * m_deltaTensor);
 
 		m_optimizer->zero_grad();
 		actorLossTensor.backward();
@@ -300,11 +393,33 @@ protected:
 
 		if (useTargetNet())
 		{
-			if (m_learnCount % m_targetNetUpdateFreq == 0)
+			if (m_targetNetTau > 0)
+			{
+				NN_softUpdateParameters(m_criticTargetNet->module(), m_criticNet->module(), m_targetNetTau);
+			}
+			else if (m_learnCount % m_targetNetUpdateFreq == 0)
 			{
 				NN_copyParameters(m_criticTargetNet->module(), m_criticNet->module());
 			}
-		}		
+		}
+	}
+	//the batch tensors are kept across learn calls and only reallocated when the batch size changes,
+	//which happens for the shorter batches at the end of an episode without experience replay
+	void allocateBatchTensors(uint32_t batchSize)
+	{
+		if (m_stateTensor.defined() && m_stateTensor.size(0) == batchSize)
+		{
+			return;
+		}
+		m_stateTensor = MakeTensor<State_t>(torch::kFloat32, batchSize);
+		m_actionTensor = MakeTensor<Action_t>(torch::kInt64, batchSize);
+		m_rewardTensor = MakeTensor<float>(torch::kFloat32, batchSize);
+		m_nextStateTensor = MakeTensor<State_t>(torch::kFloat32, batchSize);
+		m_nextDiscountTensor = MakeTensor<float>(torch::kFloat32, batchSize);
+		m_weightTensor = MakeTensor<float>(torch::kFloat32, batchSize);
+		m_nextValueTensor = MakeTensor<float>(torch::kFloat32, batchSize);
+		m_targetTensor = MakeTensor<float>(torch::kFloat32, batchSize);
+		m_deltaTensor = MakeTensor<float>(torch::kFloat32, batchSize);
 	}
 protected:
 	template<typename Element_t, typename TensorScalar_t>
@@ -329,6 +444,7 @@ protected:
 	float m_discountRate;
 	uint32_t m_batchSize;
 	uint32_t m_targetNetUpdateFreq;
+	float m_targetNetTau;
 	bool m_multiStepCompound;
 	ExperienceReplay m_experienceReplay;
 	uint32_t m_replayMemorySize;
@@ -337,13 +453,25 @@ protected:
 	float m_prioritizedEpsilon;
 	float m_prioritizedAlpha;
 	float m_prioritizedBeta;
-	uint32_t m_tryLearnCount{};
-	uint32_t m_learnCount{};
+	uint64_t m_tryLearnCount{};
+	uint64_t m_learnCount{};
 	State_t m_state;
 	Action_t m_action;
 	MultiStepBuffer<State_t, Action_t> m_multiStepBuffer;
 	TrajectoryBuffer<State_t, Action_t> m_trajectoryBuffer;
 	std::vector<uint32_t> m_sampleIndices;
+	AgentSlots<State_t, Action_t> m_slots;
+	TransitionBatch<State_t, Action_t> m_transitionBatch;
+
+	Tensor m_stateTensor;
+	Tensor m_actionTensor;
+	Tensor m_rewardTensor;
+	Tensor m_nextStateTensor;
+	Tensor m_nextDiscountTensor;
+	Tensor m_weightTensor;
+	Tensor m_nextValueTensor;
+	Tensor m_targetTensor;
+	Tensor m_deltaTensor;
 public:
 	static DeepActorCriticPtr Make(PolicyNetPtr actorNet, StateValueNetPtr criticNet, OptimizerPtr optimizer, PolicyFunctionPtr policy, const DeepActorCriticOptions& options)
 	{
@@ -1,10 +1,14 @@
 #pragma once
 #include "agent.h"
 #include "trajectory_buffer.h"
+#include "sequential_trajectory_buffer.h"
 #include "array.h"
 #include "neural_network.h"
 #include "multi_step_buffer.h"
 #include "exploration.h"
+#include "batch_prefetcher.h"
+#include "replay_service.h"
+#include <mutex>
 
 BEGIN_RLTL_IMPL
 
@@ -15,6 +19,7 @@ struct DeepActionValueOptions
 		m_batchSize(batchSize)
 	{
 		m_targetNetUpdateFreq = 0;// target network enabled if > 1
+		m_targetNetTau = 0;// soft target network updated on every learn step if > 0
 		m_multiStep = 0;// enabled if > 1
 		m_multiStepCompound = false;
 		m_experienceReplay = ExperienceReplay::no_experience_replay;
@@ -24,6 +29,11 @@ struct DeepActionValueOptions
 		m_prioritizedEpsilon = FLT_EPSILON;
 		m_prioritizedAlpha = 1.0f;
 		m_prioritizedBeta = 1.0f;
+		m_columnarReplay = false;
+		m_replayResume = false;
+		m_sequentialReplay = false;// observations stored once, only with (prioritized) experience replay
+		m_prefetchBatches = 0;// batches sampled ahead on a background thread if > 0, only with (prioritized) experience replay
+		m_externalReplay = false;// batches come from the source given to remoteReplay, the own replay memory is allocated by the first local append
 	}
 public:
 	DeepActionValueOptions& targetNetwork(uint32_t targetNetUpdateFreq)
@@ -31,6 +41,19 @@ public:
 		m_targetNetUpdateFreq = targetNetUpdateFreq;
 		return *this;
 	}
+	DeepActionValueOptions& softTargetNetwork(float targetNetTau)
+	{
+		m_targetNetTau = targetNetTau;
+		return *this;
+	}
+	//keeps the replay memory in a memory-mapped file, resume reuses the transitions of an existing file.
+	//initialize throws std::runtime_error if the file can not be mapped
+	DeepActionValueOptions& mappedReplay(const std::string& replayFilename, bool replayResume)
+	{
+		m_replayFilename = replayFilename;
+		m_replayResume = replayResume;
+		return *this;
+	}
 	DeepActionValueOptions& multiStep(uint32_t step, bool compound)
 	{
 		m_multiStep = step;
@@ -60,6 +83,7 @@ public:
 	RLTL_ARG(float, discountRate);
 	RLTL_ARG(uint32_t, batchSize);
 	RLTL_ARG(uint32_t, targetNetUpdateFreq);
+	RLTL_ARG(float, targetNetTau);
 	RLTL_ARG(uint32_t, multiStep);
 	RLTL_ARG(bool, multiStepCompound);
 	RLTL_ARG(ExperienceReplay, experienceReplay);
@@ -69,6 +93,12 @@ public:
 	RLTL_ARG(float, prioritizedEpsilon);
 	RLTL_ARG(float, prioritizedAlpha);
 	RLTL_ARG(float, prioritizedBeta);
+	RLTL_ARG(bool, columnarReplay);
+	RLTL_ARG(std::string, replayFilename);
+	RLTL_ARG(bool, replayResume);
+	RLTL_ARG(bool, sequentialReplay);
+	RLTL_ARG(uint32_t, prefetchBatches);
+	RLTL_ARG(bool, externalReplay);
 };
 
 struct DeepQLearningOptions : DeepActionValueOptions
@@ -100,8 +130,6 @@ struct DeepSarsaExtData
 public:
 	DeepSarsaExtData(const DeepSarsaOptions& options)
 	{}
-public:
-	Tensor m_nextActionTensor;
 };
 
 struct DeepExpectedSarsaOptions : DeepActionValueOptions
@@ -165,6 +193,7 @@ public:
 		m_discountRate(options.discountRate()),
 		m_batchSize(options.batchSize()),
 		m_targetNetUpdateFreq(options.targetNetUpdateFreq()),
+		m_targetNetTau(options.targetNetTau()),
 		m_multiStepCompound(options.multiStepCompound()),
 		m_experienceReplay(options.experienceReplay()),
 		m_replayMemorySize(options.replayMemorySize()),
@@ -172,7 +201,12 @@ public:
 		m_learnFreq(options.learnFreq()),
 		m_prioritizedEpsilon(options.prioritizedEpsilon()),
 		m_prioritizedAlpha(options.prioritizedAlpha()),
-		m_prioritizedBeta(options.prioritizedBeta())
+		m_prioritizedBeta(options.prioritizedBeta()),
+		m_sequentialReplay(options.sequentialReplay() && ExperienceReplay::no_experience_replay != options.experienceReplay()),
+		m_prefetchBatches(options.prefetchBatches()),
+		m_columnarReplay(options.columnarReplay()),
+		m_replayFilename(options.replayFilename()),
+		m_replayResume(options.replayResume())
 	{
 		m_targetNet = ActionValueNetPtr::Make(*valueNet->get());
 		m_targetNet->get()->device(m_valueNet->get()->device());
@@ -189,29 +223,24 @@ public:
 		{
 			NN_copyParameters(m_targetNet->get(), m_valueNet->get());
 		}
-		uint32_t bufferCapacity;
 		if (ExperienceReplay::no_experience_replay == m_experienceReplay)
 		{
-			bufferCapacity = m_batchSize + multiStep * 2;
+			m_bufferCapacity = m_batchSize + multiStep * 2;
 		}
 		else
 		{
-			bufferCapacity = std::max(m_replayMemorySize, m_warmUpSize);
+			m_bufferCapacity = std::max(m_replayMemorySize, m_warmUpSize);
 		}
-		m_trajectoryBuffer.initialize(bufferCapacity, TargetEvaluationMethod::sarsa == t_evaluationMethod, ExperienceReplay::prioritized_experience_replay == m_experienceReplay);
-		m_stateTensor = MakeTensor<State_t>(torch::kFloat32, m_batchSize);
-		m_actionTensor = MakeTensor<Action_t>(torch::kInt64, m_batchSize);
-		m_rewardTensor = MakeTensor<float>(torch::kFloat32, m_batchSize);
-		m_nextStateTensor = MakeTensor<State_t>(torch::kFloat32, m_batchSize);
-		m_nextDiscountTensor = MakeTensor<float>(torch::kFloat32, m_batchSize);
-		if constexpr(TargetEvaluationMethod::sarsa == t_evaluationMethod)
+		if (m_sequentialReplay)
 		{
-			m_nextActionTensor = MakeTensor<Action_t>(torch::kInt64);
+			bool needPriority = ExperienceReplay::prioritized_experience_replay == m_experienceReplay;
+			m_sequentialBuffer.initialize(m_bufferCapacity, multiStep, m_multiStepCompound, m_discountRate, needPriority);
 		}
-		if (ExperienceReplay::prioritized_experience_replay == m_experienceReplay)
+		else if (!options.externalReplay())
 		{
-			m_sampleIndices.resize(m_batchSize);
+			initializeTrajectoryBuffer();
 		}
+		allocateBatchTensors(m_batchSize);
 	}
 public:
 	Action_t firstStep(const State_t& firstState)
@@ -219,69 +248,25 @@ public:
 		m_state = firstState;
 		m_action = m_policy->takeAction(firstState);
 		m_multiStepBuffer.reset();
+		if (m_sequentialReplay)
+		{
+			m_sequentialBuffer.beginEpisode(0);
+		}
 		return m_action;
 	}
-	Action_t nextStep(float reward, const State_t& nextState)	
+	Action_t nextStep(float reward, const State_t& nextState)
 	{
 		if constexpr (TargetEvaluationMethod::sarsa == t_evaluationMethod)
 		{
 			Action_t nextAction = m_policy->takeAction(nextState);
-			if (m_multiStepBuffer)
-			{
-				m_multiStepBuffer.append(m_state, m_action, reward, m_discountRate);
-				if (m_multiStepCompound)
-				{
-					uint32_t count = std::min(m_multiStepBuffer.stepCount(), m_multiStepBuffer.multiStep());
-					for (size_t i = 0; i < count; ++i)
-					{
-						auto sar = m_multiStepBuffer.get(m_multiStepBuffer.stepCount() - count + i);
-						m_trajectoryBuffer.append(sar->state, sar->action, sar->accReward, nextState, sar->accDiscountRate, nextAction);
-					}
-				}
-				else
-				{
-					if (m_multiStepBuffer.stepCount() >= m_multiStepBuffer.multiStep())
-					{
-						auto sar = m_multiStepBuffer.getHead();
-						m_trajectoryBuffer.append(sar->state, sar->action, sar->accReward, nextState, sar->accDiscountRate, nextAction);
-					}
-				}
-			}
-			else
-			{
-				m_trajectoryBuffer.append(m_state, m_action, reward, nextState, m_discountRate, nextAction);
-			}
+			appendStep(0, m_state, m_action, reward, nextState, nextAction, false, false);
 			learn(false);
 			m_state = nextState;
 			m_action = nextAction;
 		}
 		else
 		{
-			if (m_multiStepBuffer)
-			{
-				m_multiStepBuffer.append(m_state, m_action, reward, m_discountRate);
-				if (m_multiStepCompound)
-				{
-					uint32_t count = std::min(m_multiStepBuffer.stepCount(), m_multiStepBuffer.multiStep());
-					for (size_t i = 0; i < count; ++i)
-					{
-						auto sar = m_multiStepBuffer.get(m_multiStepBuffer.stepCount() - count + i);
-						m_trajectoryBuffer.append(sar->state, sar->action, sar->accReward, nextState, sar->accDiscountRate);
-					}
-				}
-				else
-				{
-					if (m_multiStepBuffer.stepCount() >= m_multiStepBuffer.multiStep())
-					{
-						auto sar = m_multiStepBuffer.getHead();
-						m_trajectoryBuffer.append(sar->state, sar->action, sar->accReward, nextState, sar->accDiscountRate);
-					}
-				}
-			}
-			else
-			{
-				m_trajectoryBuffer.append(m_state, m_action, reward, nextState, m_discountRate);
-			}
+			appendStep(0, m_state, m_action, reward, nextState, m_action, false, false);
 			learn(false);
 			m_state = nextState;
 			m_action = m_policy->takeAction(nextState);
@@ -293,44 +278,331 @@ public:
 		if constexpr (TargetEvaluationMethod::sarsa == t_evaluationMethod)
 		{
 			Action_t nextAction = m_policy->takeAction(nextState);
-			if (m_multiStepBuffer)
+			appendStep(0, m_state, m_action, reward, nextState, nextAction, true, terminated);
+		}
+		else
+		{
+			appendStep(0, m_state, m_action, reward, nextState, m_action, true, terminated);
+		}
+		learn(true);
+	}
+public:
+	void firstSteps(std::vector<Action_t>& actions, const std::vector<State_t>& firstStates) override
+	{
+		m_slots.initialize(firstStates.size(), m_multiStepBuffer.multiStep());
+		if (m_sequentialReplay)
+		{
+			m_sequentialBuffer.numStreams(firstStates.size());
+			for (size_t i = 0; i < firstStates.size(); ++i)
+			{
+				m_sequentialBuffer.beginEpisode(i);
+			}
+		}
+		m_slots.m_states = firstStates;
+		m_policy->takeActions(m_slots.m_actions, m_slots.m_states);
+		actions = m_slots.m_actions;
+	}
+	void nextSteps(
+		std::vector<Action_t>& actions,
+		const std::vector<float>& rewards,
+		const std::vector<State_t>& nextStates,
+		const std::vector<EnvironmentStatus>& statuses,
+		const std::vector<State_t>& resetStates) override
+	{
+		size_t count = m_slots.size();
+		assert(rewards.size() == count && nextStates.size() == count && statuses.size() == count);
+		if constexpr (TargetEvaluationMethod::sarsa == t_evaluationMethod)
+		{
+			m_policy->takeActions(m_slots.m_nextActions, nextStates);
+		}
+		m_transitionBatch.clear();
+		bool anyLastStep = false;
+		for (size_t i = 0; i < count; ++i)
+		{
+			bool lastStep = EnvironmentStatus::es_normal != statuses[i];
+			const Action_t& nextAction = TargetEvaluationMethod::sarsa == t_evaluationMethod ? m_slots.m_nextActions[i] : m_slots.m_actions[i];
+			if (m_sequentialReplay)
+			{
+				appendSequential(i, m_slots.m_states[i], m_slots.m_actions[i], rewards[i], nextStates[i], nextAction, lastStep, EnvironmentStatus::es_terminated == statuses[i]);
+			}
+			else
+			{
+				appendTransition(m_transitionBatch, m_slots.m_multiStepBuffers[i], m_slots.m_states[i], m_slots.m_actions[i], rewards[i], nextStates[i], nextAction, lastStep, EnvironmentStatus::es_terminated == statuses[i]);
+			}
+			if (lastStep)
+			{
+				m_slots.beginEpisode(i);
+				m_slots.m_states[i] = resetStates[i];
+				anyLastStep = true;
+			}
+			else
+			{
+				++m_slots.m_stepCounts[i];
+				m_slots.m_states[i] = nextStates[i];
+			}
+		}
+		if (!m_sequentialReplay)
+		{
+			std::lock_guard<std::mutex> lock(m_trajectoryBufferMutex);
+			localTrajectoryBuffer().append(m_transitionBatch);
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			learn(EnvironmentStatus::es_normal != statuses[i]);
+		}
+		if constexpr (TargetEvaluationMethod::sarsa == t_evaluationMethod)
+		{
+			//keep the on-policy actions, only slots which started a new episode need a new one
+			m_slots.m_actions = m_slots.m_nextActions;
+			if (anyLastStep)
 			{
-				m_multiStepBuffer.append(m_state, m_action, reward, m_discountRate);
-				uint32_t count = std::min(m_multiStepBuffer.stepCount(), m_multiStepBuffer.multiStep());
 				for (size_t i = 0; i < count; ++i)
 				{
-					auto sar = m_multiStepBuffer.get(m_multiStepBuffer.stepCount() - count + i);
-					m_trajectoryBuffer.append(sar->state, sar->action, sar->accReward, nextState, terminated ? 0 : sar->accDiscountRate, nextAction);
+					if (EnvironmentStatus::es_normal != statuses[i])
+					{
+						m_slots.m_actions[i] = m_policy->takeAction(m_slots.m_states[i]);
+					}
 				}
 			}
-			else
-			{ 
-				m_trajectoryBuffer.append(m_state, m_action, reward, nextState, terminated ? 0 : m_discountRate, nextAction);
+		}
+		else
+		{
+			m_policy->takeActions(m_slots.m_actions, m_slots.m_states);
+		}
+		actions = m_slots.m_actions;
+	}
+	void beginSlotSteps(size_t count) override
+	{
+		m_slots.initialize(count, m_multiStepBuffer.multiStep());
+		if (m_sequentialReplay)
+		{
+			m_sequentialBuffer.numStreams(count);
+		}
+	}
+	Action_t firstSlotStep(size_t slot, const State_t& firstState) override
+	{
+		m_slots.beginEpisode(slot);
+		if (m_sequentialReplay)
+		{
+			m_sequentialBuffer.beginEpisode(slot);
+		}
+		m_slots.m_states[slot] = firstState;
+		m_slots.m_actions[slot] = m_policy->takeAction(firstState);
+		return m_slots.m_actions[slot];
+	}
+	Action_t nextSlotStep(size_t slot, float reward, const State_t& nextState, EnvironmentStatus status, const State_t& resetState) override
+	{
+		bool lastStep = EnvironmentStatus::es_normal != status;
+		bool terminated = EnvironmentStatus::es_terminated == status;
+		Action_t nextAction = TargetEvaluationMethod::sarsa == t_evaluationMethod ? m_policy->takeAction(nextState) : m_slots.m_actions[slot];
+		if (m_sequentialReplay)
+		{
+			appendSequential(slot, m_slots.m_states[slot], m_slots.m_actions[slot], reward, nextState, nextAction, lastStep, terminated);
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(m_trajectoryBufferMutex);
+			appendTransition(localTrajectoryBuffer(), m_slots.m_multiStepBuffers[slot], m_slots.m_states[slot], m_slots.m_actions[slot], reward, nextState, nextAction, lastStep, terminated);
+		}
+		learn(lastStep);
+		if (lastStep)
+		{
+			return firstSlotStep(slot, resetState);
+		}
+		++m_slots.m_stepCounts[slot];
+		m_slots.m_states[slot] = nextState;
+		m_slots.m_actions[slot] = TargetEvaluationMethod::sarsa == t_evaluationMethod ? nextAction : m_policy->takeAction(nextState);
+		return m_slots.m_actions[slot];
+	}
+public:
+	//learner side of DeepQNetworkActorLearner, the transitions are produced by the actor threads
+	void appendTransitions(const TransitionBatch<State_t, Action_t>& transitions)
+	{
+		assert(!m_sequentialReplay);
+		std::lock_guard<std::mutex> lock(m_trajectoryBufferMutex);
+		localTrajectoryBuffer().append(transitions);
+	}
+	//one gradient step on a sampled batch, returns false while the replay memory is warming up
+	//or if no batch could be sampled, see replayConnected()
+	bool learnerStep()
+	{
+		assert(ExperienceReplay::no_experience_replay != m_experienceReplay);
+		{
+			std::lock_guard<std::mutex> lock(m_trajectoryBufferMutex);
+			if (replaySize() < std::max(m_warmUpSize, m_batchSize))
+			{
+				return false;
+			}
+		}
+		++m_learnCount;
+		if (!update(m_batchSize))
+		{
+			//the target net cadence counts learned steps only
+			--m_learnCount;
+			return false;
+		}
+		return true;
+	}
+	//false once the remote replay can no longer be sampled, a learner loop should stop then
+	bool replayConnected()
+	{
+		std::lock_guard<std::mutex> lock(m_trajectoryBufferMutex);
+		return !m_remoteReplay || m_remoteReplay->connected();
+	}
+	uint64_t learnCount() const override
+	{
+		return m_learnCount;
+	}
+	uint32_t batchSize() const
+	{
+		return m_batchSize;
+	}
+	ActionValueNetPtr valueNet() const
+	{
+		return m_valueNet;
+	}
+	//learner process of a replay service, batches are sampled from source instead of the own buffer
+	void remoteReplay(ReplaySource<State_t, Action_t>* source)
+	{
+		static_assert(TargetEvaluationMethod::sarsa != t_evaluationMethod, "the replay service does not store next actions");
+		assert(!m_sequentialReplay && ExperienceReplay::no_experience_replay != m_experienceReplay);
+		//no batch of the old source is learned from, the prefetch thread restarts on the next update.
+		//it is stopped before taking the lock which its fill takes
+		m_prefetcher.stop();
+		std::lock_guard<std::mutex> lock(m_trajectoryBufferMutex);
+		m_remoteReplay = source;
+	}
+	//n of the returns rebuilt at sample time, only with sequential replay, the stored steps are kept
+	void multiStep(uint32_t multiStep)
+	{
+		assert(m_sequentialReplay);
+		std::lock_guard<std::mutex> lock(m_trajectoryBufferMutex);
+		m_sequentialBuffer.multiStep(multiStep);
+	}
+protected:
+	uint32_t replaySize() const
+	{
+		if (m_remoteReplay)
+		{
+			return m_remoteReplay->size();
+		}
+		return m_sequentialReplay ? m_sequentialBuffer.size() : m_trajectoryBuffer.size();
+	}
+	void appendStep(
+		size_t stream,
+		const State_t& state,
+		const Action_t& action,
+		float reward,
+		const State_t& nextState,
+		const Action_t& nextAction,
+		bool lastStep,
+		bool terminated)
+	{
+		if (m_sequentialReplay)
+		{
+			appendSequential(stream, state, action, reward, nextState, nextAction, lastStep, terminated);
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(m_trajectoryBufferMutex);
+			appendTransition(localTrajectoryBuffer(), m_multiStepBuffer, state, action, reward, nextState, nextAction, lastStep, terminated);
+		}
+	}
+	//the own replay memory, allocated here on the first local append of an externalReplay learner. needs m_trajectoryBufferMutex
+	TrajectoryBuffer<State_t, Action_t>& localTrajectoryBuffer()
+	{
+		if (!m_trajectoryBufferReady)
+		{
+			initializeTrajectoryBuffer();
+		}
+		return m_trajectoryBuffer;
+	}
+	void initializeTrajectoryBuffer()
+	{
+		bool needNextAction = TargetEvaluationMethod::sarsa == t_evaluationMethod;
+		bool needPriority = ExperienceReplay::prioritized_experience_replay == m_experienceReplay;
+		if (!m_replayFilename.empty())
+		{
+			//a requested replay file is not silently replaced by heap storage, resume would lose the transitions
+			if (!m_trajectoryBuffer.initializeMapped(m_replayFilename, m_bufferCapacity, needNextAction, needPriority, m_replayResume))
+			{
+				throw std::runtime_error("can not map the replay file " + m_replayFilename);
 			}
 		}
 		else
 		{
-			if (m_multiStepBuffer)
+			m_trajectoryBuffer.initialize(m_bufferCapacity, needNextAction, needPriority, m_columnarReplay);
+		}
+		m_trajectoryBufferReady = true;
+	}
+	//the next state is only stored at the end of an episode, otherwise it is the state of the next step
+	void appendSequential(
+		size_t stream,
+		const State_t& state,
+		const Action_t& action,
+		float reward,
+		const State_t& nextState,
+		const Action_t& nextAction,
+		bool lastStep,
+		bool terminated)
+	{
+		std::lock_guard<std::mutex> lock(m_trajectoryBufferMutex);
+		m_sequentialBuffer.append(stream, state, action, reward);
+		if (lastStep)
+		{
+			m_sequentialBuffer.endEpisode(stream, nextState, terminated, nextAction);
+		}
+	}
+	template<typename Transitions_t>
+	void appendTransition(
+		Transitions_t& transitions,
+		MultiStepBuffer<State_t, Action_t>& multiStepBuffer,
+		const State_t& state,
+		const Action_t& action,
+		float reward,
+		const State_t& nextState,
+		const Action_t& nextAction,
+		bool lastStep,
+		bool terminated)
+	{
+		if (multiStepBuffer)
+		{
+			multiStepBuffer.append(state, action, reward, m_discountRate);
+			if (lastStep || m_multiStepCompound)
 			{
-				m_multiStepBuffer.append(m_state, m_action, reward, m_discountRate);
-				uint32_t count = std::min(m_multiStepBuffer.stepCount(), m_multiStepBuffer.multiStep());
+				uint32_t count = std::min(multiStepBuffer.stepCount(), multiStepBuffer.multiStep());
 				for (size_t i = 0; i < count; ++i)
 				{
-					auto sar = m_multiStepBuffer.get(m_multiStepBuffer.stepCount() - count + i);
-					m_trajectoryBuffer.append(sar->state, sar->action, sar->accReward, nextState, terminated ? 0 : sar->accDiscountRate);
+					auto sar = multiStepBuffer.get(multiStepBuffer.stepCount() - count + i);
+					appendToTransitions(transitions, sar->state, sar->action, sar->accReward, nextState, terminated ? 0 : sar->accDiscountRate, nextAction);
 				}
 			}
-			else
+			else if (multiStepBuffer.stepCount() >= multiStepBuffer.multiStep())
 			{
-				m_trajectoryBuffer.append(m_state, m_action, reward, nextState, terminated ? 0 : m_discountRate);
+				auto sar = multiStepBuffer.getHead();
+				appendToTransitions(transitions, sar->state, sar->action, sar->accReward, nextState, sar->accDiscountRate, nextAction);
 			}
 		}
-		learn(true);
+		else
+		{
+			appendToTransitions(transitions, state, action, reward, nextState, terminated ? 0 : m_discountRate, nextAction);
+		}
+	}
+	template<typename Transitions_t>
+	void appendToTransitions(Transitions_t& transitions, const State_t& state, const Action_t& action, float reward, const State_t& nextState, float nextDiscount, const Action_t& nextAction)
+	{
+		if constexpr (TargetEvaluationMethod::sarsa == t_evaluationMethod)
+		{
+			transitions.append(state, action, reward, nextState, nextDiscount, nextAction);
+		}
+		else
+		{
+			transitions.append(state, action, reward, nextState, nextDiscount);
+		}
 	}
-protected:
 	bool useTargetNet() const
 	{
-		return m_targetNetUpdateFreq > 1;
+		return m_targetNetUpdateFreq > 1 || m_targetNetTau > 0;
 	}
 	void learn(bool lastStep)
 	{
@@ -349,7 +621,7 @@ protected:
 		}
 		else
 		{
-			if (m_trajectoryBuffer.size() < m_warmUpSize)
+			if (replaySize() < m_warmUpSize)
 			{
 				return;
 			}
@@ -359,135 +631,264 @@ protected:
 			}
 		}
 		++m_learnCount;
-
-		//Tensor stateTensor = m_stateTensor;
-		//Tensor actionTensor = m_actionTensor;
-		//Tensor rewardTensor = m_rewardTensor;
-		//Tensor nextStateTensor = m_nextStateTensor;
-		//Tensor nextDiscountTensor = m_nextDiscountTensor;
-		//Tensor weightTensor = m_weightTensor;
-
-		Tensor stateTensor = MakeTensor<State_t>(torch::kFloat32, batchSize);
-		Tensor actionTensor = MakeTensor<Action_t>(torch::kInt64, batchSize);
-		Tensor rewardTensor = MakeTensor<float>(torch::kFloat32, batchSize);
-		Tensor nextStateTensor = MakeTensor<State_t>(torch::kFloat32, batchSize);
-		Tensor nextDiscountTensor = MakeTensor<float>(torch::kFloat32, batchSize);
-		Tensor weightTensor = MakeTensor<float>(torch::kFloat32, batchSize);
-
-
-		if constexpr (TargetEvaluationMethod::sarsa == t_evaluationMethod)
+		update(batchSize);
+	}
+	//the scratch tensors are kept across updates and only reallocated when the batch size changes,
+	//which happens for the shorter batches at the end of an episode without experience replay
+	void allocateBatchTensors(uint32_t batchSize)
+	{
+		if (m_nextValueTensor.defined() && m_nextValueTensor.size(0) == batchSize)
+		{
+			return;
+		}
+		if constexpr (TargetEvaluationMethod::expected_sarsa == t_evaluationMethod)
+		{
+			m_expectedValueTensor = MakeTensor<float>(torch::kFloat32, batchSize);
+		}
+		torch::Device device = m_valueNet->get()->device();
+		m_maxActionTensor = MakeTensor<Action_t>(torch::kInt64, batchSize).to(device);
+		m_nextValueTensor = MakeTensor<float>(torch::kFloat32, batchSize).to(device);
+		m_targetTensor = MakeTensor<float>(torch::kFloat32, batchSize).to(device);
+		m_deltaTensor = MakeTensor<float>(torch::kFloat32, batchSize).to(device);
+	}
+	//fills batch from the replay memory and uploads it to the device of the net,
+	//runs on the prefetch thread when prefetching is enabled
+	bool sampleBatch(ReplayBatch& batch, uint32_t batchSize)
+	{
+		batch.allocate<State_t, Action_t>(batchSize, TargetEvaluationMethod::sarsa == t_evaluationMethod);
 		{
-			switch (m_experienceReplay)
+			std::lock_guard<std::mutex> lock(m_trajectoryBufferMutex);
+			if (m_remoteReplay)
 			{
-			case ExperienceReplay::no_experience_replay:
-				m_trajectoryBuffer.pop(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, nextActionTensor, batchSize);
-				break;
-			case ExperienceReplay::experience_replay:
 				assert(batchSize == m_batchSize);
-				m_trajectoryBuffer.sample(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, nextActionTensor, batchSize);
-				break;
-			case ExperienceReplay::prioritized_experience_replay:
+				bool sampled;
+				if (ExperienceReplay::prioritized_experience_replay == m_experienceReplay)
+				{
+					sampled = m_remoteReplay->sample(batch.m_indices, batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batch.m_weightTensor, batchSize, m_prioritizedBeta);
+					if (sampled)
+					{
+						m_remoteReplay->serials(batch.m_indices, batch.m_serials, batchSize);
+					}
+				}
+				else
+				{
+					sampled = m_remoteReplay->sample(batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batchSize);
+				}
+				if (!sampled)
+				{
+					return false;
+				}
+			}
+			else if (m_sequentialReplay)
+			{
 				assert(batchSize == m_batchSize);
-				m_trajectoryBuffer.sample(m_sampleIndices, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, nextActionTensor, weightTensor, batchSize, m_prioritizedBeta);
-				break;
-			default:
-				return;
+				sampleSequential(batch, batchSize);
+			}
+			else if constexpr (TargetEvaluationMethod::sarsa == t_evaluationMethod)
+			{
+				switch (m_experienceReplay)
+				{
+				case ExperienceReplay::no_experience_replay:
+					m_trajectoryBuffer.pop(batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batch.m_nextActionTensor, batchSize);
+					break;
+				case ExperienceReplay::experience_replay:
+					assert(batchSize == m_batchSize);
+					m_trajectoryBuffer.sample(batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batch.m_nextActionTensor, batchSize);
+					break;
+				case ExperienceReplay::prioritized_experience_replay:
+					assert(batchSize == m_batchSize);
+					m_trajectoryBuffer.sample(batch.m_indices, batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batch.m_nextActionTensor, batch.m_weightTensor, batchSize, m_prioritizedBeta);
+					m_trajectoryBuffer.serials(batch.m_indices, batch.m_serials, batchSize);
+					break;
+				default:
+					return false;
+				}
+			}
+			else
+			{
+				switch (m_experienceReplay)
+				{
+				case ExperienceReplay::no_experience_replay:
+					m_trajectoryBuffer.pop(batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batchSize);
+					break;
+				case ExperienceReplay::experience_replay:
+					assert(batchSize == m_batchSize);
+					m_trajectoryBuffer.sample(batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batchSize);
+					break;
+				case ExperienceReplay::prioritized_experience_replay:
+					assert(batchSize == m_batchSize);
+					m_trajectoryBuffer.sample(batch.m_indices, batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batch.m_weightTensor, batchSize, m_prioritizedBeta);
+					m_trajectoryBuffer.serials(batch.m_indices, batch.m_serials, batchSize);
+					break;
+				default:
+					return false;
+				}
 			}
 		}
-		else
+		//to() returns the same tensor when the net is on the cpu
+		batch.upload(m_valueNet->get()->device());
+		return true;
+	}
+	void sampleSequential(ReplayBatch& batch, uint32_t batchSize)
+	{
+		bool prioritized = ExperienceReplay::prioritized_experience_replay == m_experienceReplay;
+		if constexpr (TargetEvaluationMethod::sarsa == t_evaluationMethod)
 		{
-			switch (m_experienceReplay)
+			if (prioritized)
 			{
-			case ExperienceReplay::no_experience_replay:
-				m_trajectoryBuffer.pop(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, batchSize);
-				break;
-			case ExperienceReplay::experience_replay:
-				assert(batchSize == m_batchSize);
-				m_trajectoryBuffer.sample(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, batchSize);
-				break;
-			case ExperienceReplay::prioritized_experience_replay:
-				assert(batchSize == m_batchSize);
-				m_trajectoryBuffer.sample(m_sampleIndices, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor, batchSize, m_prioritizedBeta);
-				break;
-			default:
-				return;
+				m_sequentialBuffer.sample(batch.m_indices, batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batch.m_nextActionTensor, batch.m_weightTensor, batchSize, m_prioritizedBeta);
+				m_sequentialBuffer.serials(batch.m_indices, batch.m_serials, batchSize);
+			}
+			else
+			{
+				m_sequentialBuffer.sample(batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batch.m_nextActionTensor, batchSize);
 			}
 		}
-
-		torch::Device device = m_valueNet->get()->device();
-		stateTensor = stateTensor.to(device);
-		actionTensor = actionTensor.to(device);
-		rewardTensor = rewardTensor.to(device);
-		nextStateTensor = nextStateTensor.to(device);
-		nextDiscountTensor = nextDiscountTensor.to(device);
-		weightTensor = weightTensor.to(device);
-
-		Tensor valueTensor = m_valueNet->forward(stateTensor).gather(1, actionTensor);
-		assert(valueTensor.dim() == 2 && valueTensor.size(0) == m_batchSize);
-
-		Tensor nextValueTensor;
-		if constexpr (TargetEvaluationMethod::q_learning == t_evaluationMethod)
+		else
 		{
-			if (m_doubleDQN)
+			if (prioritized)
 			{
-				Tensor maxActionTensor = std::get<1>(m_valueNet->forward(nextStateTensor).max(1, true));
-				nextValueTensor = m_targetNet->forward(nextStateTensor).gather(1, maxActionTensor);
+				m_sequentialBuffer.sample(batch.m_indices, batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batch.m_weightTensor, batchSize, m_prioritizedBeta);
+				m_sequentialBuffer.serials(batch.m_indices, batch.m_serials, batchSize);
 			}
 			else
 			{
-				nextValueTensor = std::get<0>(m_targetNet->forward(nextStateTensor).max(1, true));
+				m_sequentialBuffer.sample(batch.m_stateTensor, batch.m_actionTensor, batch.m_rewardTensor, batch.m_nextStateTensor, batch.m_nextDiscountTensor, batchSize);
 			}
 		}
-		else if constexpr (TargetEvaluationMethod::sarsa == t_evaluationMethod)
+	}
+	//false if no batch could be sampled, nothing is learned then
+	bool update(uint32_t batchSize)
+	{
+		allocateBatchTensors(batchSize);
+		//the replay memory never shrinks below the batch size once replay has started, so the
+		//prefetch thread is started on the first update and always finds enough transitions
+		bool prefetch = m_prefetchBatches > 0 && ExperienceReplay::no_experience_replay != m_experienceReplay;
+		ReplayBatch* batch = &m_batch;
+		if (prefetch)
 		{
-			nextValueTensor = m_targetNet->forward(nextStateTensor).gather(1, nextActionTensor);//semi-gradient
+			assert(batchSize == m_batchSize);
+			if (!m_prefetcher.running())
+			{
+				m_prefetcher.start(m_prefetchBatches, [this](ReplayBatch& prefetched) { prefetched.m_sampled = sampleBatch(prefetched, m_batchSize); });
+			}
+			batch = &m_prefetcher.acquire();
+			if (!batch->m_sampled)
+			{
+				m_prefetcher.release(*batch);
+				return false;
+			}
 		}
-		else
+		else if (!sampleBatch(m_batch, batchSize))
 		{
-			nextValueTensor = torch::empty({ m_batchSize, 1 }, torch::TensorOptions().dtype(torch::kFloat32));
-			auto nextValueAccessor = nextValueTensor.accessor<float, 2>();
+			return false;
+		}
+		Tensor& stateTensor = batch->m_deviceStateTensor;
+		Tensor& actionTensor = batch->m_deviceActionTensor;
+		Tensor& rewardTensor = batch->m_deviceRewardTensor;
+		Tensor& nextStateTensor = batch->m_deviceNextStateTensor;
+		Tensor& nextDiscountTensor = batch->m_deviceNextDiscountTensor;
+		Tensor& weightTensor = batch->m_deviceWeightTensor;
 
-			Tensor nextValuesTensor = m_targetNet->forward(nextStateTensor);
-			assert(nextValuesTensor.dim() == 2 && nextValuesTensor.size(0) == m_batchSize);
-			auto nextValuesAccessor = nextValuesTensor.accessor<float, 2>();
+		Tensor valueTensor = m_valueNet->forward(stateTensor).gather(1, actionTensor);
+		assert(valueTensor.dim() == 2 && valueTensor.size(0) == batchSize);
 
-			size_t count = nextValuesTensor.size(1);
-			std::vector<float> nextValues(count);
-			for (size_t i = 0; i < m_batchSize; ++i)
+		{
+			//semi-gradient, the target is written into the persistent tensors without recording a graph
+			torch::NoGradGuard nograd;
+			ActionValueNetPtr& targetNet = useTargetNet() ? m_targetNet : m_valueNet;
+			if constexpr (TargetEvaluationMethod::q_learning == t_evaluationMethod)
+			{
+				if (this->m_doubleDQN)
+				{
+					//m_targetTensor is only scratch for the max values here
+					torch::max_out(m_targetTensor, m_maxActionTensor, m_valueNet->forward(nextStateTensor), 1, true);
+					torch::gather_out(m_nextValueTensor, targetNet->forward(nextStateTensor), 1, m_maxActionTensor);
+				}
+				else
+				{
+					torch::max_out(m_nextValueTensor, m_maxActionTensor, targetNet->forward(nextStateTensor), 1, true);
+				}
+			}
+			else if constexpr (TargetEvaluationMethod::sarsa == t_evaluationMethod)
 			{
-				for (size_t j = 0; j < count; ++j)
+				torch::gather_out(m_nextValueTensor, targetNet->forward(nextStateTensor), 1, batch->m_deviceNextActionTensor);
+			}
+			else
+			{
+				Tensor nextValuesTensor = targetNet->forward(nextStateTensor).to(torch::kCPU);
+				assert(nextValuesTensor.dim() == 2 && nextValuesTensor.size(0) == batchSize);
+				auto nextValuesAccessor = nextValuesTensor.accessor<float, 2>();
+				auto expectedValueAccessor = m_expectedValueTensor.accessor<float, 2>();
+				size_t count = nextValuesTensor.size(1);
+				m_nextValues.resize(count);
+				for (size_t i = 0; i < batchSize; ++i)
 				{
-					nextValues[j] = nextValuesAccessor[i][j];
+					for (size_t j = 0; j < count; ++j)
+					{
+						m_nextValues[j] = nextValuesAccessor[i][j];
+					}
+					expectedValueAccessor[i][0] = m_policy->getExpectedValue(m_nextValues);
 				}
-				nextValueAccessor[i][0] = m_policy.getExpectedValue(nextValues);
+				m_nextValueTensor.copy_(m_expectedValueTensor);
+			}
+			assert(m_nextValueTensor.dim() == 2 && m_nextValueTensor.size(0) == batchSize && m_nextValueTensor.size(1) == 1);
+			torch::mul_out(m_targetTensor, m_nextValueTensor, nextDiscountTensor);
+			m_targetTensor.add_(rewardTensor);
+			if (ExperienceReplay::prioritized_experience_replay == m_experienceReplay)
+			{
+				torch::sub_out(m_deltaTensor, m_targetTensor, valueTensor);
 			}
 		}
-		assert(nextValueTensor.dim() == 2 && nextValueTensor.size(0) == m_batchSize && nextValueTensor.size(1) == 1);
-		Tensor targetTensor = rewardTensor + nextValueTensor * nextDiscountTensor;
 
-		assert(targetTensor.dim() == 2 && targetTensor.size(0) == m_batchSize && targetTensor.size(1) == 1);
 		Tensor lossTensor;
 		if (ExperienceReplay::prioritized_experience_replay == m_experienceReplay)
 		{
-			Tensor deltaTensor = targetTensor - valueTensor;
-			assert(deltaTensor.dim() == 2 && deltaTensor.size(0) == m_batchSize && deltaTensor.size(1) == 1);
-			m_trajectoryBuffer.updatePriorities(m_sampleIndices, deltaTensor, m_batchSize, m_prioritizedAlpha, m_prioritizedEpsilon);
-			Tensor costTensor = torch::nn::functional::mse_loss(valueTensor, targetTensor, torch::nn::functional::MSELossFuncOptions().reduction(torch::kNone)) * m_weightTensor;
+			{
+				//batches sampled ahead see priorities at most m_prefetchBatches updates old, the serials
+				//taken with the sample skip the slots which the actors have overwritten since
+				std::lock_guard<std::mutex> lock(m_trajectoryBufferMutex);
+				if (m_remoteReplay)
+				{
+					m_remoteReplay->updatePriorities(batch->m_indices, batch->m_serials, m_deltaTensor.to(torch::kCPU), m_batchSize, m_prioritizedAlpha, m_prioritizedEpsilon);
+				}
+				else if (m_sequentialReplay)
+				{
+					m_sequentialBuffer.updatePriorities(batch->m_indices, batch->m_serials, m_deltaTensor.to(torch::kCPU), m_batchSize, m_prioritizedAlpha, m_prioritizedEpsilon);
+				}
+				else
+				{
+					m_trajectoryBuffer.updatePriorities(batch->m_indices, batch->m_serials, m_deltaTensor.to(torch::kCPU), m_batchSize, m_prioritizedAlpha, m_prioritizedEpsilon);
+				}
+			}
+			Tensor costTensor = torch::nn::functional::mse_loss(valueTensor, m_targetTensor, torch::nn::functional::MSELossFuncOptions().reduction(torch::kNone)) * weightTensor;
 			assert(costTensor.dim() == 2 && costTensor.size(0) == m_batchSize && costTensor.size(1) == 1);
 			lossTensor = torch::mean(costTensor);
 		}
 		else
 		{
-			lossTensor = torch::mean(torch::nn::functional::mse_loss(valueTensor, targetTensor));
+			lossTensor = torch::mean(torch::nn::functional::mse_loss(valueTensor, m_targetTensor));
 		}
 		assert(lossTensor.dim() == 0 && 1 == lossTensor.numel());
 		m_optimizer->zero_grad();
 		lossTensor.backward();
 		m_optimizer->step();
-		if (m_learnCount % m_targetNetUpdateFreq == 0)
+		if (prefetch)
 		{
-			NN_copyParameters(m_targetNet->module(), m_valueNet->module());
+			m_prefetcher.release(*batch);
 		}
+		if (useTargetNet())
+		{
+			if (m_targetNetTau > 0)
+			{
+				NN_softUpdateParameters(m_targetNet->module(), m_valueNet->module(), m_targetNetTau);
+			}
+			else if (m_learnCount % m_targetNetUpdateFreq == 0)
+			{
+				NN_copyParameters(m_targetNet->module(), m_valueNet->module());
+			}
+		}
+		return true;
 	}
 protected:
 	template<typename Element_t, typename TensorScalar_t>
@@ -512,6 +913,7 @@ protected:
 	float m_discountRate;
 	uint32_t m_batchSize;
 	uint32_t m_targetNetUpdateFreq;
+	float m_targetNetTau;
 	bool m_multiStepCompound;
 	ExperienceReplay m_experienceReplay;
 	uint32_t m_replayMemorySize;
@@ -520,21 +922,36 @@ protected:
 	float m_prioritizedEpsilon;
 	float m_prioritizedAlpha;
 	float m_prioritizedBeta;
-	uint32_t m_tryLearnCount{};
-	uint32_t m_learnCount{};
+	bool m_sequentialReplay;
+	uint32_t m_prefetchBatches;
+	bool m_columnarReplay;
+	std::string m_replayFilename;
+	bool m_replayResume;
+	uint32_t m_bufferCapacity;
+	uint64_t m_tryLearnCount{};
+	uint64_t m_learnCount{};
 
 	State_t m_state;
 	Action_t m_action;
 	MultiStepBuffer<State_t, Action_t> m_multiStepBuffer;
 	TrajectoryBuffer<State_t, Action_t> m_trajectoryBuffer;
-	std::vector<uint32_t> m_sampleIndices;
-
-	Tensor m_stateTensor;
-	Tensor m_actionTensor;
-	Tensor m_rewardTensor;
-	Tensor m_nextStateTensor;
-	Tensor m_nextDiscountTensor;
-	Tensor m_weightTensor;
+	bool m_trajectoryBufferReady{ false };
+	SequentialTrajectoryBuffer<State_t, Action_t> m_sequentialBuffer;
+	ReplaySource<State_t, Action_t>* m_remoteReplay{ nullptr };
+	std::mutex m_trajectoryBufferMutex;
+
+	AgentSlots<State_t, Action_t> m_slots;
+	TransitionBatch<State_t, Action_t> m_transitionBatch;
+
+	ReplayBatch m_batch;
+	Tensor m_maxActionTensor;
+	Tensor m_nextValueTensor;
+	Tensor m_targetTensor;
+	Tensor m_deltaTensor;
+	Tensor m_expectedValueTensor;
+	std::vector<float> m_nextValues;
+	//last member, its thread samples from the buffers above and has to stop before they are destroyed
+	BatchPrefetcher<ReplayBatch> m_prefetcher;
 
 public:
 	static DeepQNetworkPtr Make(ActionValueNetPtr valueNet, OptimizerPtr optimizer, PolicyFunctionPtr policy, const DeepQLearningOptions& options)
@@ -0,0 +1,381 @@
+#pragma once
+#include "deep_q_network.h"
+#include "rate_limiter.h"
+#include "parameter_store.h"
+#include "sharded_trajectory_buffer.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cmath>
+
+BEGIN_RLTL_IMPL
+
+struct ActorLearnerOptions
+{
+	ActorLearnerOptions(uint32_t numActors) :
+		m_numActors(numActors)
+	{
+		m_publishInterval = 100;// learner updates between two weight publications
+		m_actorEpsilon = 0.4f;
+		m_actorEpsilonAlpha = 7.0f;// actor i explores with epsilon ^ (1 + alpha * i / (numActors - 1))
+		m_actorFlushSize = 32;// transitions an actor collects before appending them to the shared buffer
+		m_samplesPerInsert = 0;// sampled transitions per inserted transition, no rate limit if 0
+		m_rateLimitError = 0;// allowed deviation from samplesPerInsert in sampled transitions, at least one flush and one batch
+		m_replayShards = 0;// replay shards with their own sum tree and lock, actor i appends to shard i % replayShards, one shared buffer if 0
+		m_pinActors = false;// pin every actor thread to the numa node of its replay shard
+	}
+public:
+	ActorLearnerOptions& actorExploration(float epsilon, float alpha)
+	{
+		m_actorEpsilon = epsilon;
+		m_actorEpsilonAlpha = alpha;
+		return *this;
+	}
+public:
+	RLTL_ARG(uint32_t, numActors);
+	RLTL_ARG(uint32_t, publishInterval);
+	RLTL_ARG(float, actorEpsilon);
+	RLTL_ARG(float, actorEpsilonAlpha);
+	RLTL_ARG(uint32_t, actorFlushSize);
+	RLTL_ARG(float, samplesPerInsert);
+	RLTL_ARG(float, rateLimitError);
+	RLTL_ARG(uint32_t, replayShards);
+	RLTL_ARG(bool, pinActors);
+};
+
+//acting half of a DeepQNetwork, explores with its own copy of the action-value net
+template<typename ActionValueNet_t, typename Learner_t>
+class DeepQNetworkActor : public Agent<typename ActionValueNet_t::State_t, typename ActionValueNet_t::Action_t>
+{
+public:
+	typedef typename ActionValueNet_t::State_t State_t;
+	typedef typename ActionValueNet_t::Action_t Action_t;
+	typedef paf::SharedPtr<ActionValueNet_t> ActionValueNetPtr;
+	typedef EpsilonGreedy<State_t, Action_t> EpsilonGreedy_t;
+	typedef paf::SharedPtr<EpsilonGreedy_t> EpsilonGreedyPtr;
+	typedef ShardedTrajectoryBuffer<State_t, Action_t> ShardedBuffer_t;
+public:
+	//without shardedBuffer the transitions go to the buffer of the learner
+	DeepQNetworkActor(Learner_t* learner, ParameterStore* parameterStore, RateLimiter* rateLimiter, ShardedBuffer_t* shardedBuffer, uint32_t shard,
+		ActionValueNetPtr prototype, float epsilon, float discountRate, uint32_t multiStep, bool multiStepCompound, uint32_t flushSize) :
+		m_learner(learner),
+		m_parameterStore(parameterStore),
+		m_rateLimiter(rateLimiter),
+		m_shardedBuffer(shardedBuffer),
+		m_shard(shard),
+		m_discountRate(discountRate),
+		m_multiStepCompound(multiStepCompound),
+		m_flushSize(std::max(flushSize, 1u))
+	{
+		m_valueNet = ActionValueNetPtr::Make(*prototype->get());
+		m_policy = EpsilonGreedy_t::Make(GreedyAction<State_t, Action_t>::Make(m_valueNet), epsilon);
+		if (multiStep > 1)
+		{
+			m_multiStepBuffer.initialize(multiStep);
+		}
+		syncWeights();
+	}
+public:
+	Action_t firstStep(const State_t& firstState) override
+	{
+		syncWeights();
+		m_state = firstState;
+		m_action = m_policy->takeAction(firstState);
+		m_multiStepBuffer.reset();
+		return m_action;
+	}
+	Action_t nextStep(float reward, const State_t& nextState) override
+	{
+		appendTransition(m_state, m_action, reward, nextState, false, false);
+		syncWeights();
+		m_state = nextState;
+		m_action = m_policy->takeAction(nextState);
+		return m_action;
+	}
+	void lastStep(float reward, const State_t& nextState, bool terminated) override
+	{
+		appendTransition(m_state, m_action, reward, nextState, true, terminated);
+	}
+	void flush()
+	{
+		if (m_transitionBatch.size() > 0)
+		{
+			if (*m_rateLimiter)
+			{
+				m_rateLimiter->awaitInsert(m_transitionBatch.size());
+			}
+			if (m_shardedBuffer)
+			{
+				m_shardedBuffer->append(m_shard, m_transitionBatch);
+			}
+			else
+			{
+				m_learner->appendTransitions(m_transitionBatch);
+			}
+			m_transitionBatch.clear();
+		}
+	}
+protected:
+	void syncWeights()
+	{
+		m_version = m_parameterStore->pull(m_valueNet->module(), m_version);
+	}
+	void appendTransition(const State_t& state, const Action_t& action, float reward, const State_t& nextState, bool lastStep, bool terminated)
+	{
+		if (m_multiStepBuffer)
+		{
+			m_multiStepBuffer.append(state, action, reward, m_discountRate);
+			if (lastStep || m_multiStepCompound)
+			{
+				uint32_t count = std::min(m_multiStepBuffer.stepCount(), m_multiStepBuffer.multiStep());
+				for (size_t i = 0; i < count; ++i)
+				{
+					auto sar = m_multiStepBuffer.get(m_multiStepBuffer.stepCount() - count + i);
+					m_transitionBatch.append(sar->state, sar->action, sar->accReward, nextState, terminated ? 0 : sar->accDiscountRate);
+				}
+			}
+			else if (m_multiStepBuffer.stepCount() >= m_multiStepBuffer.multiStep())
+			{
+				auto sar = m_multiStepBuffer.getHead();
+				m_transitionBatch.append(sar->state, sar->action, sar->accReward, nextState, sar->accDiscountRate);
+			}
+		}
+		else
+		{
+			m_transitionBatch.append(state, action, reward, nextState, terminated ? 0 : m_discountRate);
+		}
+		if (lastStep || m_transitionBatch.size() >= m_flushSize)
+		{
+			flush();
+		}
+	}
+protected:
+	Learner_t* m_learner;
+	ParameterStore* m_parameterStore;
+	RateLimiter* m_rateLimiter;
+	ShardedBuffer_t* m_shardedBuffer;
+	uint32_t m_shard;
+	ActionValueNetPtr m_valueNet;
+	EpsilonGreedyPtr m_policy;
+	float m_discountRate;
+	bool m_multiStepCompound;
+	uint32_t m_flushSize;
+	uint64_t m_version{};
+
+	State_t m_state;
+	Action_t m_action;
+	MultiStepBuffer<State_t, Action_t> m_multiStepBuffer;
+	TransitionBatch<State_t, Action_t> m_transitionBatch;
+};
+
+//Ape-X style training: every actor thread steps its own environment with its own epsilon,
+//a single learner thread samples the shared replay memory and periodically publishes its weights
+template<TargetEvaluationMethod t_evaluationMethod, typename ActionValueNet_t>
+class DeepQNetworkActorLearner : public paf::Introspectable
+{
+public:
+	static_assert(TargetEvaluationMethod::sarsa != t_evaluationMethod, "the actors run stale policies, only off-policy targets are supported");
+	typedef typename ActionValueNet_t::State_t State_t;
+	typedef typename ActionValueNet_t::Action_t Action_t;
+	typedef paf::SharedPtr<ActionValueNet_t> ActionValueNetPtr;
+	typedef std::shared_ptr<Optimizer> OptimizerPtr;
+	typedef DeepQNetwork<t_evaluationMethod, ActionValueNet_t> Learner_t;
+	typedef paf::SharedPtr<Learner_t> LearnerPtr;
+	typedef DeepQNetworkActor<ActionValueNet_t, Learner_t> Actor_t;
+	typedef Environment<State_t, Action_t> Environment_t;
+	typedef paf::SharedPtr<Environment_t> EnvironmentPtr;
+	typedef typename Learner_t::Options Options;
+	typedef paf::SharedPtr<DeepQNetworkActorLearner> DeepQNetworkActorLearnerPtr;
+	typedef typename Actor_t::ShardedBuffer_t ShardedBuffer_t;
+public:
+	//one environment per actor
+	DeepQNetworkActorLearner(ActionValueNetPtr valueNet, OptimizerPtr optimizer, const std::vector<EnvironmentPtr>& environments, const Options& options, const ActorLearnerOptions& actorLearnerOptions) :
+		m_environments(environments),
+		m_pinActors(actorLearnerOptions.pinActors()),
+		m_publishInterval(std::max(actorLearnerOptions.publishInterval(), 1u))
+	{
+		assert(environments.size() == actorLearnerOptions.numActors());
+		assert(ExperienceReplay::no_experience_replay != options.experienceReplay());
+		auto greedy = GreedyAction<State_t, Action_t>::Make(valueNet);
+		//with shards the learner never appends, its own replay memory is not allocated
+		Options learnerOptions(options);
+		learnerOptions.externalReplay(actorLearnerOptions.replayShards() > 0);
+		m_learner = LearnerPtr::Make(valueNet, optimizer, EpsilonGreedy<State_t, Action_t>::Make(greedy, actorLearnerOptions.actorEpsilon()), learnerOptions);
+		m_parameterStore.initialize(valueNet->module());
+		if (actorLearnerOptions.replayShards() > 0)
+		{
+			//the learner samples the shards in place of its own buffer
+			bool needPriority = ExperienceReplay::prioritized_experience_replay == options.experienceReplay();
+			uint32_t capacity = std::max(std::max(options.replayMemorySize(), options.warmUpSize()), actorLearnerOptions.replayShards());
+			m_shardedBuffer.initialize(actorLearnerOptions.replayShards(), capacity, false, needPriority, options.columnarReplay());
+			m_learner->remoteReplay(&m_shardedBuffer);
+		}
+		if (actorLearnerOptions.samplesPerInsert() > 0)
+		{
+			//an error below one flush plus one batch could block the actors and the learner at the same time
+			float samplesPerInsert = actorLearnerOptions.samplesPerInsert();
+			float minError = samplesPerInsert * std::max(actorLearnerOptions.actorFlushSize(), 1u) + options.batchSize();
+			m_rateLimiter.initialize(samplesPerInsert, std::max(options.warmUpSize(), options.batchSize()), std::max(actorLearnerOptions.rateLimitError(), minError));
+		}
+
+		size_t numActors = environments.size();
+		m_actors.reserve(numActors);
+		for (size_t i = 0; i < numActors; ++i)
+		{
+			float exponent = numActors > 1 ? 1.0f + actorLearnerOptions.actorEpsilonAlpha() * float(i) / float(numActors - 1) : 1.0f;
+			float epsilon = std::pow(actorLearnerOptions.actorEpsilon(), exponent);
+			ShardedBuffer_t* shardedBuffer = m_shardedBuffer.numShards() > 0 ? &m_shardedBuffer : nullptr;
+			uint32_t shard = shardedBuffer ? m_shardedBuffer.shardOf(i) : 0;
+			m_actors.push_back(std::make_unique<Actor_t>(m_learner.get(), &m_parameterStore, &m_rateLimiter, shardedBuffer, shard, valueNet, epsilon,
+				options.discountRate(), options.multiStep(), options.multiStepCompound(), actorLearnerOptions.actorFlushSize()));
+		}
+	}
+	~DeepQNetworkActorLearner()
+	{
+		//the learner may outlive this object, it must not sample the shards afterwards
+		if (m_shardedBuffer.numShards() > 0)
+		{
+			m_learner->remoteReplay(nullptr);
+		}
+	}
+public:
+	//runs the actors and the learner until the learner has made numUpdates gradient steps
+	void train(uint64_t numUpdates)
+	{
+		m_stop = false;
+		//the limiter was stopped at the end of the previous call
+		m_rateLimiter.restart();
+		std::vector<std::thread> actorThreads;
+		actorThreads.reserve(m_actors.size());
+		for (size_t i = 0; i < m_actors.size(); ++i)
+		{
+			actorThreads.emplace_back(&DeepQNetworkActorLearner::runActor, this, i);
+		}
+		std::thread learnerThread(&DeepQNetworkActorLearner::runLearner, this, numUpdates);
+		learnerThread.join();
+		m_stop = true;
+		m_rateLimiter.stop();
+		for (auto& actorThread : actorThreads)
+		{
+			actorThread.join();
+		}
+	}
+	uint64_t numSteps() const
+	{
+		return m_numSteps.load(std::memory_order_relaxed);
+	}
+	uint64_t numEpisodes() const
+	{
+		return m_numEpisodes.load(std::memory_order_relaxed);
+	}
+	uint64_t numUpdates() const
+	{
+		return m_numUpdates.load(std::memory_order_relaxed);
+	}
+	LearnerPtr learner() const
+	{
+		return m_learner;
+	}
+	//actual ratio and wait counters, only counts when samplesPerInsert was set
+	const RateLimiter& rateLimiter() const
+	{
+		return m_rateLimiter;
+	}
+	//empty unless replayShards was set
+	ShardedBuffer_t& shardedBuffer()
+	{
+		return m_shardedBuffer;
+	}
+protected:
+	void runActor(size_t index)
+	{
+		Random::seedThread(RandomStream::actor, uint32_t(index));
+		Actor_t* actor = m_actors[index].get();
+		Environment_t* environment = m_environments[index].get();
+		if (m_pinActors && m_shardedBuffer.numShards() > 0)
+		{
+			m_shardedBuffer.pinToShard(m_shardedBuffer.shardOf(index));
+		}
+		while (!m_stop)
+		{
+			State_t state = environment->reset();
+			Action_t action = actor->firstStep(state);
+			while (!m_stop)
+			{
+				float reward;
+				State_t nextState;
+				EnvironmentStatus status = environment->step(reward, nextState, action);
+				m_numSteps.fetch_add(1, std::memory_order_relaxed);
+				if (EnvironmentStatus::es_normal == status)
+				{
+					action = actor->nextStep(reward, nextState);
+				}
+				else
+				{
+					actor->lastStep(reward, nextState, EnvironmentStatus::es_terminated == status);
+					m_numEpisodes.fetch_add(1, std::memory_order_relaxed);
+					break;
+				}
+			}
+		}
+		actor->flush();
+	}
+	void runLearner(uint64_t numUpdates)
+	{
+		Random::seedThread(RandomStream::learner, 0);
+		uint64_t count = 0;
+		bool admitted = false;
+		bool publishPending = false;
+		while (count < numUpdates)
+		{
+			//the limiter counts inserts before the actors append them, so a step it admits
+			//may still find the buffer short and is retried without asking again
+			if (m_rateLimiter && !admitted)
+			{
+				m_rateLimiter.awaitSample(m_learner->batchSize());
+				admitted = true;
+			}
+			if (!m_learner->learnerStep())
+			{
+				if (!m_learner->replayConnected())
+				{
+					break;
+				}
+				std::this_thread::yield();
+				continue;
+			}
+			++count;
+			admitted = false;
+			m_numUpdates.fetch_add(1, std::memory_order_relaxed);
+			//a publication skipped because an actor still copies from the spare slab is retried after the next step
+			if (publishPending || count % m_publishInterval == 0)
+			{
+				publishPending = !m_parameterStore.publish(m_learner->valueNet()->module());
+			}
+		}
+		while (!m_parameterStore.publish(m_learner->valueNet()->module()))
+		{
+			std::this_thread::yield();
+		}
+	}
+protected:
+	LearnerPtr m_learner;
+	std::vector<EnvironmentPtr> m_environments;
+	std::vector<std::unique_ptr<Actor_t>> m_actors;
+	ParameterStore m_parameterStore;
+	RateLimiter m_rateLimiter;
+	ShardedBuffer_t m_shardedBuffer;
+	bool m_pinActors;
+	uint32_t m_publishInterval;
+	std::atomic<bool> m_stop{};
+	std::atomic<uint64_t> m_numSteps{};
+	std::atomic<uint64_t> m_numEpisodes{};
+	std::atomic<uint64_t> m_numUpdates{};
+public:
+	static DeepQNetworkActorLearnerPtr Make(ActionValueNetPtr valueNet, OptimizerPtr optimizer, const std::vector<EnvironmentPtr>& environments, const Options& options, const ActorLearnerOptions& actorLearnerOptions)
+	{
+		return DeepQNetworkActorLearnerPtr::Make(valueNet, optimizer, environments, options, actorLearnerOptions);
+	}
+};
+
+END_RLTL_IMPL
@@ -2,6 +2,7 @@
 #include "utility.h"
 #include "../arg.h"
 #include "neural_network.h"
+#include "agent.h"
 #include <vector>
 
 BEGIN_RLTL_IMPL
@@ -15,7 +16,7 @@ struct ReinforceOptions
 };
 
 template<typename State_t, typename Action_t>
-class DeepReinforce
+class DeepReinforce : public Agent<State_t, Action_t>
 {
 public:
 	typedef State_t State_t;
@@ -56,24 +57,115 @@ public:
 		m_states.emplace_back(m_state);
 		m_actions.emplace_back(m_action);
 		m_rewards.emplace_back(reward);
-		
-		
-		uint32_t batchSize = m_states.size();
+		learnEpisode(m_states, m_actions, m_rewards);
+		m_states.clear();
+		m_actions.clear();
+		m_rewards.clear();
+	}
+
+public:
+	void firstSteps(std::vector<Action_t>& actions, const std::vector<State_t>& firstStates) override
+	{
+		size_t count = firstStates.size();
+		m_slots.initialize(count);
+		m_slotEpisodes.resize(count);
+		for (auto& episode : m_slotEpisodes)
+		{
+			episode.clear();
+		}
+		m_slots.m_states = firstStates;
+		m_policy->takeActions(m_slots.m_actions, m_slots.m_states);
+		actions = m_slots.m_actions;
+	}
+
+	void nextSteps(
+		std::vector<Action_t>& actions,
+		const std::vector<float>& rewards,
+		const std::vector<State_t>& nextStates,
+		const std::vector<EnvironmentStatus>& statuses,
+		const std::vector<State_t>& resetStates) override
+	{
+		size_t count = m_slots.size();
+		assert(rewards.size() == count && nextStates.size() == count && statuses.size() == count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			Episode& episode = m_slotEpisodes[i];
+			episode.m_states.emplace_back(m_slots.m_states[i]);
+			episode.m_actions.emplace_back(m_slots.m_actions[i]);
+			episode.m_rewards.emplace_back(rewards[i]);
+			if (EnvironmentStatus::es_normal == statuses[i])
+			{
+				++m_slots.m_stepCounts[i];
+				m_slots.m_states[i] = nextStates[i];
+			}
+			else
+			{
+				learnEpisode(episode.m_states, episode.m_actions, episode.m_rewards);
+				episode.clear();
+				m_slots.beginEpisode(i);
+				m_slots.m_states[i] = resetStates[i];
+			}
+		}
+		m_policy->takeActions(m_slots.m_actions, m_slots.m_states);
+		actions = m_slots.m_actions;
+	}
+	void beginSlotSteps(size_t count) override
+	{
+		m_slots.initialize(count);
+		m_slotEpisodes.resize(count);
+		for (auto& episode : m_slotEpisodes)
+		{
+			episode.clear();
+		}
+	}
+	Action_t firstSlotStep(size_t slot, const State_t& firstState) override
+	{
+		m_slots.beginEpisode(slot);
+		m_slotEpisodes[slot].clear();
+		m_slots.m_states[slot] = firstState;
+		m_slots.m_actions[slot] = m_policy->takeAction(firstState);
+		return m_slots.m_actions[slot];
+	}
+	Action_t nextSlotStep(size_t slot, float reward, const State_t& nextState, EnvironmentStatus status, const State_t& resetState) override
+	{
+		Episode& episode = m_slotEpisodes[slot];
+		episode.m_states.emplace_back(m_slots.m_states[slot]);
+		episode.m_actions.emplace_back(m_slots.m_actions[slot]);
+		episode.m_rewards.emplace_back(reward);
+		if (EnvironmentStatus::es_normal != status)
+		{
+			learnEpisode(episode.m_states, episode.m_actions, episode.m_rewards);
+			return firstSlotStep(slot, resetState);
+		}
+		++m_slots.m_stepCounts[slot];
+		m_slots.m_states[slot] = nextState;
+		m_slots.m_actions[slot] = m_policy->takeAction(nextState);
+		return m_slots.m_actions[slot];
+	}
+	uint64_t learnCount() const override
+	{
+		return m_learnCount;
+	}
+protected:
+	void learnEpisode(const std::vector<State_t>& states, const std::vector<Action_t>& actions, const std::vector<float>& rewards)
+	{
+		++m_learnCount;
+		uint32_t batchSize = states.size();
 		Tensor stateTensor = MakeTensor<State_t>(torch::kFloat32, batchSize);
 		Tensor actionTensor = MakeTensor<Action_t>(torch::kInt64, batchSize);
 		Tensor returnTensor = MakeTensor<float>(torch::kFloat32, batchSize);
-		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
-		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
+		auto stateAccessor = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto actionAccessor = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
 		auto returns = returnTensor.accessor<float, 2>();
 
 		float g = 0;
 		for (size_t i = 0; i < batchSize; ++i)
 		{
 			size_t index = batchSize - 1 - i;
-			g = g * m_discountRate + m_rewards[index];
+			g = g * m_discountRate + rewards[index];
 			returns[index][0] = -g;
-			Tensor_Assign(states[index], m_states[index]);
-			Tensor_Assign(actions[index], m_actions[index]);
+			Tensor_Assign(stateAccessor[index], states[index]);
+			Tensor_Assign(actionAccessor[index], actions[index]);
 		}
 
 		Tensor logProbTensor = torch::nn::functional::log_softmax(m_policyNet->forward(stateTensor), 1);
@@ -107,11 +199,6 @@ public:
 		//	lossTensor.backward();
 		//}
 		//m_optimizer.step();
-
-
-		m_states.clear();
-		m_actions.clear();
-		m_rewards.clear();
 	}
 protected:
 	template<typename Element_t, typename TensorScalar_t>
@@ -132,12 +219,28 @@ protected:
 	OptimizerPtr m_optimizer;
 	PolicyFunctionPtr m_policy;
 	float m_discountRate;
+	uint64_t m_learnCount{};
 	std::vector<State_t> m_states;
 	std::vector<Action_t> m_actions;
 	std::vector<float> m_rewards;
 protected:
 	State_t m_state;
 	Action_t m_action;
+protected:
+	struct Episode
+	{
+		void clear()
+		{
+			m_states.clear();
+			m_actions.clear();
+			m_rewards.clear();
+		}
+		std::vector<State_t> m_states;
+		std::vector<Action_t> m_actions;
+		std::vector<float> m_rewards;
+	};
+	AgentSlots<State_t, Action_t> m_slots;
+	std::vector<Episode> m_slotEpisodes;
 public:
 	static DeepReinforcePtr Make(PolicyNetPtr policyNet, OptimizerPtr optimizer, PolicyFunctionPtr policy, const ReinforceOptions& options)
 	{
@@ -1,6 +1,6 @@
 #pragma once
 #include "utility.h"
-#include "../math/random.h"
+#include "random.h"
 #include "callback.h"
 
 BEGIN_RLTL_IMPL
@@ -24,6 +24,10 @@ public:
 	{
 		return m_actionValueFunction->maxAction(state, m_firstMax);
 	}
+	void takeActions(std::vector<Action_t>& actions, const std::vector<State_t>& states) override
+	{
+		m_actionValueFunction->maxActions(actions, states, m_firstMax);
+	}
 	uint32_t actionCount() const override
 	{
 		return m_actionValueFunction->actionCount();
@@ -64,15 +68,28 @@ public:
 	}
 	Action_t takeAction(const State_t& state)
 	{
-		if (rltl::math::Random::rand() < m_epsilon)
+		//the thread local generator, each actor thread explores with its own seeded sequence
+		if (Random::rand() < m_epsilon)
 		{
-			return rltl::math::Random::randint(m_actionCount) % m_actionCount;
+			return Random::randuint(m_actionCount);
 		}
 		else
 		{
 			return m_policy->takeAction(state);
 		}
 	}
+	void takeActions(std::vector<Action_t>& actions, const std::vector<State_t>& states) override
+	{
+		m_policy->takeActions(actions, states);
+		size_t count = states.size();
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (Random::rand() < m_epsilon)
+			{
+				actions[i] = Random::randuint(m_actionCount);
+			}
+		}
+	}
 	uint32_t actionCount() const override
 	{
 		return m_actionCount;
@@ -0,0 +1,212 @@
+#pragma once
+#include "utility.h"
+#include <string>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+BEGIN_RLTL_IMPL
+
+enum class MappedAccess
+{
+	normal,
+	sequential,
+	random,
+	will_need,
+	dont_need,
+};
+
+//read-write mapping of a whole file, the file is created or grown to the requested size
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile()
+	{
+		close();
+	}
+public:
+	//returns false if the file can not be opened or mapped,
+	//existed() tells whether the file was already there with at least size bytes
+	bool open(const std::string& filename, size_t size)
+	{
+		close();
+#ifdef _WIN32
+		m_file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (INVALID_HANDLE_VALUE == m_file)
+		{
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(m_file, &fileSize);
+		m_existed = size_t(fileSize.QuadPart) >= size;
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, DWORD(uint64_t(size) >> 32), DWORD(size & 0xffffffff), nullptr);
+		if (nullptr == m_mapping)
+		{
+			close();
+			return false;
+		}
+		m_data = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		if (nullptr == m_data)
+		{
+			close();
+			return false;
+		}
+#else
+		m_file = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+		if (m_file < 0)
+		{
+			return false;
+		}
+		struct stat fileStat;
+		if (0 != fstat(m_file, &fileStat))
+		{
+			close();
+			return false;
+		}
+		m_existed = size_t(fileStat.st_size) >= size;
+		if (size_t(fileStat.st_size) < size && 0 != ftruncate(m_file, off_t(size)))
+		{
+			close();
+			return false;
+		}
+		void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+		if (MAP_FAILED == data)
+		{
+			close();
+			return false;
+		}
+		m_data = data;
+#endif
+		m_size = size;
+		return true;
+	}
+	void close()
+	{
+#ifdef _WIN32
+		if (m_data)
+		{
+			UnmapViewOfFile(m_data);
+		}
+		if (m_mapping)
+		{
+			CloseHandle(m_mapping);
+		}
+		if (INVALID_HANDLE_VALUE != m_file)
+		{
+			CloseHandle(m_file);
+		}
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data)
+		{
+			munmap(m_data, m_size);
+		}
+		if (m_file >= 0)
+		{
+			::close(m_file);
+		}
+		m_file = -1;
+#endif
+		m_data = nullptr;
+		m_size = 0;
+		m_existed = false;
+	}
+	//flushes dirty pages of the range to the file, blocking
+	void flush(size_t offset = 0, size_t length = 0)
+	{
+		assert(m_data);
+		char* begin = alignDown(offset);
+		size_t end = 0 == length ? m_size : offset + length;
+#ifdef _WIN32
+		FlushViewOfFile(begin, static_cast<char*>(m_data) + end - begin);
+		FlushFileBuffers(m_file);
+#else
+		msync(begin, static_cast<char*>(m_data) + end - begin, MS_SYNC);
+#endif
+	}
+	//access pattern hint for the range, ignored where the platform has no equivalent
+	void advise(MappedAccess access, size_t offset = 0, size_t length = 0)
+	{
+		assert(m_data);
+#ifndef _WIN32
+		char* begin = alignDown(offset);
+		size_t end = 0 == length ? m_size : offset + length;
+		int advice = MADV_NORMAL;
+		switch (access)
+		{
+		case MappedAccess::sequential:
+			advice = MADV_SEQUENTIAL;
+			break;
+		case MappedAccess::random:
+			advice = MADV_RANDOM;
+			break;
+		case MappedAccess::will_need:
+			advice = MADV_WILLNEED;
+			break;
+		case MappedAccess::dont_need:
+			advice = MADV_DONTNEED;
+			break;
+		default:
+			break;
+		}
+		madvise(begin, static_cast<char*>(m_data) + end - begin, advice);
+#endif
+	}
+public:
+	void* data() const
+	{
+		return m_data;
+	}
+	size_t size() const
+	{
+		return m_size;
+	}
+	bool existed() const
+	{
+		return m_existed;
+	}
+	explicit operator bool() const
+	{
+		return nullptr != m_data;
+	}
+	static size_t PageSize()
+	{
+#ifdef _WIN32
+		SYSTEM_INFO systemInfo;
+		GetSystemInfo(&systemInfo);
+		return systemInfo.dwAllocationGranularity;
+#else
+		return size_t(sysconf(_SC_PAGESIZE));
+#endif
+	}
+protected:
+	char* alignDown(size_t offset) const
+	{
+		size_t pageSize = PageSize();
+		return static_cast<char*>(m_data) + offset / pageSize * pageSize;
+	}
+protected:
+#ifdef _WIN32
+	HANDLE m_file{ INVALID_HANDLE_VALUE };
+	HANDLE m_mapping{ nullptr };
+#else
+	int m_file{ -1 };
+#endif
+	void* m_data{ nullptr };
+	size_t m_size{ 0 };
+	bool m_existed{ false };
+};
+
+END_RLTL_IMPL
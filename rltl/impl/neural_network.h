@@ -4,6 +4,8 @@
 #include "random.h"
 #include <string>
 #include <type_traits>
+#include <cmath>
+#include <algorithm>
 
 BEGIN_RLTL_IMPL
 
@@ -241,21 +243,24 @@ Tensor NN_makeTensor(TensorScalar_t dtype, uint32_t batchSize)
 // 	return value;
 // }
 
-template<typename Network_t, typename State_t>
-inline void NN_getStateValues(std::vector<float>& values, Network_t& network, const State_t& state)
+//input tensor of batch size 1 reused by every single state forward pass on this thread,
+//so choosing an action does not allocate the input again
+template<typename State_t>
+inline Tensor& NN_stateInputTensor(const State_t& state)
 {
-	auto shape = Array_Shape<State_t>::shape();
-	std::array<int64_t, Array_Dimension<State_t>::dim() + 1> tensorShape;
-	tensorShape[0] = 1;
-	for (size_t i = 0; i < State_t::t_dim; ++i)
-	{
-		tensorShape[i + 1] = shape[i];
-	}
-	torch::Tensor stateTensor = torch::empty(tensorShape, torch::TensorOptions().dtype(torch::kFloat32));
+	thread_local Tensor stateTensor = NN_makeTensor<State_t>(torch::kFloat32, 1);
 	auto stateAccessor = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
 	Tensor_Assign(stateAccessor[0], state);
-	torch::Tensor valueTensor = network->forward(stateTensor);
-	auto valueAccessor = valueTensor.accessor<int64_t, 2>();	
+	return stateTensor;
+}
+
+template<typename Network_t, typename State_t>
+inline void NN_getStateValues(std::vector<float>& values, Network_t& network, const State_t& state)
+{
+	Tensor& stateTensor = NN_stateInputTensor(state);
+	torch::InferenceMode guard;
+	torch::Tensor valueTensor = network->actionValue(stateTensor);
+	auto valueAccessor = valueTensor.accessor<float, 2>();
 	size_t count = valueTensor.size(1);
 	values.resize(count);
 	for (uint32_t i = 0; i < count; ++i)
@@ -268,20 +273,22 @@ template<typename Network_t, typename State_t, typename Action_t>
 inline Action_t NN_actionByArgmax(Network_t& network, const State_t& state)
 {
 	assert(Array_Dimension<Action_t>::dim() == 1);
-	auto shape = Array_Shape<State_t>::shape();
-	std::array<int64_t, Array_Dimension<State_t>::dim() + 1> tensorShape;
-	tensorShape[0] = 1;
-	for (size_t i = 0; i < State_t::t_dim; ++i)
+	Tensor& stateTensor = NN_stateInputTensor(state);
+	torch::InferenceMode guard;
+	torch::Tensor valueTensor = network->actionValue(stateTensor);
+	auto valueAccessor = valueTensor.accessor<float, 2>();
+	size_t count = valueTensor.size(1);
+	//first max like argmax, without allocating its result tensor
+	Action_t action = 0;
+	float maxValue = valueAccessor[0][0];
+	for (size_t i = 1; i < count; ++i)
 	{
-		tensorShape[i + 1] = shape[i];
+		if (valueAccessor[0][i] > maxValue)
+		{
+			maxValue = valueAccessor[0][i];
+			action = i;
+		}
 	}
-	torch::Tensor stateTensor = torch::empty(tensorShape, torch::TensorOptions().dtype(torch::kFloat32));
-	auto stateAccessor = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
-	Tensor_Assign(stateAccessor[0], state);
-	torch::Tensor actionTensor = network->actionValue(stateTensor).argmax(1);
-	auto actionAccessor = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim()>();
-	Action_t action;
-	Tensor_Assign(action, actionAccessor);
 	return action;
 }
 
@@ -289,46 +296,148 @@ template<typename Network_t, typename State_t, typename Action_t>
 inline Action_t NN_actionBySoftmax(Network_t& network, const State_t& state)
 {
 	assert(Array_Dimension<Action_t>::dim() == 1);
-	auto shape = Array_Shape<State_t>::shape();
-	std::array<int64_t, Array_Dimension<State_t>::dim() + 1> tensorShape;
-	tensorShape[0] = 1;
-	for (size_t i = 0; i < State_t::t_dim; ++i)
+	Tensor& stateTensor = NN_stateInputTensor(state);
+	torch::InferenceMode guard;
+	torch::Tensor logitTensor = network->logitAction(stateTensor);
+	size_t logitSize = logitTensor.size(1);
+	auto logitAccessor = logitTensor.accessor<float, 2>();
+
+	//softmax in place of a probability tensor, rnd is scaled by the sum instead of normalizing
+	float maxLogit = logitAccessor[0][0];
+	for (size_t i = 1; i < logitSize; ++i)
 	{
-		tensorShape[i + 1] = shape[i];
+		maxLogit = std::max(maxLogit, logitAccessor[0][i]);
 	}
-	torch::Tensor stateTensor = torch::empty(tensorShape, torch::TensorOptions().dtype(torch::kFloat32));
+	float sum = 0;
+	for (size_t i = 0; i < logitSize; ++i)
+	{
+		sum += std::exp(logitAccessor[0][i] - maxLogit);
+	}
+	Action_t action = logitSize - 1;
+	float rnd = Random::rand() * sum;
+	for (size_t i = 0; i < logitSize; ++i)
+	{
+		float weight = std::exp(logitAccessor[0][i] - maxLogit);
+		if (rnd <= weight)
+		{
+			action = i;
+			break;
+		}
+		rnd -= weight;
+	}
+	return action;
+}
+
+template<typename State_t>
+inline Tensor NN_makeStateTensor(const std::vector<State_t>& states)
+{
+	uint32_t count = states.size();
+	Tensor stateTensor = NN_makeTensor<State_t>(torch::kFloat32, count);
 	auto stateAccessor = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
-	Tensor_Assign(stateAccessor[0], state);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		Tensor_Assign(stateAccessor[i], states[i]);
+	}
+	return stateTensor;
+}
+
+//one forward pass for a batch of states
+template<typename Network_t, typename State_t, typename Action_t>
+inline void NN_actionsByArgmax(std::vector<Action_t>& actions, Network_t& network, const std::vector<State_t>& states)
+{
+	assert(Array_Dimension<Action_t>::dim() == 1);
+	size_t count = states.size();
+	torch::Tensor stateTensor = NN_makeStateTensor(states);
+	torch::InferenceMode guard;
+	torch::Tensor actionTensor = network->actionValue(stateTensor).argmax(1);
+	auto actionAccessor = actionTensor.accessor<int64_t, 1>();
+	actions.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		actions[i] = actionAccessor[i];
+	}
+}
+
+template<typename Network_t, typename State_t, typename Action_t>
+inline void NN_actionsBySoftmax(std::vector<Action_t>& actions, Network_t& network, const std::vector<State_t>& states)
+{
+	assert(Array_Dimension<Action_t>::dim() == 1);
+	size_t count = states.size();
+	torch::Tensor stateTensor = NN_makeStateTensor(states);
+	torch::InferenceMode guard;
 	torch::Tensor probTensor = torch::nn::functional::softmax(network->logitAction(stateTensor), 1);
 	size_t probSize = probTensor.size(1);
-
-	Action_t action = probSize - 1;
 	auto probAccessor = probTensor.accessor<float, 2>();
-	float rnd = Random::rand();
-	for (size_t i = 0; i < probSize; ++i)
+	actions.resize(count);
+	for (size_t i = 0; i < count; ++i)
 	{
-		float prob = probAccessor[0][i];
-		if (rnd <= prob)
+		Action_t action = probSize - 1;
+		float rnd = Random::rand();
+		for (size_t j = 0; j < probSize; ++j)
 		{
-			action = i;
-			break;
+			float prob = probAccessor[i][j];
+			if (rnd <= prob)
+			{
+				action = j;
+				break;
+			}
+			rnd -= prob;
 		}
-		rnd -= prob;
+		actions[i] = action;
 	}
-	return action;
 }
 
 
-//template<typename Net_t>
+//dst must have the same architecture as src, parameters and buffers are copied in place in registration order
 inline void NN_copyParameters(torch::nn::Module* dst, const torch::nn::Module* src)
 {
-	std::stringstream stream;
-	torch::serialize::OutputArchive outputArchive(std::make_shared<torch::jit::CompilationUnit>());
-	torch::serialize::InputArchive inputArchive;
-	src->save(outputArchive);
-	outputArchive.save_to(stream);
-	inputArchive.load_from(stream);
-	dst->load(inputArchive);
+	torch::NoGradGuard nograd;
+	std::vector<torch::Tensor> dstParameters = dst->parameters();
+	std::vector<torch::Tensor> srcParameters = src->parameters();
+	assert(dstParameters.size() == srcParameters.size());
+	for (size_t i = 0; i < dstParameters.size(); ++i)
+	{
+		dstParameters[i].copy_(srcParameters[i]);
+	}
+	std::vector<torch::Tensor> dstBuffers = dst->buffers();
+	std::vector<torch::Tensor> srcBuffers = src->buffers();
+	assert(dstBuffers.size() == srcBuffers.size());
+	for (size_t i = 0; i < dstBuffers.size(); ++i)
+	{
+		dstBuffers[i].copy_(srcBuffers[i]);
+	}
+}
+
+//Polyak averaging dst = tau * src + (1 - tau) * dst, with one multi-tensor kernel per step instead of one per parameter
+//buffers such as running statistics are copied, not averaged
+inline void NN_softUpdateParameters(torch::nn::Module* dst, const torch::nn::Module* src, float tau)
+{
+	assert(0 < tau && tau <= 1);
+	torch::NoGradGuard nograd;
+	std::vector<torch::Tensor> dstParameters = dst->parameters();
+	std::vector<torch::Tensor> srcParameters = src->parameters();
+	assert(dstParameters.size() == srcParameters.size());
+	torch::_foreach_mul_(dstParameters, 1.0f - tau);
+	torch::_foreach_add_(dstParameters, srcParameters, tau);
+	std::vector<torch::Tensor> dstBuffers = dst->buffers();
+	std::vector<torch::Tensor> srcBuffers = src->buffers();
+	assert(dstBuffers.size() == srcBuffers.size());
+	for (size_t i = 0; i < dstBuffers.size(); ++i)
+	{
+		dstBuffers[i].copy_(srcBuffers[i]);
+	}
+}
+
+//prioritized replay priorities (|delta| + epsilon)^alpha for a batch of td errors, as whole-tensor ops into
+//priorityTensor, which is only reallocated when the batch shape changes
+inline void NN_prioritiesFromDeltas(Tensor& priorityTensor, const Tensor& deltaTensor, float prioritizedAlpha, float prioritizedEpsilon)
+{
+	torch::NoGradGuard nograd;
+	if (!priorityTensor.defined() || priorityTensor.sizes() != deltaTensor.sizes())
+	{
+		priorityTensor = torch::empty(deltaTensor.sizes(), torch::TensorOptions().dtype(torch::kFloat32));
+	}
+	priorityTensor.copy_(deltaTensor).abs_().add_(prioritizedEpsilon).pow_(prioritizedAlpha);
 }
 
 inline void NN_saveModule(torch::nn::Module* module, const std::string& filename)
@@ -0,0 +1,144 @@
+#pragma once
+#include "utility.h"
+#include "neural_network.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+
+BEGIN_RLTL_IMPL
+
+//versioned snapshots of the parameters and buffers of a module for actor threads in the same process.
+//the learner copies every tensor byte-wise into the spare of two slabs and swaps the current slab pointer,
+//actors compare the version and only copy the current slab into their own net when it changed.
+//an actor marks the slab it copies from with a reader count and never waits, the learner never waits either:
+//publish() returns false while an actor is still copying from the spare slab and is simply tried again later
+class ParameterStore
+{
+protected:
+	struct Slab
+	{
+		std::unique_ptr<char[]> m_data;
+		std::atomic<uint32_t> m_readers{ 0 };
+		std::atomic<uint64_t> m_version{ 0 };
+	};
+	struct Entry
+	{
+		uint64_t m_offset;
+		std::vector<int64_t> m_shape;
+		torch::Dtype m_dtype;
+	};
+public:
+	ParameterStore() = default;
+	ParameterStore(const ParameterStore&) = delete;
+	ParameterStore& operator=(const ParameterStore&) = delete;
+public:
+	//lays out the slabs for the tensors of module and publishes it as version 1,
+	//not thread safe, call before any actor pulls
+	void initialize(const torch::nn::Module* module)
+	{
+		m_entries.clear();
+		uint64_t offset = 0;
+		forEachTensor(module, [&](const Tensor& tensor)
+			{
+				m_entries.push_back(Entry{ offset, tensor.sizes().vec(), tensor.scalar_type() });
+				offset = align(offset + tensor.numel() * tensor.element_size());
+			});
+		m_bytes = offset;
+		for (Slab& slab : m_slabs)
+		{
+			slab.m_data.reset(new char[std::max<uint64_t>(m_bytes, 1)]);
+			slab.m_readers.store(0);
+			slab.m_version.store(0);
+		}
+		m_current.store(&m_slabs[0]);
+		m_version.store(0);
+		//no actor can hold a slab yet, so this publish always succeeds
+		publish(module);
+	}
+	//learner thread only, O(parameter bytes)
+	bool publish(const torch::nn::Module* module)
+	{
+		Slab* spare = m_current.load() == &m_slabs[0] ? &m_slabs[1] : &m_slabs[0];
+		if (0 != spare->m_readers.load())
+		{
+			return false;
+		}
+		torch::NoGradGuard nograd;
+		size_t index = 0;
+		forEachTensor(module, [&](const Tensor& tensor)
+			{
+				const Entry& entry = m_entries[index++];
+				assert(entry.m_dtype == tensor.scalar_type());
+				view(spare, entry).copy_(tensor);
+			});
+		uint64_t version = m_version.load(std::memory_order_relaxed) + 1;
+		spare->m_version.store(version);
+		m_current.store(spare);
+		m_version.store(version, std::memory_order_release);
+		return true;
+	}
+	//any thread, returns the version held by dst afterwards, only copies when it differs from version
+	uint64_t pull(torch::nn::Module* dst, uint64_t version)
+	{
+		if (m_version.load(std::memory_order_acquire) == version)
+		{
+			return version;
+		}
+		Slab* slab = m_current.load();
+		slab->m_readers.fetch_add(1);
+		//the learner may have started rewriting the slab between the two loads, then this pull is skipped
+		if (slab != m_current.load())
+		{
+			slab->m_readers.fetch_sub(1);
+			return version;
+		}
+		torch::NoGradGuard nograd;
+		size_t index = 0;
+		forEachTensor(dst, [&](Tensor& tensor)
+			{
+				tensor.copy_(view(slab, m_entries[index++]));
+			});
+		uint64_t pulled = slab->m_version.load();
+		slab->m_readers.fetch_sub(1);
+		return pulled;
+	}
+	uint64_t version() const
+	{
+		return m_version.load(std::memory_order_acquire);
+	}
+	uint64_t bytes() const
+	{
+		return m_bytes;
+	}
+protected:
+	template<typename Module_t, typename Func_t>
+	static void forEachTensor(Module_t* module, Func_t func)
+	{
+		for (Tensor tensor : module->parameters())
+		{
+			func(tensor);
+		}
+		for (Tensor tensor : module->buffers())
+		{
+			func(tensor);
+		}
+	}
+	static Tensor view(Slab* slab, const Entry& entry)
+	{
+		return torch::from_blob(slab->m_data.get() + entry.m_offset, entry.m_shape, torch::TensorOptions().dtype(entry.m_dtype));
+	}
+	static uint64_t align(uint64_t offset)
+	{
+		return (offset + 63) / 64 * 64;
+	}
+protected:
+	//seq_cst on the pointer and the reader counts: a pull which registered after publish() checked
+	//the spare slab sees the swapped pointer and backs off
+	Slab m_slabs[2];
+	std::atomic<Slab*> m_current{ nullptr };
+	std::atomic<uint64_t> m_version{ 0 };
+	std::vector<Entry> m_entries;
+	uint64_t m_bytes{ 0 };
+};
+
+END_RLTL_IMPL
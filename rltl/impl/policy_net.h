@@ -107,7 +107,12 @@ public:
 	{
 		return NN_actionBySoftmax<decltype(*this), State_t, Action_t>(*this, state);
 	}
-	
+
+	void takeActions(std::vector<Action_t>& actions, const std::vector<State_t>& states) override
+	{
+		NN_actionsBySoftmax<decltype(*this), State_t, Action_t>(actions, *this, states);
+	}
+
 	uint32_t actionCount() const override
 	{
 		return impl_->actionDim();
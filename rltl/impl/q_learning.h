@@ -1,15 +1,17 @@
 #pragma once
 #include "utility.h"
+#include "agent.h"
+#include "action_value_table.h"
 
 BEGIN_RLTL_IMPL
 
 template<typename State_t, typename Action_t>
-class QLearning
+class QLearning : public Agent<State_t, Action_t>
 {
 public:
 	typedef State_t State_t;
 	typedef Action_t Action_t;
-	typedef ActionValueFunction<State_t, Action_t> ActionValueFunction_t;
+	typedef ActionValueTable<State_t, Action_t> ActionValueFunction_t;
 	typedef PolicyFunction<State_t, Action_t> PolicyFunction_t;
 	typedef paf::SharedPtr<ActionValueFunction_t> ActionValueFunctionPtr;
 	typedef paf::SharedPtr<PolicyFunction_t> PolicyFunctionPtr;
@@ -25,29 +27,88 @@ public:
 	Action_t firstStep(const State_t& firstState)
 	{
 		m_state = firstState;
-		m_action = m_policy.takeAction(firstState);
+		m_action = m_policy->takeAction(firstState);
 		return m_action;
 	}
 	Action_t nextStep(float reward, const State_t& nextState)
 	{
-		float value = m_actionValueFunction.getValue(m_state, m_action);
-		float target = reward + m_actionValueFunction.getMaxValue(nextState) * m_discountRate;
-		float newValue = value + (target - value) * m_learningRate;
-		m_actionValueFunction.setValue(m_state, m_action, newValue);
+		update(m_state, m_action, reward, nextState, false);
 		m_state = nextState;
-		m_action = m_policy.takeAction(nextState);
+		m_action = m_policy->takeAction(nextState);
 		return m_action;
 	}
 	void lastStep(float reward, const State_t& nextState, bool terminated)
 	{
-		float value = m_actionValueFunction.getValue(m_state, m_action);
+		update(m_state, m_action, reward, nextState, terminated);
+	}
+public:
+	void firstSteps(std::vector<Action_t>& actions, const std::vector<State_t>& firstStates) override
+	{
+		m_slots.initialize(firstStates.size());
+		m_slots.m_states = firstStates;
+		m_policy->takeActions(m_slots.m_actions, m_slots.m_states);
+		actions = m_slots.m_actions;
+	}
+	void nextSteps(
+		std::vector<Action_t>& actions,
+		const std::vector<float>& rewards,
+		const std::vector<State_t>& nextStates,
+		const std::vector<EnvironmentStatus>& statuses,
+		const std::vector<State_t>& resetStates) override
+	{
+		size_t count = m_slots.size();
+		assert(rewards.size() == count && nextStates.size() == count && statuses.size() == count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			update(m_slots.m_states[i], m_slots.m_actions[i], rewards[i], nextStates[i], EnvironmentStatus::es_terminated == statuses[i]);
+			if (EnvironmentStatus::es_normal == statuses[i])
+			{
+				++m_slots.m_stepCounts[i];
+				m_slots.m_states[i] = nextStates[i];
+			}
+			else
+			{
+				m_slots.beginEpisode(i);
+				m_slots.m_states[i] = resetStates[i];
+			}
+		}
+		m_policy->takeActions(m_slots.m_actions, m_slots.m_states);
+		actions = m_slots.m_actions;
+	}
+	void beginSlotSteps(size_t count) override
+	{
+		m_slots.initialize(count);
+	}
+	Action_t firstSlotStep(size_t slot, const State_t& firstState) override
+	{
+		m_slots.beginEpisode(slot);
+		m_slots.m_states[slot] = firstState;
+		m_slots.m_actions[slot] = m_policy->takeAction(firstState);
+		return m_slots.m_actions[slot];
+	}
+	Action_t nextSlotStep(size_t slot, float reward, const State_t& nextState, EnvironmentStatus status, const State_t& resetState) override
+	{
+		update(m_slots.m_states[slot], m_slots.m_actions[slot], reward, nextState, EnvironmentStatus::es_terminated == status);
+		if (EnvironmentStatus::es_normal != status)
+		{
+			return firstSlotStep(slot, resetState);
+		}
+		++m_slots.m_stepCounts[slot];
+		m_slots.m_states[slot] = nextState;
+		m_slots.m_actions[slot] = m_policy->takeAction(nextState);
+		return m_slots.m_actions[slot];
+	}
+protected:
+	void update(const State_t& state, const Action_t& action, float reward, const State_t& nextState, bool terminated)
+	{
+		float value = m_actionValueFunction->getValue(state, action);
 		float target = reward;
 		if (!terminated)
 		{
-			target += m_actionValueFunction.getMaxValue(nextState) * m_discountRate;
+			target += m_actionValueFunction->getMaxValue(nextState) * m_discountRate;
 		}
 		float newValue = value + (target - value) * m_learningRate;
-		m_actionValueFunction.setValue(m_state, m_action, newValue);
+		m_actionValueFunction->setValue(state, action, newValue);
 	}
 protected:
 	ActionValueFunctionPtr m_actionValueFunction;
@@ -57,6 +118,7 @@ protected:
 protected:
 	State_t m_state;
 	Action_t m_action;
+	AgentSlots<State_t, Action_t> m_slots;
 public:
 	static QLearningPtr Make(ActionValueFunctionPtr actionValueFunction, PolicyFunctionPtr policy, float learningRate, float discountRate = 1.0f)
 	{
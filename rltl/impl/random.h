@@ -2,9 +2,21 @@
 #include "utility.h"
 #include <stdlib.h>
 #include <random>
+#include <atomic>
 
 BEGIN_RLTL_IMPL
 
+//kinds of threads which draw random numbers, see Random::seedThread
+enum class RandomStream : uint32_t
+{
+	main,
+	actor,
+	learner,
+	prefetcher,
+	replay_shard,
+	replay_server,
+};
+
 class Random
 {
 public:
@@ -28,9 +40,30 @@ public:
 	}
 	static std::default_random_engine& generator()
 	{
-		static std::default_random_engine s_generator;
+		//per thread, the actors and the learner of DeepQNetworkActorLearner draw concurrently
+		static thread_local std::default_random_engine s_generator;
 		return s_generator;
 	}
+	//sets the process seed and reseeds the calling thread as RandomStream::main
+	static void seed(uint64_t processSeed)
+	{
+		ProcessSeed().store(processSeed, std::memory_order_relaxed);
+		seedThread(RandomStream::main, 0);
+	}
+	//threads started by the library call this first, so every thread draws its own sequence
+	//which only depends on the process seed, the kind of thread and its index
+	static void seedThread(RandomStream stream, uint32_t index)
+	{
+		uint64_t processSeed = ProcessSeed().load(std::memory_order_relaxed);
+		std::seed_seq sequence{ uint32_t(processSeed), uint32_t(processSeed >> 32), uint32_t(stream), index };
+		generator().seed(sequence);
+	}
+protected:
+	static std::atomic<uint64_t>& ProcessSeed()
+	{
+		static std::atomic<uint64_t> s_processSeed{ std::default_random_engine::default_seed };
+		return s_processSeed;
+	}
 };
 
 END_RLTL_IMPL
@@ -0,0 +1,157 @@
+#pragma once
+#include "utility.h"
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+BEGIN_RLTL_IMPL
+
+//keeps the number of sampled transitions close to samplesPerInsert times the number of inserted ones,
+//so the replay ratio does not depend on how fast or how many actors run.
+//inserters block while samples lag more than errorBuffer behind the target, the sampler blocks while it
+//runs more than errorBuffer ahead of it or fewer than minSizeToSample transitions were inserted.
+//errorBuffer has to cover one insert and one sample call, otherwise both sides could wait on each other
+class RateLimiter
+{
+public:
+	RateLimiter() = default;
+	RateLimiter(const RateLimiter&) = delete;
+	RateLimiter& operator=(const RateLimiter&) = delete;
+public:
+	//not thread safe, call before any inserter or sampler starts
+	void initialize(double samplesPerInsert, uint64_t minSizeToSample, double errorBuffer)
+	{
+		assert(samplesPerInsert > 0);
+		m_samplesPerInsert = samplesPerInsert;
+		m_minSizeToSample = minSizeToSample;
+		m_errorBuffer = errorBuffer;
+		m_inserts = 0;
+		m_samples = 0;
+		m_stopped = false;
+		m_insertWaitCount = 0;
+		m_sampleWaitCount = 0;
+		m_insertWaitSeconds = 0;
+		m_sampleWaitSeconds = 0;
+	}
+	explicit operator bool() const
+	{
+		return m_samplesPerInsert > 0;
+	}
+	//blocks until count transitions may be inserted, the caller inserts them afterwards
+	void awaitInsert(uint64_t count)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!canInsert(count))
+		{
+			++m_insertWaitCount;
+			auto start = std::chrono::steady_clock::now();
+			m_insertCondition.wait(lock, [this, count]() { return canInsert(count); });
+			m_insertWaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		m_inserts += count;
+		lock.unlock();
+		m_sampleCondition.notify_all();
+	}
+	//blocks until a batch of count transitions may be sampled
+	void awaitSample(uint64_t count)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!canSample(count))
+		{
+			++m_sampleWaitCount;
+			auto start = std::chrono::steady_clock::now();
+			m_sampleCondition.wait(lock, [this, count]() { return canSample(count); });
+			m_sampleWaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		m_samples += count;
+		lock.unlock();
+		m_insertCondition.notify_all();
+	}
+	//releases every waiting thread, later calls return at once
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopped = true;
+		}
+		m_insertCondition.notify_all();
+		m_sampleCondition.notify_all();
+	}
+	//limits again after stop, the counts are kept since the replay memory keeps its transitions.
+	//not thread safe, call before the inserters and the sampler start again
+	void restart()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopped = false;
+	}
+public:
+	uint64_t numInserts() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_inserts;
+	}
+	uint64_t numSamples() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_samples;
+	}
+	//actual samples per insert since initialize
+	double ratio() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_inserts > 0 ? double(m_samples) / double(m_inserts) : 0;
+	}
+	uint64_t insertWaitCount() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_insertWaitCount;
+	}
+	uint64_t sampleWaitCount() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_sampleWaitCount;
+	}
+	//summed over all inserting threads
+	double insertWaitSeconds() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_insertWaitSeconds;
+	}
+	double sampleWaitSeconds() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_sampleWaitSeconds;
+	}
+protected:
+	//how far the samples lag behind the target once sampling has started
+	double lag(uint64_t inserts, uint64_t samples) const
+	{
+		uint64_t counted = inserts > m_minSizeToSample ? inserts - m_minSizeToSample : 0;
+		return double(counted) * m_samplesPerInsert - double(samples);
+	}
+	bool canInsert(uint64_t count) const
+	{
+		return m_stopped || m_inserts + count <= m_minSizeToSample || lag(m_inserts + count, m_samples) <= m_errorBuffer;
+	}
+	bool canSample(uint64_t count) const
+	{
+		return m_stopped || (m_inserts >= m_minSizeToSample && lag(m_inserts, m_samples + count) >= -m_errorBuffer);
+	}
+protected:
+	double m_samplesPerInsert{ 0 };
+	uint64_t m_minSizeToSample{ 0 };
+	double m_errorBuffer{ 0 };
+	uint64_t m_inserts{ 0 };
+	uint64_t m_samples{ 0 };
+	bool m_stopped{ false };
+	uint64_t m_insertWaitCount{ 0 };
+	uint64_t m_sampleWaitCount{ 0 };
+	double m_insertWaitSeconds{ 0 };
+	double m_sampleWaitSeconds{ 0 };
+	mutable std::mutex m_mutex;
+	std::condition_variable m_insertCondition;
+	std::condition_variable m_sampleCondition;
+};
+
+END_RLTL_IMPL
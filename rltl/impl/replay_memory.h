@@ -5,6 +5,7 @@
 #include "random.h"
 #include "neural_network.h"
 #include "callback.h"
+#include "sum_tree.h"
 
 BEGIN_RLTL_IMPL
 
@@ -87,10 +88,7 @@ public:
 		m_nextDiscounts = new float[capacity];
 		if (options.prioritized())
 		{
-			m_priorities = new Priority_t[capacity];
-			std::memset(m_priorities, 0, sizeof(Priority_t)*(capacity));
-			m_prioritySums = new PrioritySum_t[capacity - 1];
-			std::memset(m_prioritySums, 0, sizeof(PrioritySum_t)*(capacity-1));
+			m_sumTree.initialize(uint32_t(capacity));
 		}
 	}
 
@@ -102,8 +100,6 @@ public:
 		delete[]m_rewards;
 		delete[]m_actions;
 		delete[]m_states;
-		delete[]m_priorities;
-		delete[]m_prioritySums;
 	}
 public:
 	size_t size() const
@@ -113,7 +109,7 @@ public:
 
 	bool isPrioritized() const
 	{
-		return m_priorities != nullptr;
+		return bool(m_sumTree);
 	}
 
 	float prioritizedBeta() const
@@ -143,9 +139,9 @@ public:
 		m_rewards[index] = reward;
 		m_nextStates[index] = nextState;
 		m_nextDiscounts[index] = nextDiscount;
-		if (m_priorities)
+		if (m_sumTree)
 		{
-			updatePriority(index, m_maxPriority);
+			updatePriority(index, m_sumTree.maxPriority());
 		}
 		m_index = (index + 1) % m_capacity;
 		if (m_size < m_capacity)
@@ -163,9 +159,9 @@ public:
 		m_nextStates[index] = nextState;
 		m_nextDiscounts[index] = nextDiscount;
 		m_nextActions[index] = nextAction;
-		if (m_priorities)
+		if (m_sumTree)
 		{
-			updatePriority(index, m_maxPriority);
+			updatePriority(index, m_sumTree.maxPriority());
 		}
 		m_index = (index + 1) % m_capacity;
 		if (m_size < m_capacity)
@@ -259,7 +255,7 @@ public:
 			Tensor_Assign(rewards[i], m_rewards[index]);
 			Tensor_Assign(nextStates[i], m_nextStates[index]);
 			Tensor_Assign(nextDiscounts[i], m_nextDiscounts[index]);
-			weights[i][0] = std::pow(m_minPriority / m_priorities[index], m_prioritizedBeta);
+			weights[i][0] = m_sumTree.weight(index, m_prioritizedBeta);
 		}
 	}
 
@@ -284,7 +280,7 @@ public:
 			Tensor_Assign(nextStates[i], m_nextStates[index]);
 			Tensor_Assign(nextDiscounts[i], m_nextDiscounts[index]);
 			Tensor_Assign(nextActions[i], m_nextActions[index]);
-			weights[i][0] = std::pow(m_minPriority / m_priorities[index], m_prioritizedBeta);
+			weights[i][0] = m_sumTree.weight(index, m_prioritizedBeta);
 		}
 	}
 
@@ -304,51 +300,11 @@ public:
 protected:
 	void updatePriority(size_t index, float priority)
 	{
-		m_priorities[index] = priority;
-		updateSumTree(index);
-		if (m_minPriority > priority)
-		{
-			m_minPriority = priority;
-		}
-		if (m_maxPriority < priority)
-		{
-			m_maxPriority = priority;
-		}
-	}
-	void updateSumTree(size_t index)
-	{
-		size_t parent = (index + m_capacity) / 2 - 1;
-		m_prioritySums[parent] = m_priorities[index] + m_priorities[index ^ 1];
-		while (parent)
-		{
-			parent = (parent - 1) / 2;
-			m_prioritySums[parent] = m_prioritySums[parent * 2 + 1] + m_prioritySums[parent * 2 + 2];
-			assert(m_prioritySums[parent] >= m_prioritySums[parent * 2 + 1] && m_prioritySums[parent] >= m_prioritySums[parent * 2 + 2]);
-		}
+		m_sumTree.update(index, priority);
 	}
 	size_t sampleIndexSumTree() const
 	{
-		Priority_t priority = Random::rand() * m_prioritySums[0];
-		size_t leftNode = 1;
-		while (leftNode < m_capacity - 1)
-		{
-			if (m_prioritySums[leftNode] > priority)
-			{
-				leftNode = leftNode * 2 + 1;
-			}
-			else
-			{
-				priority -= m_prioritySums[leftNode];
-				leftNode = (leftNode + 1) * 2 + 1;
-			}
-		}
-		leftNode -= (m_capacity - 1);
-		size_t index = m_priorities[leftNode] > priority ? leftNode : leftNode + 1;
-		if (index >= m_size)
-		{
-			index = m_size - 1;
-		}
-		return index;
+		return m_sumTree.sample(uint32_t(m_size));
 	}
 protected:
 	State_t* m_states{};
@@ -357,10 +313,7 @@ protected:
 	State_t* m_nextStates{};
 	float* m_nextDiscounts{};
 	Action_t* m_nextActions{};
-	Priority_t* m_priorities{};
-	PrioritySum_t* m_prioritySums{};
-	Priority_t m_minPriority{ FLT_MAX };
-	Priority_t m_maxPriority{ 1.0f };
+	PrioritySumTree<Priority_t, PrioritySum_t> m_sumTree;
 	size_t m_capacity{};
 	size_t m_index{};
 	size_t m_size{};
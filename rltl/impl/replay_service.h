@@ -0,0 +1,763 @@
+#pragma once
+#include "utility.h"
+#include "trajectory_buffer.h"
+#include "mapped_file.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#endif
+
+BEGIN_RLTL_IMPL
+
+//replay memory living outside the learner, DeepQNetwork samples from it instead of its own buffer.
+//sample returns false if no batch was written, connected() turns false once none will be any more
+template<typename State_t, typename Action_t>
+class ReplaySource
+{
+public:
+	virtual ~ReplaySource() = default;
+public:
+	virtual bool connected()
+	{
+		return true;
+	}
+	virtual uint32_t size() = 0;
+	virtual bool sample(
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		uint32_t batchSize) = 0;
+	virtual bool sample(
+		std::vector<uint32_t>& indices,
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		Tensor& weightTensor,
+		uint32_t batchSize,
+		float prioritizedBeta) = 0;
+	virtual void updatePriorities(const std::vector<uint32_t>& indices, const Tensor& deltaTensor, uint32_t batchSize, float prioritizedAlpha, float prioritizedEpsilon) = 0;
+	//write serials of the slots of the last prioritized sample, read under its lock. a source which can not
+	//tell overwritten slots apart leaves them empty and the update with serials falls back to the indices
+	virtual void serials(const std::vector<uint32_t>& indices, std::vector<uint64_t>& serials, uint32_t batchSize)
+	{
+		serials.clear();
+	}
+	virtual void updatePriorities(const std::vector<uint32_t>& indices, const std::vector<uint64_t>& serials, const Tensor& deltaTensor, uint32_t batchSize, float prioritizedAlpha, float prioritizedEpsilon)
+	{
+		updatePriorities(indices, deltaTensor, batchSize, prioritizedAlpha, prioritizedEpsilon);
+	}
+};
+
+enum class ReplayRequest : uint32_t
+{
+	hello,
+	insert,
+	sample,
+	sample_prioritized,
+	update_priorities,
+	size,
+};
+
+//fixed size control message, requests and replies have the same layout.
+//payloads never go through the socket, m_slot names the slot of the client's shared memory ring holding them.
+//m_path is only set in the reply to hello
+struct ReplayMessage
+{
+	ReplayRequest m_request;
+	uint32_t m_slot;
+	uint32_t m_count;
+	uint32_t m_ok;
+	float m_prioritizedAlpha;
+	float m_prioritizedBeta;
+	float m_prioritizedEpsilon;
+	uint32_t m_slotCount;
+	uint64_t m_slotBytes;
+	uint64_t m_size;
+	char m_path[256];
+};
+
+//where the parts of a sampled batch are placed in a slot, every part starts on a cache line
+template<typename State_t, typename Action_t>
+struct ReplaySlotLayout
+{
+	struct Transition
+	{
+		State_t m_state;
+		Action_t m_action;
+		float m_reward;
+		State_t m_nextState;
+		float m_nextDiscount;
+	};
+	static_assert(std::is_trivially_copyable_v<Transition>, "transitions are copied byte-wise through shared memory");
+
+	ReplaySlotLayout(uint32_t batchSize)
+	{
+		uint64_t offset = 0;
+		m_stateOffset = offset;
+		offset = align(offset + uint64_t(batchSize) * Array_Size<State_t>::size() * sizeof(float));
+		m_actionOffset = offset;
+		offset = align(offset + uint64_t(batchSize) * Array_Size<Action_t>::size() * sizeof(int64_t));
+		m_rewardOffset = offset;
+		offset = align(offset + uint64_t(batchSize) * sizeof(float));
+		m_nextStateOffset = offset;
+		offset = align(offset + uint64_t(batchSize) * Array_Size<State_t>::size() * sizeof(float));
+		m_nextDiscountOffset = offset;
+		offset = align(offset + uint64_t(batchSize) * sizeof(float));
+		m_weightOffset = offset;
+		offset = align(offset + uint64_t(batchSize) * sizeof(float));
+		m_indexOffset = offset;
+		offset = align(offset + uint64_t(batchSize) * sizeof(uint32_t));
+		m_sampleBytes = offset;
+	}
+	//bytes of a slot which can carry count inserted transitions or a batch of count
+	static uint64_t SlotBytes(uint32_t count)
+	{
+		return align(std::max(uint64_t(count) * sizeof(Transition), ReplaySlotLayout(count).m_sampleBytes));
+	}
+	static uint64_t align(uint64_t offset)
+	{
+		return (offset + 63) / 64 * 64;
+	}
+	template<typename Element_t>
+	static std::vector<int64_t> batchShape(uint32_t batchSize)
+	{
+		auto shape = Array_Shape<Element_t>::shape();
+		std::vector<int64_t> tensorShape(shape.size() + 1);
+		tensorShape[0] = batchSize;
+		for (size_t i = 0; i < shape.size(); ++i)
+		{
+			tensorShape[i + 1] = shape[i];
+		}
+		return tensorShape;
+	}
+	//tensors over the batch parts of a slot, nothing is copied
+	void view(char* slot, uint32_t batchSize, Tensor& stateTensor, Tensor& actionTensor, Tensor& rewardTensor, Tensor& nextStateTensor, Tensor& nextDiscountTensor, Tensor& weightTensor) const
+	{
+		stateTensor = torch::from_blob(slot + m_stateOffset, batchShape<State_t>(batchSize), torch::kFloat32);
+		actionTensor = torch::from_blob(slot + m_actionOffset, batchShape<Action_t>(batchSize), torch::kInt64);
+		rewardTensor = torch::from_blob(slot + m_rewardOffset, { int64_t(batchSize), 1 }, torch::kFloat32);
+		nextStateTensor = torch::from_blob(slot + m_nextStateOffset, batchShape<State_t>(batchSize), torch::kFloat32);
+		nextDiscountTensor = torch::from_blob(slot + m_nextDiscountOffset, { int64_t(batchSize), 1 }, torch::kFloat32);
+		weightTensor = torch::from_blob(slot + m_weightOffset, { int64_t(batchSize), 1 }, torch::kFloat32);
+	}
+	uint64_t m_stateOffset;
+	uint64_t m_actionOffset;
+	uint64_t m_rewardOffset;
+	uint64_t m_nextStateOffset;
+	uint64_t m_nextDiscountOffset;
+	uint64_t m_weightOffset;
+	uint64_t m_indexOffset;
+	uint64_t m_sampleBytes;
+};
+
+#ifndef _WIN32
+
+//blocking send and receive of whole control messages, false once the peer is gone
+inline bool ReplaySocket_send(int socket, const ReplayMessage& message)
+{
+	const char* data = reinterpret_cast<const char*>(&message);
+	size_t sent = 0;
+	while (sent < sizeof(message))
+	{
+		ssize_t count = ::send(socket, data + sent, sizeof(message) - sent, MSG_NOSIGNAL);
+		if (count < 0 && EINTR == errno)
+		{
+			continue;
+		}
+		if (count <= 0)
+		{
+			return false;
+		}
+		sent += size_t(count);
+	}
+	return true;
+}
+
+inline bool ReplaySocket_receive(int socket, ReplayMessage& message)
+{
+	char* data = reinterpret_cast<char*>(&message);
+	size_t received = 0;
+	while (received < sizeof(message))
+	{
+		ssize_t count = ::recv(socket, data + received, sizeof(message) - received, 0);
+		if (count < 0 && EINTR == errno)
+		{
+			continue;
+		}
+		if (count <= 0)
+		{
+			return false;
+		}
+		received += size_t(count);
+	}
+	return true;
+}
+
+inline bool ReplaySocket_address(sockaddr_un& address, const std::string& socketPath)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+	memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+	return true;
+}
+
+//owns a TrajectoryBuffer and serves local clients, one thread per connection.
+//a client asks for a shared memory ring of slotCount slots in the hello message, the server creates it
+//in a private directory, bounded by maxRingBytes, and replies with its path.
+//inserted transitions are read from the client's slot, sampled batches are written into it
+template<typename State_t, typename Action_t>
+class ReplayServer
+{
+public:
+	typedef ReplaySlotLayout<State_t, Action_t> Layout_t;
+	typedef typename Layout_t::Transition Transition_t;
+	typedef TrajectoryBuffer<State_t, Action_t> Buffer_t;
+public:
+	ReplayServer() = default;
+	ReplayServer(const ReplayServer&) = delete;
+	ReplayServer& operator=(const ReplayServer&) = delete;
+	~ReplayServer()
+	{
+		stop();
+	}
+public:
+	//ringParent should be on a memory file system such as /dev/shm, the rings are created in a new directory below it
+	bool start(const std::string& socketPath, uint32_t capacity, bool needPriority, const std::string& ringParent = "/dev/shm", uint64_t maxRingBytes = uint64_t(1) << 30)
+	{
+		stop();
+		sockaddr_un address;
+		if (!ReplaySocket_address(address, socketPath))
+		{
+			return false;
+		}
+		std::string ringDirectory = ringParent + "/rltl_replay_XXXXXX";
+		if (nullptr == mkdtemp(&ringDirectory[0]))
+		{
+			return false;
+		}
+		//a fresh buffer, so a restarted server does not serve what it held before
+		m_buffer.reset(new Buffer_t());
+		m_buffer->initialize(capacity, false, needPriority);
+		m_listenSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (m_listenSocket >= 0)
+		{
+			::unlink(socketPath.c_str());
+			if (0 != ::bind(m_listenSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) || 0 != ::listen(m_listenSocket, 64))
+			{
+				::close(m_listenSocket);
+				m_listenSocket = -1;
+			}
+		}
+		if (m_listenSocket < 0)
+		{
+			::rmdir(ringDirectory.c_str());
+			return false;
+		}
+		m_socketPath = socketPath;
+		m_ringDirectory = ringDirectory;
+		m_maxRingBytes = maxRingBytes;
+		m_needPriority = needPriority;
+		m_acceptThread = std::thread([this]() { acceptClients(); });
+		return true;
+	}
+	void stop()
+	{
+		if (m_listenSocket < 0)
+		{
+			return;
+		}
+		//shutdown wakes the blocked accept and recv calls, the threads then close their sockets.
+		//a socket a finished thread has closed is -1, its number may already belong to another file
+		::shutdown(m_listenSocket, SHUT_RDWR);
+		m_acceptThread.join();
+		::close(m_listenSocket);
+		m_listenSocket = -1;
+		{
+			std::lock_guard<std::mutex> lock(m_clientMutex);
+			for (auto& client : m_clients)
+			{
+				if (client->m_socket >= 0)
+				{
+					::shutdown(client->m_socket, SHUT_RDWR);
+				}
+			}
+		}
+		for (auto& client : m_clients)
+		{
+			client->m_thread.join();
+		}
+		m_clients.clear();
+		::unlink(m_socketPath.c_str());
+		::rmdir(m_ringDirectory.c_str());
+	}
+	uint32_t size()
+	{
+		std::lock_guard<std::mutex> lock(m_bufferMutex);
+		return m_buffer ? m_buffer->size() : 0;
+	}
+protected:
+	struct Client
+	{
+		int m_socket{ -1 };
+		MappedFile m_ring;
+		std::string m_ringPath;
+		uint64_t m_slotBytes{ 0 };
+		uint32_t m_slotCount{ 0 };
+		uint32_t m_index{ 0 };
+		std::vector<uint32_t> m_indices;
+		std::thread m_thread;
+		//m_socket and m_finished are guarded by m_clientMutex
+		bool m_finished{ false };
+	};
+	void acceptClients()
+	{
+		while (true)
+		{
+			int socket = ::accept(m_listenSocket, nullptr, nullptr);
+			if (socket < 0)
+			{
+				if (EINTR == errno)
+				{
+					continue;
+				}
+				return;
+			}
+			std::lock_guard<std::mutex> lock(m_clientMutex);
+			reapClients();
+			m_clients.push_back(std::make_unique<Client>());
+			Client* client = m_clients.back().get();
+			client->m_socket = socket;
+			client->m_index = m_numAccepted++;
+			client->m_thread = std::thread([this, client]()
+				{
+					Random::seedThread(RandomStream::replay_server, client->m_index);
+					serve(*client);
+				});
+		}
+	}
+	//joins the threads of disconnected clients, a finished thread takes no lock any more
+	void reapClients()
+	{
+		for (auto it = m_clients.begin(); it != m_clients.end();)
+		{
+			if ((*it)->m_finished)
+			{
+				(*it)->m_thread.join();
+				it = m_clients.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+	void serve(Client& client)
+	{
+		ReplayMessage message;
+		while (ReplaySocket_receive(client.m_socket, message))
+		{
+			message.m_ok = handle(client, message) ? 1 : 0;
+			if (!ReplaySocket_send(client.m_socket, message))
+			{
+				break;
+			}
+		}
+		client.m_ring.close();
+		if (!client.m_ringPath.empty())
+		{
+			::unlink(client.m_ringPath.c_str());
+		}
+		std::lock_guard<std::mutex> lock(m_clientMutex);
+		::close(client.m_socket);
+		client.m_socket = -1;
+		client.m_finished = true;
+	}
+	bool handle(Client& client, ReplayMessage& message)
+	{
+		if (ReplayRequest::hello == message.m_request)
+		{
+			//the client only chooses the shape of its ring, never where the server creates a file
+			memset(message.m_path, 0, sizeof(message.m_path));
+			if (client.m_ring || 0 == message.m_slotCount || 0 == message.m_slotBytes || message.m_slotBytes % 64 != 0 || message.m_slotCount > m_maxRingBytes / message.m_slotBytes)
+			{
+				return false;
+			}
+			std::string ringPath = m_ringDirectory + "/ring_" + std::to_string(client.m_index);
+			if (ringPath.size() >= sizeof(message.m_path) || !client.m_ring.open(ringPath, size_t(message.m_slotCount * message.m_slotBytes)))
+			{
+				return false;
+			}
+			client.m_ringPath = ringPath;
+			client.m_slotCount = message.m_slotCount;
+			client.m_slotBytes = message.m_slotBytes;
+			memcpy(message.m_path, ringPath.c_str(), ringPath.size());
+			return true;
+		}
+		if (ReplayRequest::size == message.m_request)
+		{
+			message.m_size = size();
+			return true;
+		}
+		if (!client.m_ring || message.m_slot >= client.m_slotCount)
+		{
+			return false;
+		}
+		char* slot = static_cast<char*>(client.m_ring.data()) + message.m_slot * client.m_slotBytes;
+		uint32_t count = message.m_count;
+		//without priorities the buffer has no sum tree to sample or update
+		if (!m_needPriority && (ReplayRequest::sample_prioritized == message.m_request || ReplayRequest::update_priorities == message.m_request))
+		{
+			return false;
+		}
+		switch (message.m_request)
+		{
+		case ReplayRequest::insert:
+		{
+			if (count * sizeof(Transition_t) > client.m_slotBytes)
+			{
+				return false;
+			}
+			const Transition_t* transitions = reinterpret_cast<const Transition_t*>(slot);
+			std::lock_guard<std::mutex> lock(m_bufferMutex);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				const Transition_t& transition = transitions[i];
+				m_buffer->append(transition.m_state, transition.m_action, transition.m_reward, transition.m_nextState, transition.m_nextDiscount);
+			}
+			message.m_size = m_buffer->size();
+			return true;
+		}
+		case ReplayRequest::sample:
+		case ReplayRequest::sample_prioritized:
+		{
+			Layout_t layout(count);
+			if (0 == count || layout.m_sampleBytes > client.m_slotBytes)
+			{
+				return false;
+			}
+			Tensor stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor;
+			layout.view(slot, count, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor);
+			std::lock_guard<std::mutex> lock(m_bufferMutex);
+			if (0 == m_buffer->size())
+			{
+				return false;
+			}
+			if (ReplayRequest::sample == message.m_request)
+			{
+				m_buffer->sample(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, count);
+			}
+			else
+			{
+				client.m_indices.resize(count);
+				m_buffer->sample(client.m_indices, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor, count, message.m_prioritizedBeta);
+				memcpy(slot + layout.m_indexOffset, client.m_indices.data(), count * sizeof(uint32_t));
+			}
+			message.m_size = m_buffer->size();
+			return true;
+		}
+		case ReplayRequest::update_priorities:
+		{
+			//count indices followed by count deltas
+			uint64_t deltaOffset = Layout_t::align(count * sizeof(uint32_t));
+			if (deltaOffset + count * sizeof(float) > client.m_slotBytes)
+			{
+				return false;
+			}
+			const uint32_t* indices = reinterpret_cast<const uint32_t*>(slot);
+			client.m_indices.assign(indices, indices + count);
+			Tensor deltaTensor = torch::from_blob(slot + deltaOffset, { int64_t(count), 1 }, torch::kFloat32);
+			std::lock_guard<std::mutex> lock(m_bufferMutex);
+			for (uint32_t index : client.m_indices)
+			{
+				if (index >= m_buffer->size())
+				{
+					return false;
+				}
+			}
+			m_buffer->updatePriorities(client.m_indices, deltaTensor, count, message.m_prioritizedAlpha, message.m_prioritizedEpsilon);
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+protected:
+	std::unique_ptr<Buffer_t> m_buffer;
+	std::mutex m_bufferMutex;
+	int m_listenSocket{ -1 };
+	std::string m_socketPath;
+	std::string m_ringDirectory;
+	uint64_t m_maxRingBytes{ 0 };
+	bool m_needPriority{ false };
+	std::thread m_acceptThread;
+	std::vector<std::unique_ptr<Client>> m_clients;
+	uint32_t m_numAccepted{ 0 };
+	std::mutex m_clientMutex;
+};
+
+//one connection to a ReplayServer, used by one thread.
+//as the Learner_t of a DeepQNetworkActor it appends transitions, as the remote replay of a DeepQNetwork it samples.
+//inserts and priority updates are pipelined: they only wait for a reply when their slot is needed again
+template<typename State_t, typename Action_t>
+class ReplayClient : public ReplaySource<State_t, Action_t>
+{
+public:
+	typedef ReplaySlotLayout<State_t, Action_t> Layout_t;
+	typedef typename Layout_t::Transition Transition_t;
+	using ReplaySource<State_t, Action_t>::updatePriorities;
+public:
+	ReplayClient() = default;
+	ReplayClient(const ReplayClient&) = delete;
+	ReplayClient& operator=(const ReplayClient&) = delete;
+	~ReplayClient()
+	{
+		close();
+	}
+public:
+	//maxCount bounds both an insert and a batch, the server refuses a ring larger than its maxRingBytes
+	bool connect(const std::string& socketPath, uint32_t slotCount, uint32_t maxCount)
+	{
+		close();
+		sockaddr_un address;
+		if (!ReplaySocket_address(address, socketPath) || 0 == slotCount || 0 == maxCount)
+		{
+			return false;
+		}
+		m_slotCount = slotCount;
+		m_slotBytes = Layout_t::SlotBytes(maxCount);
+		m_maxCount = maxCount;
+		m_socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (m_socket < 0 || 0 != ::connect(m_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)))
+		{
+			close();
+			return false;
+		}
+		ReplayMessage message{};
+		message.m_request = ReplayRequest::hello;
+		message.m_slotCount = m_slotCount;
+		message.m_slotBytes = m_slotBytes;
+		if (!request(message))
+		{
+			close();
+			return false;
+		}
+		//the server created the ring with the requested size and removes it when the connection ends
+		message.m_path[sizeof(message.m_path) - 1] = 0;
+		if (!m_ring.open(message.m_path, size_t(m_slotCount * m_slotBytes)) || !m_ring.existed())
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+	void close()
+	{
+		if (m_socket >= 0)
+		{
+			drain();
+			::close(m_socket);
+			m_socket = -1;
+		}
+		m_ring.close();
+		m_nextSlot = 0;
+		m_inFlight = 0;
+		m_failed = false;
+	}
+	explicit operator bool() const
+	{
+		return m_socket >= 0 && !m_failed;
+	}
+public:
+	//actor side, same signature as DeepQNetwork::appendTransitions
+	void appendTransitions(const TransitionBatch<State_t, Action_t>& transitions)
+	{
+		uint32_t count = uint32_t(transitions.size());
+		for (uint32_t first = 0; first < count; first += m_maxCount)
+		{
+			uint32_t slotCount = std::min(m_maxCount, count - first);
+			uint32_t slotIndex = acquireSlot();
+			Transition_t* slot = reinterpret_cast<Transition_t*>(slotData(slotIndex));
+			for (uint32_t i = 0; i < slotCount; ++i)
+			{
+				Transition_t& transition = slot[i];
+				transition.m_state = transitions.m_states[first + i];
+				transition.m_action = transitions.m_actions[first + i];
+				transition.m_reward = transitions.m_rewards[first + i];
+				transition.m_nextState = transitions.m_nextStates[first + i];
+				transition.m_nextDiscount = transitions.m_nextDiscounts[first + i];
+			}
+			ReplayMessage message{};
+			message.m_request = ReplayRequest::insert;
+			message.m_slot = slotIndex;
+			message.m_count = slotCount;
+			post(message);
+		}
+	}
+public:
+	//learner side
+	bool connected() override
+	{
+		return bool(*this);
+	}
+	uint32_t size() override
+	{
+		ReplayMessage message{};
+		message.m_request = ReplayRequest::size;
+		return request(message) ? uint32_t(message.m_size) : 0;
+	}
+	bool sample(
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		uint32_t batchSize) override
+	{
+		Tensor weightTensor;
+		return sampleSlot(ReplayRequest::sample, batchSize, 1, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor, nullptr);
+	}
+	bool sample(
+		std::vector<uint32_t>& indices,
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		Tensor& weightTensor,
+		uint32_t batchSize,
+		float prioritizedBeta) override
+	{
+		return sampleSlot(ReplayRequest::sample_prioritized, batchSize, prioritizedBeta, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor, &indices);
+	}
+	void updatePriorities(const std::vector<uint32_t>& indices, const Tensor& deltaTensor, uint32_t batchSize, float prioritizedAlpha, float prioritizedEpsilon) override
+	{
+		assert(batchSize <= m_maxCount && indices.size() >= batchSize);
+		uint32_t slotIndex = acquireSlot();
+		char* slot = slotData(slotIndex);
+		uint64_t deltaOffset = Layout_t::align(batchSize * sizeof(uint32_t));
+		memcpy(slot, indices.data(), batchSize * sizeof(uint32_t));
+		torch::from_blob(slot + deltaOffset, { int64_t(batchSize), 1 }, torch::kFloat32).copy_(deltaTensor.reshape({ int64_t(batchSize), 1 }));
+		ReplayMessage message{};
+		message.m_request = ReplayRequest::update_priorities;
+		message.m_slot = slotIndex;
+		message.m_count = batchSize;
+		message.m_prioritizedAlpha = prioritizedAlpha;
+		message.m_prioritizedEpsilon = prioritizedEpsilon;
+		post(message);
+	}
+protected:
+	//false if the server refused the request or is gone, the tensors are left as they were
+	bool sampleSlot(ReplayRequest kind, uint32_t batchSize, float prioritizedBeta, Tensor& stateTensor, Tensor& actionTensor, Tensor& rewardTensor, Tensor& nextStateTensor, Tensor& nextDiscountTensor, Tensor& weightTensor, std::vector<uint32_t>* indices)
+	{
+		assert(batchSize <= m_maxCount);
+		uint32_t slotIndex = acquireSlot();
+		ReplayMessage message{};
+		message.m_request = kind;
+		message.m_slot = slotIndex;
+		message.m_count = batchSize;
+		message.m_prioritizedBeta = prioritizedBeta;
+		if (!request(message))
+		{
+			return false;
+		}
+		//the server wrote the batch into the slot, this is the only copy on the client side
+		char* slot = slotData(slotIndex);
+		Layout_t layout(batchSize);
+		Tensor states, actions, rewards, nextStates, nextDiscounts, weights;
+		layout.view(slot, batchSize, states, actions, rewards, nextStates, nextDiscounts, weights);
+		stateTensor.copy_(states);
+		actionTensor.copy_(actions);
+		rewardTensor.copy_(rewards);
+		nextStateTensor.copy_(nextStates);
+		nextDiscountTensor.copy_(nextDiscounts);
+		if (indices)
+		{
+			weightTensor.copy_(weights);
+			const uint32_t* sampled = reinterpret_cast<const uint32_t*>(slot + layout.m_indexOffset);
+			indices->assign(sampled, sampled + batchSize);
+		}
+		return true;
+	}
+	char* slotData(uint32_t slotIndex) const
+	{
+		return static_cast<char*>(m_ring.data()) + slotIndex * m_slotBytes;
+	}
+	//next slot of the ring, waits for the reply of the request which used it last
+	uint32_t acquireSlot()
+	{
+		if (m_inFlight == m_slotCount)
+		{
+			receiveReply();
+		}
+		uint32_t slotIndex = m_nextSlot;
+		m_nextSlot = (m_nextSlot + 1) % m_slotCount;
+		return slotIndex;
+	}
+	void post(ReplayMessage& message)
+	{
+		if (m_failed || !ReplaySocket_send(m_socket, message))
+		{
+			m_failed = true;
+			return;
+		}
+		++m_inFlight;
+	}
+	//replies arrive in request order, so the pipelined ones are drained before a synchronous request
+	bool request(ReplayMessage& message)
+	{
+		drain();
+		if (m_failed || !ReplaySocket_send(m_socket, message) || !ReplaySocket_receive(m_socket, message))
+		{
+			m_failed = true;
+			return false;
+		}
+		return 0 != message.m_ok;
+	}
+	void receiveReply()
+	{
+		ReplayMessage reply;
+		if (m_failed || !ReplaySocket_receive(m_socket, reply))
+		{
+			m_failed = true;
+		}
+		--m_inFlight;
+	}
+	void drain()
+	{
+		while (m_inFlight > 0)
+		{
+			receiveReply();
+		}
+	}
+protected:
+	int m_socket{ -1 };
+	MappedFile m_ring;
+	uint32_t m_slotCount{ 0 };
+	uint64_t m_slotBytes{ 0 };
+	uint32_t m_maxCount{ 0 };
+	uint32_t m_nextSlot{ 0 };
+	uint32_t m_inFlight{ 0 };
+	bool m_failed{ false };
+};
+
+#endif
+
+END_RLTL_IMPL
@@ -0,0 +1,445 @@
+#pragma once
+#include "utility.h"
+#include "random.h"
+#include "neural_network.h"
+#include "chunked_array.h"
+#include "sum_tree.h"
+#include <deque>
+#include <cmath>
+#include <numeric>
+
+BEGIN_RLTL_IMPL
+
+//replay memory which stores every observation once instead of a state and a next state per transition.
+//each environment step takes one slot (state, action, reward), and the last observation of an episode takes one
+//more slot. every slot links to the next slot of its episode, so episodes of several environments (streams)
+//may interleave in the ring. the next state, the n-step return and the next discount of a transition are rebuilt
+//at sample time by following at most multiStep links, so multiStep can be changed without refilling the ring.
+//a step slot becomes sampleable once multiStep later observations of its episode are stored or the episode ends
+template<typename State_t, typename Action_t, typename Priority_t = float, typename PrioritySum_t = double, typename SumTree_t = PrioritySumTree<Priority_t, PrioritySum_t>>
+class SequentialTrajectoryBuffer
+{
+protected:
+	enum class SlotKind : uint8_t
+	{
+		empty,
+		pending,
+		ready,
+		terminated,
+		truncated,
+	};
+	static constexpr uint32_t t_none = UINT32_MAX;
+	struct SlotRef
+	{
+		uint32_t m_index;
+		uint64_t m_serial;
+	};
+	struct Stream
+	{
+		std::deque<SlotRef> m_pending;
+		SlotRef m_last{ t_none, 0 };
+	};
+public:
+	//in compound mode each sample draws its own depth in [1, multiStep], like storing every k-step transition
+	void initialize(
+		uint32_t capacity,
+		uint32_t multiStep,
+		bool multiStepCompound,
+		float discountRate,
+		bool needPriority)
+	{
+		if (needPriority)
+		{
+			capacity = SumTree_t::AlignCapacity(capacity);
+			m_sumTree.initialize(capacity);
+		}
+		m_capacity = capacity;
+		m_multiStepCompound = multiStepCompound;
+		m_discountRate = discountRate;
+		this->multiStep(multiStep);
+		m_states.initialize(capacity);
+		m_actions.initialize(capacity);
+		m_rewards.initialize(capacity);
+		m_nexts.initialize(capacity);
+		m_kinds.initialize(capacity);
+		m_serials.initialize(capacity);
+		m_streams.resize(1);
+	}
+	//one stream per environment, streams are independent episodes sharing the ring
+	void numStreams(size_t count)
+	{
+		m_streams.resize(count);
+	}
+	size_t numStreams() const
+	{
+		return m_streams.size();
+	}
+	//takes effect on the next sample. slots which became ready under a smaller n return a shorter window
+	//until their episode has stored enough later observations
+	void multiStep(uint32_t multiStep)
+	{
+		m_multiStep = std::max(multiStep, 1u);
+		m_discountPowers.resize(m_multiStep + 1);
+		m_discountPowers[0] = 1;
+		for (uint32_t i = 1; i <= m_multiStep; ++i)
+		{
+			m_discountPowers[i] = m_discountPowers[i - 1] * m_discountRate;
+		}
+		m_rewardWindow.resize(m_multiStep);
+	}
+	uint32_t multiStep() const
+	{
+		return m_multiStep;
+	}
+public:
+	//number of sampleable transitions
+	uint32_t size() const
+	{
+		return m_numReady;
+	}
+	uint32_t capacity() const
+	{
+		return m_capacity;
+	}
+	explicit operator bool() const
+	{
+		return 0 != m_capacity;
+	}
+	size_t allocatedBytes() const
+	{
+		return m_states.allocatedBytes() + m_actions.allocatedBytes() + m_rewards.allocatedBytes()
+			+ m_nexts.allocatedBytes() + m_kinds.allocatedBytes() + m_serials.allocatedBytes() + m_sumTree.allocatedBytes();
+	}
+	//forgets an episode of the stream that was abandoned without endEpisode, so the next append starts
+	//a new chain instead of linking onto it. its pending slots never become sampleable
+	void beginEpisode(size_t stream)
+	{
+		Stream& s = m_streams[stream];
+		s.m_pending.clear();
+		s.m_last = SlotRef{ t_none, 0 };
+	}
+	//state of the stream at this step, the action taken in it and the reward received for it
+	void append(size_t stream, const State_t& state, const Action_t& action, float reward)
+	{
+		Stream& s = m_streams[stream];
+		uint32_t index = write(state, action, reward, SlotKind::pending);
+		link(s, index);
+		s.m_pending.push_back(SlotRef{ index, m_serials[index] });
+		while (s.m_pending.size() > m_multiStep)
+		{
+			ready(s.m_pending.front());
+			s.m_pending.pop_front();
+		}
+	}
+	//last observation of the episode, nextAction is only read by sarsa targets
+	void endEpisode(size_t stream, const State_t& lastState, bool terminated, const Action_t& nextAction = Action_t())
+	{
+		Stream& s = m_streams[stream];
+		uint32_t index = write(lastState, nextAction, 0, terminated ? SlotKind::terminated : SlotKind::truncated);
+		link(s, index);
+		for (const SlotRef& ref : s.m_pending)
+		{
+			ready(ref);
+		}
+		s.m_pending.clear();
+		s.m_last = SlotRef{ t_none, 0 };
+	}
+public:
+	//for experience replay, not const as in TrajectoryBuffer: the reward window and the batch priorities are scratch members
+	void sample(
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		uint32_t batchSize)
+	{
+		assert(0 < batchSize && 0 < m_numReady);
+		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
+		auto rewards = rewardTensor.accessor<float, 2>();
+		auto nextStates = nextStateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto nextDiscounts = nextDiscountTensor.accessor<float, 2>();
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			uint32_t index = sampleUniform();
+			uint32_t nextIndex = rebuild(index, rewards[i][0], nextDiscounts[i][0]);
+			Tensor_Assign(states[i], m_states[index]);
+			Tensor_Assign(actions[i], m_actions[index]);
+			Tensor_Assign(nextStates[i], m_states[nextIndex]);
+		}
+	}
+
+	void sample(
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		Tensor& nextActionTensor,
+		uint32_t batchSize)
+	{
+		assert(0 < batchSize && 0 < m_numReady);
+		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
+		auto rewards = rewardTensor.accessor<float, 2>();
+		auto nextStates = nextStateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto nextDiscounts = nextDiscountTensor.accessor<float, 2>();
+		auto nextActions = nextActionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			uint32_t index = sampleUniform();
+			uint32_t nextIndex = rebuild(index, rewards[i][0], nextDiscounts[i][0]);
+			Tensor_Assign(states[i], m_states[index]);
+			Tensor_Assign(actions[i], m_actions[index]);
+			Tensor_Assign(nextStates[i], m_states[nextIndex]);
+			Tensor_Assign(nextActions[i], m_actions[nextIndex]);
+		}
+	}
+
+public:
+	//for prioritized experience replay
+	void sample(
+		std::vector<uint32_t>& indices,
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		Tensor& weightTensor,
+		uint32_t batchSize,
+		float prioritizedBeta)
+	{
+		assert(m_sumTree && 0 < batchSize && 0 < m_numReady);
+		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
+		auto rewards = rewardTensor.accessor<float, 2>();
+		auto nextStates = nextStateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto nextDiscounts = nextDiscountTensor.accessor<float, 2>();
+		samplePrioritizedBatch(indices, weightTensor, batchSize, prioritizedBeta);
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			uint32_t index = indices[i];
+			uint32_t nextIndex = rebuild(index, rewards[i][0], nextDiscounts[i][0]);
+			Tensor_Assign(states[i], m_states[index]);
+			Tensor_Assign(actions[i], m_actions[index]);
+			Tensor_Assign(nextStates[i], m_states[nextIndex]);
+		}
+	}
+
+	void sample(
+		std::vector<uint32_t>& indices,
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		Tensor& nextActionTensor,
+		Tensor& weightTensor,
+		uint32_t batchSize,
+		float prioritizedBeta)
+	{
+		assert(m_sumTree && 0 < batchSize && 0 < m_numReady);
+		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
+		auto rewards = rewardTensor.accessor<float, 2>();
+		auto nextStates = nextStateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
+		auto nextDiscounts = nextDiscountTensor.accessor<float, 2>();
+		auto nextActions = nextActionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
+		samplePrioritizedBatch(indices, weightTensor, batchSize, prioritizedBeta);
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			uint32_t index = indices[i];
+			uint32_t nextIndex = rebuild(index, rewards[i][0], nextDiscounts[i][0]);
+			Tensor_Assign(states[i], m_states[index]);
+			Tensor_Assign(actions[i], m_actions[index]);
+			Tensor_Assign(nextStates[i], m_states[nextIndex]);
+			Tensor_Assign(nextActions[i], m_actions[nextIndex]);
+		}
+	}
+
+	void updatePriorities(const std::vector<uint32_t>& indices, const Tensor& deltaTensor, uint32_t batchSize, float prioritizedAlpha, float prioritizedEpsilon)
+	{
+		assert(indices.size() >= batchSize);
+		NN_prioritiesFromDeltas(m_priorityTensor, deltaTensor, prioritizedAlpha, prioritizedEpsilon);
+		auto priorities = m_priorityTensor.accessor<float, 2>();
+		m_batchPriorities.resize(batchSize);
+		m_updateIndices.resize(batchSize);
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			//the slot may have been overwritten since it was sampled
+			if (SlotKind::ready == m_kinds[indices[i]])
+			{
+				m_updateIndices[count] = indices[i];
+				m_batchPriorities[count] = priorities[i][0];
+				++count;
+			}
+		}
+		m_sumTree.update(m_updateIndices.data(), m_batchPriorities.data(), count);
+	}
+	//as TrajectoryBuffer::serials, for batches whose priorities are updated several samples later
+	void serials(const std::vector<uint32_t>& indices, std::vector<uint64_t>& serials, uint32_t batchSize) const
+	{
+		serials.resize(batchSize);
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			serials[i] = m_serials[indices[i]];
+		}
+	}
+	void updatePriorities(const std::vector<uint32_t>& indices, const std::vector<uint64_t>& serials, const Tensor& deltaTensor, uint32_t batchSize, float prioritizedAlpha, float prioritizedEpsilon)
+	{
+		assert(indices.size() >= batchSize && serials.size() >= batchSize);
+		NN_prioritiesFromDeltas(m_priorityTensor, deltaTensor, prioritizedAlpha, prioritizedEpsilon);
+		auto priorities = m_priorityTensor.accessor<float, 2>();
+		m_batchPriorities.resize(batchSize);
+		m_updateIndices.resize(batchSize);
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			//a ready slot with another serial holds a newer transition which was not sampled
+			if (SlotKind::ready == m_kinds[indices[i]] && m_serials[indices[i]] == serials[i])
+			{
+				m_updateIndices[count] = indices[i];
+				m_batchPriorities[count] = priorities[i][0];
+				++count;
+			}
+		}
+		m_sumTree.update(m_updateIndices.data(), m_batchPriorities.data(), count);
+	}
+protected:
+	uint32_t write(const State_t& state, const Action_t& action, float reward, SlotKind kind)
+	{
+		uint32_t index = m_end;
+		if (SlotKind::ready == m_kinds[index])
+		{
+			--m_numReady;
+		}
+		if (m_sumTree)
+		{
+			m_sumTree.update(index, 0);
+		}
+		m_states[index] = state;
+		m_actions[index] = action;
+		m_rewards[index] = reward;
+		m_nexts[index] = t_none;
+		m_kinds[index] = kind;
+		m_serials[index] = ++m_serial;
+		m_end = (m_end + 1) % m_capacity;
+		if (m_filled < m_capacity)
+		{
+			++m_filled;
+		}
+		return index;
+	}
+	//links the previous slot of the stream to index, unless the ring has reused that slot meanwhile
+	void link(Stream& stream, uint32_t index)
+	{
+		if (t_none != stream.m_last.m_index && m_serials[stream.m_last.m_index] == stream.m_last.m_serial)
+		{
+			m_nexts[stream.m_last.m_index] = index;
+		}
+		stream.m_last = SlotRef{ index, m_serials[index] };
+	}
+	void ready(const SlotRef& ref)
+	{
+		if (m_serials[ref.m_index] != ref.m_serial || SlotKind::pending != m_kinds[ref.m_index])
+		{
+			return;
+		}
+		m_kinds[ref.m_index] = SlotKind::ready;
+		++m_numReady;
+		if (m_sumTree)
+		{
+			m_sumTree.update(ref.m_index, m_sumTree.maxPriority());
+		}
+	}
+	uint32_t sampleUniform() const
+	{
+		while (true)
+		{
+			uint32_t index = Random::randuint(m_filled);
+			if (SlotKind::ready == m_kinds[index])
+			{
+				return index;
+			}
+		}
+	}
+	//stratified batch as in TrajectoryBuffer, a draw which lands on a slot that is not ready is drawn again alone
+	void samplePrioritizedBatch(std::vector<uint32_t>& indices, Tensor& weightTensor, uint32_t batchSize, float prioritizedBeta)
+	{
+		assert(indices.size() >= batchSize);
+		m_batchPriorities.resize(batchSize);
+		m_sumTree.sample(indices.data(), m_batchPriorities.data(), batchSize, m_filled);
+		auto weights = weightTensor.accessor<float, 2>();
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			if (SlotKind::ready != m_kinds[indices[i]])
+			{
+				indices[i] = samplePrioritized();
+				m_batchPriorities[i] = m_sumTree.priority(indices[i]);
+			}
+			weights[i][0] = m_batchPriorities[i];
+		}
+		weightTensor.reciprocal_().mul_(m_sumTree.minPriority()).pow_(prioritizedBeta);
+	}
+	uint32_t samplePrioritized() const
+	{
+		//only ready slots carry priority, the loop only repeats on rounding at a zero leaf
+		while (true)
+		{
+			uint32_t index = m_sumTree.sample(m_filled);
+			if (SlotKind::ready == m_kinds[index])
+			{
+				return index;
+			}
+		}
+	}
+	//follows up to depth links from a ready slot, returns the slot of the next state.
+	//the rewards of the window are gathered first, the return is then their dot product with the discount powers.
+	//a missing link means the episode has not stored depth later observations yet, which happens after
+	//multiStep grew, the window then bootstraps from the latest stored observation
+	uint32_t rebuild(uint32_t index, float& reward, float& nextDiscount)
+	{
+		uint32_t depth = m_multiStepCompound ? 1 + Random::randuint(m_multiStep) : m_multiStep;
+		uint32_t count = 0;
+		uint32_t current = index;
+		while (count < depth && t_none != m_nexts[current])
+		{
+			m_rewardWindow[count++] = m_rewards[current];
+			current = m_nexts[current];
+			if (SlotKind::terminated == m_kinds[current] || SlotKind::truncated == m_kinds[current])
+			{
+				break;
+			}
+		}
+		assert(count > 0);
+		reward = std::inner_product(m_rewardWindow.begin(), m_rewardWindow.begin() + count, m_discountPowers.begin(), 0.0f);
+		nextDiscount = SlotKind::terminated == m_kinds[current] ? 0 : m_discountPowers[count];
+		return current;
+	}
+protected:
+	uint32_t m_capacity{ 0 };
+	uint32_t m_multiStep{ 1 };
+	bool m_multiStepCompound{ false };
+	float m_discountRate{ 1 };
+	uint32_t m_end{ 0 };
+	uint32_t m_filled{ 0 };
+	uint32_t m_numReady{ 0 };
+	uint64_t m_serial{ 0 };
+	ChunkedArray<State_t> m_states;
+	ChunkedArray<Action_t> m_actions;
+	ChunkedArray<float> m_rewards;
+	ChunkedArray<uint32_t> m_nexts;
+	ChunkedArray<SlotKind> m_kinds;
+	ChunkedArray<uint64_t> m_serials;
+	SumTree_t m_sumTree;
+	std::vector<float> m_discountPowers;
+	std::vector<float> m_rewardWindow;
+	std::vector<Priority_t> m_batchPriorities;
+	std::vector<uint32_t> m_updateIndices;
+	Tensor m_priorityTensor;
+	std::vector<Stream> m_streams;
+};
+
+END_RLTL_IMPL
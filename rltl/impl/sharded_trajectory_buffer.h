@@ -0,0 +1,457 @@
+#pragma once
+#include "trajectory_buffer.h"
+#include "replay_service.h"
+#include "thread_affinity.h"
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+
+BEGIN_RLTL_IMPL
+
+//replay memory split into shards with their own TrajectoryBuffer, sum tree and lock, so actors filling
+//different shards never share a cache line. each shard belongs to a numa node: it has a sampler thread
+//pinned there, and actors pinned with pinToShard() touch its storage first, which places it on that node.
+//a batch is split over the shards proportional to their priority totals (sizes without priorities),
+//then every shard samples its part on its own sampler thread in parallel.
+//append from any thread, sample and updatePriorities from one learner thread
+template<typename State_t, typename Action_t, typename Priority_t = float, typename PrioritySum_t = double, typename SumTree_t = PrioritySumTree<Priority_t, PrioritySum_t>>
+class ShardedTrajectoryBuffer : public ReplaySource<State_t, Action_t>
+{
+protected:
+	typedef TrajectoryBuffer<State_t, Action_t, Priority_t, PrioritySum_t, SumTree_t> Buffer_t;
+	struct Shard
+	{
+		Buffer_t m_buffer;
+		std::mutex m_mutex;
+		uint32_t m_node{};
+		std::thread m_thread;
+		//part of the current batch, written by the learner thread before the job is posted
+		uint32_t m_offset{};
+		uint32_t m_count{};
+		std::vector<uint32_t> m_indices;
+		std::vector<uint64_t> m_serials;
+	};
+	//output of the current batch, the shards write disjoint row ranges of it
+	struct SampleJob
+	{
+		std::vector<uint32_t>* m_indices{};
+		Tensor* m_stateTensor{};
+		Tensor* m_actionTensor{};
+		Tensor* m_rewardTensor{};
+		Tensor* m_nextStateTensor{};
+		Tensor* m_nextDiscountTensor{};
+		Tensor* m_nextActionTensor{};
+		Tensor* m_weightTensor{};
+		float m_prioritizedBeta{};
+		Priority_t m_minPriority{};
+	};
+public:
+	ShardedTrajectoryBuffer() = default;
+	ShardedTrajectoryBuffer(const ShardedTrajectoryBuffer&) = delete;
+	ShardedTrajectoryBuffer& operator=(const ShardedTrajectoryBuffer&) = delete;
+	~ShardedTrajectoryBuffer()
+	{
+		stop();
+	}
+public:
+	//capacity is split evenly, shard i lives on shardNodes[i] or on node i % Numa_nodeCount() if shardNodes is empty.
+	//every shard is initialized on a thread pinned to its node, so whatever initialize touches is local as well
+	void initialize(
+		uint32_t numShards,
+		uint32_t capacity,
+		bool needNextAction,
+		bool needPriority,
+		bool columnar = false,
+		const std::vector<uint32_t>& shardNodes = std::vector<uint32_t>())
+	{
+		assert(0 < numShards && numShards <= capacity);
+		assert(shardNodes.empty() || shardNodes.size() == numShards);
+		stop();
+		m_shards.clear();
+		m_needPriority = needPriority;
+		m_stop = false;
+		m_generation = 0;
+		m_remaining = 0;
+		uint32_t nodeCount = Numa_nodeCount();
+		uint32_t shardCapacity = (capacity + numShards - 1) / numShards;
+		//global indices are strided by the prioritized capacity, a power of two, and have to fit in 32 bits
+		if (needPriority && shardCapacity > (uint32_t(1) << 31))
+		{
+			throw std::length_error("the shards of a ShardedTrajectoryBuffer need global indices below 2^32");
+		}
+		uint32_t shardStride = needPriority ? SumTree_t::AlignCapacity(shardCapacity) : shardCapacity;
+		if (uint64_t(numShards) * shardStride > UINT32_MAX)
+		{
+			throw std::length_error("the shards of a ShardedTrajectoryBuffer need global indices below 2^32");
+		}
+		for (uint32_t i = 0; i < numShards; ++i)
+		{
+			m_shards.push_back(std::make_unique<Shard>());
+			m_shards[i]->m_node = shardNodes.empty() ? i % nodeCount : shardNodes[i];
+		}
+		for (uint32_t i = 0; i < numShards; ++i)
+		{
+			std::thread initializer([this, i, shardCapacity, needNextAction, needPriority, columnar]()
+				{
+					Thread_pinToNode(m_shards[i]->m_node);
+					m_shards[i]->m_buffer.initialize(shardCapacity, needNextAction, needPriority, columnar);
+				});
+			initializer.join();
+			m_shards[i]->m_thread = std::thread(&ShardedTrajectoryBuffer::run, this, i);
+		}
+		//the prioritized capacity is rounded up to a power of two, global indices are strided by it
+		m_shardCapacity = m_shards[0]->m_buffer.capacity();
+		assert(m_shardCapacity == shardStride);
+	}
+	//joins the sampler threads, the transitions stay
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_jobMutex);
+			m_stop = true;
+		}
+		m_jobCondition.notify_all();
+		for (auto& shard : m_shards)
+		{
+			if (shard->m_thread.joinable())
+			{
+				shard->m_thread.join();
+			}
+		}
+	}
+public:
+	uint32_t numShards() const
+	{
+		return uint32_t(m_shards.size());
+	}
+	uint32_t shardNode(uint32_t shard) const
+	{
+		return m_shards[shard]->m_node;
+	}
+	//shard an actor appends to, actors of one shard share its lock and its node
+	uint32_t shardOf(size_t actorIndex) const
+	{
+		return uint32_t(actorIndex % m_shards.size());
+	}
+	//pins the calling thread to the node of shard, returns false if pinning is not supported
+	bool pinToShard(uint32_t shard) const
+	{
+		return Thread_pinToNode(m_shards[shard]->m_node);
+	}
+	uint32_t size() override
+	{
+		uint32_t size = 0;
+		for (auto& shard : m_shards)
+		{
+			std::lock_guard<std::mutex> lock(shard->m_mutex);
+			size += shard->m_buffer.size();
+		}
+		return size;
+	}
+	uint32_t shardSize(uint32_t shard)
+	{
+		std::lock_guard<std::mutex> lock(m_shards[shard]->m_mutex);
+		return m_shards[shard]->m_buffer.size();
+	}
+public:
+	void append(uint32_t shard, const State_t& state, const Action_t& action, float reward, const State_t& nextState, float nextDiscount)
+	{
+		std::lock_guard<std::mutex> lock(m_shards[shard]->m_mutex);
+		m_shards[shard]->m_buffer.append(state, action, reward, nextState, nextDiscount);
+	}
+	void append(uint32_t shard, const State_t& state, const Action_t& action, float reward, const State_t& nextState, float nextDiscount, const Action_t& nextAction)
+	{
+		std::lock_guard<std::mutex> lock(m_shards[shard]->m_mutex);
+		m_shards[shard]->m_buffer.append(state, action, reward, nextState, nextDiscount, nextAction);
+	}
+	void append(uint32_t shard, const TransitionBatch<State_t, Action_t>& batch)
+	{
+		std::lock_guard<std::mutex> lock(m_shards[shard]->m_mutex);
+		m_shards[shard]->m_buffer.append(batch);
+	}
+public:
+	//for experience replay
+	bool sample(
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		uint32_t batchSize) override
+	{
+		SampleJob job;
+		setTensors(job, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor);
+		runJob(job, batchSize);
+		return true;
+	}
+	void sample(
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		Tensor& nextActionTensor,
+		uint32_t batchSize)
+	{
+		SampleJob job;
+		setTensors(job, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor);
+		job.m_nextActionTensor = &nextActionTensor;
+		runJob(job, batchSize);
+	}
+	//for prioritized experience replay, indices are global: shard * shard capacity + index in the shard.
+	//the weights are normalized by the smallest priority of all shards, not per shard
+	bool sample(
+		std::vector<uint32_t>& indices,
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		Tensor& weightTensor,
+		uint32_t batchSize,
+		float prioritizedBeta) override
+	{
+		assert(m_needPriority && indices.size() >= batchSize);
+		SampleJob job;
+		setTensors(job, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor);
+		job.m_indices = &indices;
+		job.m_weightTensor = &weightTensor;
+		job.m_prioritizedBeta = prioritizedBeta;
+		runJob(job, batchSize);
+		return true;
+	}
+	//taken by each shard under its lock while it sampled
+	void serials(const std::vector<uint32_t>& indices, std::vector<uint64_t>& serials, uint32_t batchSize) override
+	{
+		assert(m_needPriority && m_serials.size() >= batchSize);
+		serials.assign(m_serials.begin(), m_serials.begin() + batchSize);
+	}
+	void sample(
+		std::vector<uint32_t>& indices,
+		Tensor& stateTensor,
+		Tensor& actionTensor,
+		Tensor& rewardTensor,
+		Tensor& nextStateTensor,
+		Tensor& nextDiscountTensor,
+		Tensor& nextActionTensor,
+		Tensor& weightTensor,
+		uint32_t batchSize,
+		float prioritizedBeta)
+	{
+		assert(m_needPriority && indices.size() >= batchSize);
+		SampleJob job;
+		setTensors(job, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor);
+		job.m_indices = &indices;
+		job.m_nextActionTensor = &nextActionTensor;
+		job.m_weightTensor = &weightTensor;
+		job.m_prioritizedBeta = prioritizedBeta;
+		runJob(job, batchSize);
+	}
+	//the rows of one shard are contiguous in a sampled batch, each run is updated under its shard lock once
+	void updatePriorities(const std::vector<uint32_t>& indices, const Tensor& deltaTensor, uint32_t batchSize, float prioritizedAlpha, float prioritizedEpsilon) override
+	{
+		updateShards(indices, nullptr, deltaTensor, batchSize, prioritizedAlpha, prioritizedEpsilon);
+	}
+	//skips the slots an actor overwrote since the batch was sampled
+	void updatePriorities(const std::vector<uint32_t>& indices, const std::vector<uint64_t>& serials, const Tensor& deltaTensor, uint32_t batchSize, float prioritizedAlpha, float prioritizedEpsilon) override
+	{
+		updateShards(indices, serials.empty() ? nullptr : &serials, deltaTensor, batchSize, prioritizedAlpha, prioritizedEpsilon);
+	}
+protected:
+	void updateShards(const std::vector<uint32_t>& indices, const std::vector<uint64_t>* serials, const Tensor& deltaTensor, uint32_t batchSize, float prioritizedAlpha, float prioritizedEpsilon)
+	{
+		assert(m_needPriority && indices.size() >= batchSize && (!serials || serials->size() >= batchSize));
+		uint32_t begin = 0;
+		while (begin < batchSize)
+		{
+			uint32_t shard = indices[begin] / m_shardCapacity;
+			uint32_t end = begin + 1;
+			while (end < batchSize && indices[end] / m_shardCapacity == shard)
+			{
+				++end;
+			}
+			m_localIndices.resize(end - begin);
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				m_localIndices[i - begin] = indices[i] - shard * m_shardCapacity;
+			}
+			std::lock_guard<std::mutex> lock(m_shards[shard]->m_mutex);
+			if (serials)
+			{
+				m_localSerials.assign(serials->begin() + begin, serials->begin() + end);
+				m_shards[shard]->m_buffer.updatePriorities(m_localIndices, m_localSerials, deltaTensor.narrow(0, begin, end - begin), end - begin, prioritizedAlpha, prioritizedEpsilon);
+			}
+			else
+			{
+				m_shards[shard]->m_buffer.updatePriorities(m_localIndices, deltaTensor.narrow(0, begin, end - begin), end - begin, prioritizedAlpha, prioritizedEpsilon);
+			}
+			begin = end;
+		}
+	}
+	static void setTensors(SampleJob& job, Tensor& stateTensor, Tensor& actionTensor, Tensor& rewardTensor, Tensor& nextStateTensor, Tensor& nextDiscountTensor)
+	{
+		job.m_stateTensor = &stateTensor;
+		job.m_actionTensor = &actionTensor;
+		job.m_rewardTensor = &rewardTensor;
+		job.m_nextStateTensor = &nextStateTensor;
+		job.m_nextDiscountTensor = &nextDiscountTensor;
+	}
+	//systematic draw of the shard counts: one uniform offset, batchSize equally spaced points over the
+	//cumulative shard masses, so every shard gets its expected count rounded up or down
+	void splitBatch(SampleJob& job, uint32_t batchSize)
+	{
+		uint32_t numShards = uint32_t(m_shards.size());
+		m_masses.resize(numShards);
+		double total = 0;
+		job.m_minPriority = 0;
+		for (uint32_t i = 0; i < numShards; ++i)
+		{
+			Shard& shard = *m_shards[i];
+			std::lock_guard<std::mutex> lock(shard.m_mutex);
+			if (m_needPriority)
+			{
+				m_masses[i] = 0 == shard.m_buffer.size() ? 0 : double(shard.m_buffer.totalPriority());
+				Priority_t minPriority = shard.m_buffer.minPriority();
+				if (m_masses[i] > 0 && (0 == job.m_minPriority || minPriority < job.m_minPriority))
+				{
+					job.m_minPriority = minPriority;
+				}
+			}
+			else
+			{
+				m_masses[i] = double(shard.m_buffer.size());
+			}
+			total += m_masses[i];
+		}
+		assert(total > 0);
+		uint32_t lastShard = numShards - 1;
+		while (0 == m_masses[lastShard])
+		{
+			--lastShard;
+		}
+		double step = total / batchSize;
+		double point = Random::rand() * step;
+		double upper = 0;
+		uint32_t offset = 0;
+		for (uint32_t i = 0; i < numShards; ++i)
+		{
+			upper += m_masses[i];
+			uint32_t count = 0;
+			//the last shard with mass takes the points rounding may have pushed past the total
+			while (offset + count < batchSize && (point < upper || i == lastShard))
+			{
+				++count;
+				point += step;
+			}
+			m_shards[i]->m_offset = offset;
+			m_shards[i]->m_count = count;
+			offset += count;
+		}
+		assert(offset == batchSize);
+	}
+	void runJob(const SampleJob& job, uint32_t batchSize)
+	{
+		assert(0 < batchSize);
+		m_job = job;
+		if (job.m_indices)
+		{
+			m_serials.resize(batchSize);
+		}
+		splitBatch(m_job, batchSize);
+		std::unique_lock<std::mutex> lock(m_jobMutex);
+		m_remaining = uint32_t(m_shards.size());
+		++m_generation;
+		m_jobCondition.notify_all();
+		m_doneCondition.wait(lock, [this]() { return 0 == m_remaining; });
+	}
+	void run(uint32_t index)
+	{
+		Shard& shard = *m_shards[index];
+		Thread_pinToNode(shard.m_node);
+		Random::seedThread(RandomStream::replay_shard, index);
+		uint64_t generation = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_jobMutex);
+				m_jobCondition.wait(lock, [this, generation]() { return m_stop || m_generation != generation; });
+				if (m_stop)
+				{
+					return;
+				}
+				generation = m_generation;
+			}
+			if (shard.m_count > 0)
+			{
+				sampleShard(index);
+			}
+			{
+				std::lock_guard<std::mutex> lock(m_jobMutex);
+				--m_remaining;
+			}
+			m_doneCondition.notify_one();
+		}
+	}
+	void sampleShard(uint32_t index)
+	{
+		Shard& shard = *m_shards[index];
+		uint32_t count = shard.m_count;
+		Tensor stateTensor = m_job.m_stateTensor->narrow(0, shard.m_offset, count);
+		Tensor actionTensor = m_job.m_actionTensor->narrow(0, shard.m_offset, count);
+		Tensor rewardTensor = m_job.m_rewardTensor->narrow(0, shard.m_offset, count);
+		Tensor nextStateTensor = m_job.m_nextStateTensor->narrow(0, shard.m_offset, count);
+		Tensor nextDiscountTensor = m_job.m_nextDiscountTensor->narrow(0, shard.m_offset, count);
+		Tensor nextActionTensor = m_job.m_nextActionTensor ? m_job.m_nextActionTensor->narrow(0, shard.m_offset, count) : Tensor();
+		std::lock_guard<std::mutex> lock(shard.m_mutex);
+		if (!m_job.m_weightTensor)
+		{
+			if (m_job.m_nextActionTensor)
+			{
+				shard.m_buffer.sample(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, nextActionTensor, count);
+			}
+			else
+			{
+				shard.m_buffer.sample(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, count);
+			}
+			return;
+		}
+		Tensor weightTensor = m_job.m_weightTensor->narrow(0, shard.m_offset, count);
+		shard.m_indices.resize(count);
+		if (m_job.m_nextActionTensor)
+		{
+			shard.m_buffer.sample(shard.m_indices, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, nextActionTensor, weightTensor, count, m_job.m_prioritizedBeta);
+		}
+		else
+		{
+			shard.m_buffer.sample(shard.m_indices, stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor, weightTensor, count, m_job.m_prioritizedBeta);
+		}
+		shard.m_buffer.serials(shard.m_indices, shard.m_serials, count);
+		//the shard normalized by its own smallest priority, rescale to the smallest of all shards
+		weightTensor.mul_(std::pow(float(m_job.m_minPriority / shard.m_buffer.minPriority()), m_job.m_prioritizedBeta));
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			(*m_job.m_indices)[shard.m_offset + i] = index * m_shardCapacity + shard.m_indices[i];
+			m_serials[shard.m_offset + i] = shard.m_serials[i];
+		}
+	}
+protected:
+	std::vector<std::unique_ptr<Shard>> m_shards;
+	uint32_t m_shardCapacity{};
+	bool m_needPriority{};
+	SampleJob m_job;
+	std::vector<double> m_masses;
+	std::vector<uint32_t> m_localIndices;
+	std::vector<uint64_t> m_localSerials;
+	std::vector<uint64_t> m_serials;//of the last prioritized batch, the shards write disjoint ranges
+	std::mutex m_jobMutex;
+	std::condition_variable m_jobCondition;
+	std::condition_variable m_doneCondition;
+	uint64_t m_generation{};
+	uint32_t m_remaining{};
+	bool m_stop{};
+};
+
+END_RLTL_IMPL
@@ -0,0 +1,547 @@
+#pragma once
+#include "utility.h"
+#include "random.h"
+#include "chunked_array.h"
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+#include <bitset>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+BEGIN_RLTL_IMPL
+
+//smaller of two priorities where zero means no priority
+template<typename Priority_t>
+inline Priority_t SumTree_MinPositive(Priority_t a, Priority_t b)
+{
+	if (a <= 0)
+	{
+		return b;
+	}
+	return b <= 0 || a < b ? a : b;
+}
+
+//binary sum tree over the priorities of a replay buffer, the inner nodes are stored in heap order
+//in m_sums (root at 0) and the leaves in m_priorities. capacity must be a power of two.
+//m_mins is a min tree over the positive priorities in the same layout, updated in the same pass,
+//so the minimum follows overwritten and lowered priorities instead of only ever decreasing
+template<typename Priority_t = float, typename PrioritySum_t = double>
+class PrioritySumTree
+{
+public:
+	void initialize(uint32_t capacity)
+	{
+		assert(capacity >= 2 && 0 == (capacity & (capacity - 1)));
+		m_capacity = capacity;
+		m_priorities.initialize(capacity);
+		m_sums.initialize(capacity - 1);
+		m_mins.initialize(capacity - 1);
+		m_maxPriority = 1.0f;
+	}
+	static uint32_t AlignCapacity(uint32_t capacity)
+	{
+		uint32_t alignedCapacity = 2;
+		while (alignedCapacity < capacity)
+		{
+			alignedCapacity *= 2;
+		}
+		return alignedCapacity;
+	}
+public:
+	//a zero priority removes the leaf from sampling and from the min priority
+	void update(size_t index, Priority_t priority)
+	{
+		m_priorities[index] = priority;
+		updateSums(index);
+		if (m_maxPriority < priority)
+		{
+			m_maxPriority = priority;
+		}
+	}
+	//bulk update: the leaves are written in batch order, so the last priority of a repeated index wins,
+	//then each dirty inner node is recomputed once, level by level from the leaves up
+	void update(const uint32_t* indices, const Priority_t* priorities, uint32_t count)
+	{
+		if (0 == count)
+		{
+			return;
+		}
+		m_dirty.resize(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			m_priorities[indices[i]] = priorities[i];
+			if (m_maxPriority < priorities[i])
+			{
+				m_maxPriority = priorities[i];
+			}
+			m_dirty[i] = (indices[i] + m_capacity) / 2 - 1;
+		}
+		//batches from the stratified sample are already in order
+		if (!std::is_sorted(m_dirty.begin(), m_dirty.end()))
+		{
+			std::sort(m_dirty.begin(), m_dirty.end());
+		}
+		m_dirty.erase(std::unique(m_dirty.begin(), m_dirty.end()), m_dirty.end());
+		for (uint32_t node : m_dirty)
+		{
+			size_t leaf = node * 2 + 2 - m_capacity;
+			m_sums[node] = m_priorities[leaf] + m_priorities[leaf + 1];
+			m_mins[node] = SumTree_MinPositive(m_priorities[leaf], m_priorities[leaf + 1]);
+		}
+		//all dirty nodes stay on one level and in order, so parents only repeat next to each other
+		while (0 != m_dirty[0])
+		{
+			size_t parents = 0;
+			for (uint32_t node : m_dirty)
+			{
+				uint32_t parent = (node - 1) / 2;
+				if (0 == parents || m_dirty[parents - 1] != parent)
+				{
+					m_dirty[parents++] = parent;
+				}
+			}
+			m_dirty.resize(parents);
+			for (uint32_t node : m_dirty)
+			{
+				m_sums[node] = m_sums[node * 2 + 1] + m_sums[node * 2 + 2];
+				m_mins[node] = SumTree_MinPositive(m_mins[node * 2 + 1], m_mins[node * 2 + 2]);
+			}
+		}
+	}
+	//leaf whose prefix sum range contains a uniform draw over the total priority, clipped to size - 1
+	uint32_t sample(uint32_t size) const
+	{
+		return find(Random::rand() * m_sums[0], size);
+	}
+	uint32_t find(PrioritySum_t priority, uint32_t size) const
+	{
+		uint32_t leftNode = 1;
+		while (leftNode < m_capacity - 1)
+		{
+			if (m_sums[leftNode] > priority)
+			{
+				leftNode = leftNode * 2 + 1;
+			}
+			else
+			{
+				priority -= m_sums[leftNode];
+				leftNode = (leftNode + 1) * 2 + 1;
+			}
+		}
+		leftNode -= (m_capacity - 1);
+		uint32_t index = m_priorities[leftNode] > priority ? leftNode : leftNode + 1;
+		if (index >= size)
+		{
+			index = size - 1;
+		}
+		return index;
+	}
+	//stratified batch: the total priority is split into count equal segments with one uniform draw in each.
+	//the targets ascend, so all descents advance one level at a time and neighbouring targets reuse the
+	//node just read. indices come out sorted, priorities receives the priority of each sampled leaf.
+	//not const: the targets are scratch kept in m_targets, so one tree must not be batch sampled from two threads
+	void sample(uint32_t* indices, Priority_t* priorities, uint32_t count, uint32_t size)
+	{
+		assert(0 < count && 0 < size);
+		m_targets.resize(count);
+		PrioritySum_t segment = m_sums[0] / count;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			m_targets[i] = (i + Random::rand()) * segment;
+			indices[i] = 0;
+		}
+		uint32_t innerNodes = m_capacity - 1;
+		for (uint32_t levelSize = 1; levelSize < m_capacity; levelSize *= 2)
+		{
+			bool leafLevel = levelSize * 2 == m_capacity;
+			uint32_t lastLeft = UINT32_MAX;
+			PrioritySum_t leftSum = 0;
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				uint32_t left = indices[i] * 2 + 1;
+				if (left != lastLeft)
+				{
+					lastLeft = left;
+					leftSum = leafLevel ? PrioritySum_t(m_priorities[left - innerNodes]) : m_sums[left];
+				}
+				if (leftSum > m_targets[i])
+				{
+					indices[i] = left;
+				}
+				else
+				{
+					m_targets[i] -= leftSum;
+					indices[i] = left + 1;
+				}
+			}
+		}
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint32_t index = indices[i] - innerNodes;
+			if (index >= size)
+			{
+				index = size - 1;
+			}
+			indices[i] = index;
+			priorities[i] = m_priorities[index];
+		}
+	}
+	//importance sampling weight of a sampled leaf, normalized by the smallest priority
+	float weight(size_t index, float prioritizedBeta) const
+	{
+		return std::pow(minPriority() / m_priorities[index], prioritizedBeta);
+	}
+public:
+	uint32_t capacity() const
+	{
+		return m_capacity;
+	}
+	Priority_t priority(size_t index) const
+	{
+		return m_priorities[index];
+	}
+	PrioritySum_t total() const
+	{
+		return m_sums[0];
+	}
+	//smallest positive priority, zero if there is none
+	Priority_t minPriority() const
+	{
+		return m_mins[0];
+	}
+	Priority_t maxPriority() const
+	{
+		return m_maxPriority;
+	}
+	size_t allocatedBytes() const
+	{
+		return m_priorities.allocatedBytes() + m_sums.allocatedBytes() + m_mins.allocatedBytes();
+	}
+	explicit operator bool() const
+	{
+		return 0 != m_capacity;
+	}
+protected:
+	void updateSums(size_t index)
+	{
+		size_t parent = (index + m_capacity) / 2 - 1;
+		m_sums[parent] = m_priorities[index] + m_priorities[index ^ 1];
+		m_mins[parent] = SumTree_MinPositive(m_priorities[index], m_priorities[index ^ 1]);
+		while (parent)
+		{
+			parent = (parent - 1) / 2;
+			m_sums[parent] = m_sums[parent * 2 + 1] + m_sums[parent * 2 + 2];
+			m_mins[parent] = SumTree_MinPositive(m_mins[parent * 2 + 1], m_mins[parent * 2 + 2]);
+			assert(m_sums[parent] >= m_sums[parent * 2 + 1] && m_sums[parent] >= m_sums[parent * 2 + 2]);
+		}
+	}
+protected:
+	uint32_t m_capacity{ 0 };
+	ChunkedArray<Priority_t> m_priorities;
+	ChunkedArray<PrioritySum_t> m_sums;
+	ChunkedArray<Priority_t> m_mins;
+	Priority_t m_maxPriority{ 1.0f };
+	std::vector<PrioritySum_t> m_targets;
+	std::vector<uint32_t> m_dirty;
+};
+
+//sum tree with t_fanout children per node, the child sums of a node are packed into one cache line
+//(8 doubles) so a descent or an update touches one line per level and the depth is log(capacity) / log(t_fanout).
+//the leaves are the priorities themselves, any capacity is accepted and the unused tail leaves stay zero.
+//child selection is a prefix sum and compare over the node, with AVX2 for 8 double sums when available.
+//the min tree has the same shape with t_fanout child minimums per node, kept out of the sum line
+template<typename Priority_t = float, typename PrioritySum_t = double, uint32_t t_fanout = 8>
+class WidePrioritySumTree
+{
+public:
+	static_assert(t_fanout >= 2 && 0 == (t_fanout & (t_fanout - 1)));
+	struct alignas(64) Node
+	{
+		PrioritySum_t m_sums[t_fanout];
+	};
+	struct MinNode
+	{
+		Priority_t m_mins[t_fanout];
+	};
+public:
+	void initialize(uint32_t capacity)
+	{
+		assert(capacity >= 1);
+		m_capacity = capacity;
+		//at least one level of nodes above the leaves
+		m_depth = 2;
+		uint64_t leafCapacity = t_fanout * t_fanout;
+		while (leafCapacity < capacity)
+		{
+			leafCapacity *= t_fanout;
+			++m_depth;
+		}
+		m_innerNodes = uint32_t((leafCapacity / t_fanout - 1) / (t_fanout - 1));
+		m_priorities.initialize(leafCapacity);
+		m_nodes.initialize(m_innerNodes);
+		m_minNodes.initialize(m_innerNodes);
+		m_total = 0;
+		m_minPriority = 0;
+		m_maxPriority = 1.0f;
+	}
+	static uint32_t AlignCapacity(uint32_t capacity)
+	{
+		return capacity;
+	}
+public:
+	void update(size_t index, Priority_t priority)
+	{
+		m_priorities[index] = priority;
+		updateSums(index);
+		if (m_maxPriority < priority)
+		{
+			m_maxPriority = priority;
+		}
+	}
+	//bulk update with the same contract as PrioritySumTree::update
+	void update(const uint32_t* indices, const Priority_t* priorities, uint32_t count)
+	{
+		if (0 == count)
+		{
+			return;
+		}
+		//leaf blocks are numbered as the nodes below the last inner level
+		m_dirty.resize(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			m_priorities[indices[i]] = priorities[i];
+			if (m_maxPriority < priorities[i])
+			{
+				m_maxPriority = priorities[i];
+			}
+			m_dirty[i] = m_innerNodes + indices[i] / t_fanout;
+		}
+		//batches from the stratified sample are already in order
+		if (!std::is_sorted(m_dirty.begin(), m_dirty.end()))
+		{
+			std::sort(m_dirty.begin(), m_dirty.end());
+		}
+		m_dirty.erase(std::unique(m_dirty.begin(), m_dirty.end()), m_dirty.end());
+		bool leafLevel = true;
+		while (true)
+		{
+			size_t parents = 0;
+			for (uint32_t node : m_dirty)
+			{
+				PrioritySum_t sum = 0;
+				Priority_t min = 0;
+				for (uint32_t i = 0; i < t_fanout; ++i)
+				{
+					if (leafLevel)
+					{
+						Priority_t priority = m_priorities[size_t(node - m_innerNodes) * t_fanout + i];
+						sum += priority;
+						min = SumTree_MinPositive(min, priority);
+					}
+					else
+					{
+						sum += m_nodes[node].m_sums[i];
+						min = SumTree_MinPositive(min, m_minNodes[node].m_mins[i]);
+					}
+				}
+				if (0 == node)
+				{
+					m_total = sum;
+					m_minPriority = min;
+					return;
+				}
+				uint32_t parent = (node - 1) / t_fanout;
+				m_nodes[parent].m_sums[(node - 1) % t_fanout] = sum;
+				m_minNodes[parent].m_mins[(node - 1) % t_fanout] = min;
+				if (0 == parents || m_dirty[parents - 1] != parent)
+				{
+					m_dirty[parents++] = parent;
+				}
+			}
+			m_dirty.resize(parents);
+			leafLevel = false;
+		}
+	}
+	uint32_t sample(uint32_t size) const
+	{
+		return find(Random::rand() * m_total, size);
+	}
+	uint32_t find(PrioritySum_t priority, uint32_t size) const
+	{
+		uint32_t node = 0;
+		for (uint32_t level = 0; level + 1 < m_depth; ++level)
+		{
+			node = node * t_fanout + 1 + SelectChild(m_nodes[node].m_sums, priority);
+		}
+		uint32_t index = leafIndex(node - m_innerNodes, priority);
+		return index < size ? index : size - 1;
+	}
+	//stratified batch with the same contract as PrioritySumTree::sample
+	void sample(uint32_t* indices, Priority_t* priorities, uint32_t count, uint32_t size)
+	{
+		assert(0 < count && 0 < size);
+		m_targets.resize(count);
+		PrioritySum_t segment = m_total / count;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			m_targets[i] = (i + Random::rand()) * segment;
+			indices[i] = 0;
+		}
+		for (uint32_t level = 0; level + 1 < m_depth; ++level)
+		{
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				indices[i] = indices[i] * t_fanout + 1 + SelectChild(m_nodes[indices[i]].m_sums, m_targets[i]);
+			}
+		}
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint32_t index = leafIndex(indices[i] - m_innerNodes, m_targets[i]);
+			if (index >= size)
+			{
+				index = size - 1;
+			}
+			indices[i] = index;
+			priorities[i] = m_priorities[index];
+		}
+	}
+	float weight(size_t index, float prioritizedBeta) const
+	{
+		return std::pow(m_minPriority / m_priorities[index], prioritizedBeta);
+	}
+public:
+	uint32_t capacity() const
+	{
+		return m_capacity;
+	}
+	Priority_t priority(size_t index) const
+	{
+		return m_priorities[index];
+	}
+	PrioritySum_t total() const
+	{
+		return m_total;
+	}
+	//smallest positive priority, zero if there is none
+	Priority_t minPriority() const
+	{
+		return m_minPriority;
+	}
+	Priority_t maxPriority() const
+	{
+		return m_maxPriority;
+	}
+	uint32_t depth() const
+	{
+		return m_depth;
+	}
+	size_t allocatedBytes() const
+	{
+		return m_priorities.allocatedBytes() + m_nodes.allocatedBytes() + m_minNodes.allocatedBytes();
+	}
+	explicit operator bool() const
+	{
+		return 0 != m_capacity;
+	}
+protected:
+	//index of the first child whose prefix sum exceeds target, target is reduced by the sums before it.
+	//a target at or past the total selects the last child
+	static uint32_t SelectChild(const PrioritySum_t* sums, PrioritySum_t& target)
+	{
+#ifdef __AVX2__
+		if constexpr (8 == t_fanout && std::is_same_v<PrioritySum_t, double>)
+		{
+			__m256d zero = _mm256_setzero_pd();
+			__m256d low = _mm256_load_pd(sums);
+			__m256d high = _mm256_load_pd(sums + 4);
+			low = _mm256_add_pd(low, _mm256_blend_pd(_mm256_permute4x64_pd(low, 0x90), zero, 0x1));
+			low = _mm256_add_pd(low, _mm256_blend_pd(_mm256_permute4x64_pd(low, 0x40), zero, 0x3));
+			high = _mm256_add_pd(high, _mm256_blend_pd(_mm256_permute4x64_pd(high, 0x90), zero, 0x1));
+			high = _mm256_add_pd(high, _mm256_blend_pd(_mm256_permute4x64_pd(high, 0x40), zero, 0x3));
+			high = _mm256_add_pd(high, _mm256_permute4x64_pd(low, 0xff));
+			__m256d value = _mm256_set1_pd(target);
+			int mask = _mm256_movemask_pd(_mm256_cmp_pd(low, value, _CMP_LE_OQ))
+				| (_mm256_movemask_pd(_mm256_cmp_pd(high, value, _CMP_LE_OQ)) << 4);
+			uint32_t child = std::min<uint32_t>(uint32_t(std::bitset<8>(mask).count()), t_fanout - 1);
+			if (child > 0)
+			{
+				alignas(32) double prefix[t_fanout];
+				_mm256_store_pd(prefix, low);
+				_mm256_store_pd(prefix + 4, high);
+				target -= prefix[child - 1];
+			}
+			return child;
+		}
+#endif
+		PrioritySum_t prefix[t_fanout + 1];
+		prefix[0] = 0;
+		uint32_t child = 0;
+		for (uint32_t i = 0; i < t_fanout; ++i)
+		{
+			prefix[i + 1] = prefix[i] + sums[i];
+			child += prefix[i + 1] <= target;
+		}
+		child = child < t_fanout - 1 ? child : t_fanout - 1;
+		target -= prefix[child];
+		return child;
+	}
+	uint32_t leafIndex(uint32_t block, PrioritySum_t target) const
+	{
+		alignas(64) PrioritySum_t sums[t_fanout];
+		size_t first = size_t(block) * t_fanout;
+		for (uint32_t i = 0; i < t_fanout; ++i)
+		{
+			sums[i] = m_priorities[first + i];
+		}
+		return uint32_t(first + SelectChild(sums, target));
+	}
+	void updateSums(size_t index)
+	{
+		size_t first = index & ~size_t(t_fanout - 1);
+		PrioritySum_t sum = 0;
+		Priority_t min = 0;
+		for (uint32_t i = 0; i < t_fanout; ++i)
+		{
+			Priority_t priority = m_priorities[first + i];
+			sum += priority;
+			min = SumTree_MinPositive(min, priority);
+		}
+		size_t node = m_innerNodes + index / t_fanout;
+		while (node > 0)
+		{
+			size_t parent = (node - 1) / t_fanout;
+			size_t child = (node - 1) % t_fanout;
+			Node& parentNode = m_nodes[parent];
+			MinNode& parentMinNode = m_minNodes[parent];
+			parentNode.m_sums[child] = sum;
+			parentMinNode.m_mins[child] = min;
+			sum = 0;
+			min = 0;
+			for (uint32_t i = 0; i < t_fanout; ++i)
+			{
+				sum += parentNode.m_sums[i];
+				min = SumTree_MinPositive(min, parentMinNode.m_mins[i]);
+			}
+			node = parent;
+		}
+		m_total = sum;
+		m_minPriority = min;
+	}
+protected:
+	uint32_t m_capacity{ 0 };
+	uint32_t m_depth{ 0 };
+	uint32_t m_innerNodes{ 0 };
+	ChunkedArray<Priority_t> m_priorities;
+	ChunkedArray<Node, 10> m_nodes;
+	ChunkedArray<MinNode, 10> m_minNodes;
+	PrioritySum_t m_total{ 0 };
+	Priority_t m_minPriority{ 0 };
+	Priority_t m_maxPriority{ 1.0f };
+	std::vector<PrioritySum_t> m_targets;
+	std::vector<uint32_t> m_dirty;
+};
+
+END_RLTL_IMPL
@@ -0,0 +1,133 @@
+#pragma once
+#include "utility.h"
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+BEGIN_RLTL_IMPL
+
+//numa nodes and thread pinning without libnuma: windows numa api, linux sysfs and pthread affinity.
+//memory follows the first touch on both, so a buffer filled by threads pinned to a node lives on that node
+
+#ifndef _WIN32
+//"0-3,8,10-11" as in /sys/devices/system/node/node*/cpulist
+inline std::vector<uint32_t> Numa_parseCpuList(const std::string& cpuList)
+{
+	std::vector<uint32_t> cpus;
+	size_t pos = 0;
+	while (pos < cpuList.size())
+	{
+		size_t end = cpuList.find(',', pos);
+		if (std::string::npos == end)
+		{
+			end = cpuList.size();
+		}
+		std::string range = cpuList.substr(pos, end - pos);
+		size_t dash = range.find('-');
+		if (!range.empty() && range[0] >= '0' && range[0] <= '9')
+		{
+			uint32_t first = uint32_t(std::stoul(range));
+			uint32_t last = std::string::npos == dash ? first : uint32_t(std::stoul(range.substr(dash + 1)));
+			for (uint32_t cpu = first; cpu <= last; ++cpu)
+			{
+				cpus.push_back(cpu);
+			}
+		}
+		pos = end + 1;
+	}
+	return cpus;
+}
+
+//empty if the node does not exist or sysfs is not mounted
+inline std::vector<uint32_t> Numa_nodeCpus(uint32_t node)
+{
+	std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+	std::string cpuList;
+	if (!file || !std::getline(file, cpuList))
+	{
+		return std::vector<uint32_t>();
+	}
+	return Numa_parseCpuList(cpuList);
+}
+#endif
+
+//at least 1, nodes are numbered from 0
+inline uint32_t Numa_nodeCount()
+{
+#ifdef _WIN32
+	ULONG highestNode = 0;
+	if (!GetNumaHighestNodeNumber(&highestNode))
+	{
+		return 1;
+	}
+	return uint32_t(highestNode) + 1;
+#else
+	uint32_t count = 0;
+	while (!Numa_nodeCpus(count).empty())
+	{
+		++count;
+	}
+	return count > 0 ? count : 1;
+#endif
+}
+
+//restricts the calling thread to the cpus of node, returns false if that is not possible
+inline bool Thread_pinToNode(uint32_t node)
+{
+#ifdef _WIN32
+	GROUP_AFFINITY affinity{};
+	if (!GetNumaNodeProcessorMaskEx(USHORT(node), &affinity) || 0 == affinity.Mask)
+	{
+		return false;
+	}
+	return 0 != SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+#else
+	std::vector<uint32_t> cpus = Numa_nodeCpus(node);
+	if (cpus.empty())
+	{
+		return false;
+	}
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	for (uint32_t cpu : cpus)
+	{
+		if (cpu < CPU_SETSIZE)
+		{
+			CPU_SET(cpu, &cpuSet);
+		}
+	}
+	return 0 == pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+}
+
+//restricts the calling thread to one cpu, on windows only the first 64 cpus of the current group
+inline bool Thread_pinToCpu(uint32_t cpu)
+{
+#ifdef _WIN32
+	if (cpu >= sizeof(DWORD_PTR) * 8)
+	{
+		return false;
+	}
+	return 0 != SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+#else
+	if (cpu >= CPU_SETSIZE)
+	{
+		return false;
+	}
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(cpu, &cpuSet);
+	return 0 == pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+}
+
+END_RLTL_IMPL
@@ -1,8 +1,51 @@
 #pragma once
 #include "utility.h"
+#include "vector_environment.h"
+#include "async_environment_pool.h"
+#include "../arg.h"
+#include <chrono>
+#include <algorithm>
 
 BEGIN_RLTL_IMPL
 
+//0 disables a budget, training stops at whichever enabled budget runs out first
+struct TrainBudget
+{
+	TrainBudget()
+	{
+		m_maxSteps = 0;
+		m_maxSeconds = 0;
+		m_maxUpdates = 0;
+	}
+public:
+	bool unlimited() const
+	{
+		return 0 == m_maxSteps && m_maxSeconds <= 0 && 0 == m_maxUpdates;
+	}
+public:
+	RLTL_ARG(uint64_t, maxSteps);
+	RLTL_ARG(double, maxSeconds);
+	RLTL_ARG(uint64_t, maxUpdates);
+};
+
+struct TrainStats
+{
+public:
+	double stepsPerSecond() const
+	{
+		return m_seconds > 0 ? double(m_numSteps) / m_seconds : 0;
+	}
+	double updatesPerSecond() const
+	{
+		return m_seconds > 0 ? double(m_numUpdates) / m_seconds : 0;
+	}
+public:
+	uint64_t m_numSteps;
+	uint32_t m_numEpisodes;
+	uint64_t m_numUpdates;
+	double m_seconds;
+};
+
 template<typename State_t, typename Action_t>
 class Trainer
 {
@@ -11,6 +54,8 @@ public:
 	typedef Action_t Action_t;
 	typedef Agent<State_t, Action_t> Agent_t;
 	typedef Environment<State_t, Action_t> Environment_t;
+	typedef VectorEnvironment<State_t, Action_t> VectorEnvironment_t;
+	typedef AsyncEnvironmentPool<State_t, Action_t> AsyncEnvironmentPool_t;
 public:
 	static void TrainEpisodes(Agent_t* agent, Environment_t* environment, uint32_t numEpisodes, Callback* callback)
 	{
@@ -71,17 +116,208 @@ public:
 		}
 	}
 
-	static void TrainSteps(Agent_t* agent, Environment_t* environment, uint64_t maxSteps, Callback* callback)
+	//steps all environments of the vector environment together, the agent takes the actions of all slots in one call
+	static void TrainVectorEpisodes(Agent_t* agent, VectorEnvironment_t* environment, uint32_t numEpisodes, Callback* callback)
 	{
-		if (nullptr == agent || nullptr == environment || 0 == maxSteps)
+		if (callback)
+		{
+			callback->beginTrain();
+		}
+		size_t count = environment->size();
+		std::vector<State_t> states;
+		std::vector<State_t> nextStates;
+		std::vector<State_t> resetStates;
+		std::vector<Action_t> actions;
+		std::vector<float> rewards;
+		std::vector<EnvironmentStatus> envStatuses;
+		std::vector<uint32_t> episodes(count);
+		std::vector<uint32_t> numSteps(count, 0);
+		std::vector<float> totalRewards(count, 0);
+		uint32_t numStartedEpisodes = 0;
+		uint32_t numFinishedEpisodes = 0;
+		for (size_t i = 0; i < count; ++i)
 		{
-			return;
+			episodes[i] = numStartedEpisodes++;
+			if (callback)
+			{
+				callback->beginEpisode(episodes[i]);
+				callback->beginStep(episodes[i], 0);
+			}
+		}
+		environment->reset(states);
+		agent->firstSteps(actions, states);
+		while (numFinishedEpisodes < numEpisodes)
+		{
+			environment->step(rewards, nextStates, envStatuses, resetStates, actions);
+			agent->nextSteps(actions, rewards, nextStates, envStatuses, resetStates);
+			for (size_t i = 0; i < count; ++i)
+			{
+				++numSteps[i];
+				totalRewards[i] += rewards[i];
+				if (callback)
+				{
+					callback->endStep(episodes[i], numSteps[i], rewards[i]);
+				}
+				if (EnvironmentStatus::es_normal == envStatuses[i])
+				{
+					if (callback)
+					{
+						callback->beginStep(episodes[i], numSteps[i] + 1);
+					}
+				}
+				else
+				{
+					if (callback)
+					{
+						callback->endEpisode(episodes[i], numSteps[i], totalRewards[i]);
+					}
+					++numFinishedEpisodes;
+					episodes[i] = numStartedEpisodes++;
+					numSteps[i] = 0;
+					totalRewards[i] = 0;
+					if (callback)
+					{
+						callback->beginEpisode(episodes[i]);
+						callback->beginStep(episodes[i], 0);
+					}
+				}
+			}
+		}
+		if (callback)
+		{
+			callback->endTrain();
+		}
+	}
+
+	//agents[i] acts in environment i of the pool, an agent is stepped as soon as its environment has finished
+	//so slow environments do not hold up the others, all agents run on the calling thread.
+	//an agent given for several environments drives them as separate slots through beginSlotSteps/firstSlotStep/nextSlotStep,
+	//each slot keeps its own episode while the agent learns from all of them
+	static void TrainAsyncEpisodes(const std::vector<Agent_t*>& agents, AsyncEnvironmentPool_t* environment, uint32_t numEpisodes, Callback* callback)
+	{
+		size_t count = environment->size();
+		assert(agents.size() == count);
+		//the slot of environment i is its index among the environments of the same agent
+		std::vector<size_t> slots(count, 0);
+		for (size_t i = 0; i < count; ++i)
+		{
+			for (size_t j = 0; j < i; ++j)
+			{
+				if (agents[j] == agents[i])
+				{
+					++slots[i];
+				}
+			}
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (0 == slots[i])
+			{
+				size_t numSlots = std::count(agents.begin() + i, agents.end(), agents[i]);
+				agents[i]->beginSlotSteps(numSlots);
+			}
 		}
 		if (callback)
 		{
 			callback->beginTrain();
 		}
-		for (uint32_t episode = 0; episode < numEpisodes; ++episode)
+		std::vector<State_t> states;
+		std::vector<uint32_t> episodes(count);
+		std::vector<uint32_t> numSteps(count, 0);
+		std::vector<float> totalRewards(count, 0);
+		uint32_t numStartedEpisodes = 0;
+		uint32_t numFinishedEpisodes = 0;
+		environment->reset(states);
+		for (size_t i = 0; i < count; ++i)
+		{
+			episodes[i] = numStartedEpisodes++;
+			if (callback)
+			{
+				callback->beginEpisode(episodes[i]);
+				callback->beginStep(episodes[i], 0);
+			}
+			environment->stepAsync(i, agents[i]->firstSlotStep(slots[i], states[i]));
+		}
+		while (numFinishedEpisodes < numEpisodes)
+		{
+			size_t i = environment->waitAny();
+			const auto& result = environment->result(i);
+			++numSteps[i];
+			totalRewards[i] += result.m_reward;
+			//a last step also starts the next episode of the slot from the reset state
+			Action_t action = agents[i]->nextSlotStep(slots[i], result.m_reward, result.m_nextState, result.m_status, result.m_resetState);
+			if (callback)
+			{
+				callback->endStep(episodes[i], numSteps[i], result.m_reward);
+			}
+			if (EnvironmentStatus::es_normal == result.m_status)
+			{
+				if (callback)
+				{
+					callback->beginStep(episodes[i], numSteps[i] + 1);
+				}
+			}
+			else
+			{
+				if (callback)
+				{
+					callback->endEpisode(episodes[i], numSteps[i], totalRewards[i]);
+				}
+				if (++numFinishedEpisodes >= numEpisodes)
+				{
+					break;
+				}
+				episodes[i] = numStartedEpisodes++;
+				numSteps[i] = 0;
+				totalRewards[i] = 0;
+				if (callback)
+				{
+					callback->beginEpisode(episodes[i]);
+					callback->beginStep(episodes[i], 0);
+				}
+			}
+			environment->stepAsync(i, action);
+		}
+		environment->waitAll();
+		if (callback)
+		{
+			callback->endTrain();
+		}
+	}
+	//one agent for every environment of the pool
+	static void TrainAsyncEpisodes(Agent_t* agent, AsyncEnvironmentPool_t* environment, uint32_t numEpisodes, Callback* callback)
+	{
+		TrainAsyncEpisodes(std::vector<Agent_t*>(environment->size(), agent), environment, numEpisodes, callback);
+	}
+
+	//runs episodes until the first of the budgets in TrainBudget is exhausted, an episode cut by the budget ends as truncated
+	static TrainStats TrainSteps(Agent_t* agent, Environment_t* environment, const TrainBudget& budget, Callback* callback)
+	{
+		TrainStats stats{};
+		if (nullptr == agent || nullptr == environment || budget.unlimited())
+		{
+			return stats;
+		}
+		if (callback)
+		{
+			callback->beginTrain();
+		}
+		auto startTime = std::chrono::steady_clock::now();
+		auto deadline = startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(budget.maxSeconds()));
+		uint64_t startLearnCount = agent->learnCount();
+		auto exhausted = [&]()
+		{
+			if (budget.maxSteps() > 0 && stats.m_numSteps >= budget.maxSteps())
+			{
+				return true;
+			}
+			if (budget.maxUpdates() > 0 && agent->learnCount() - startLearnCount >= budget.maxUpdates())
+			{
+				return true;
+			}
+			return budget.maxSeconds() > 0 && std::chrono::steady_clock::now() >= deadline;
+		};
+		for (uint32_t episode = 0; !exhausted(); ++episode)
 		{
 			if (callback)
 			{
@@ -91,20 +327,21 @@ public:
 			{
 				callback->beginStep(episode, 0);
 			}
-			State_t state = environment.reset();
-			Action_t action = agent.firstStep(state);
+			State_t state = environment->reset();
+			Action_t action = agent->firstStep(state);
 			uint32_t numSteps = 0;
 			float totalReward = 0;
 			while (true)
 			{
 				float reward;
 				State_t nextState;
-				EnvironmentStatus envStatus = environment.step(reward, nextState, action);
+				EnvironmentStatus envStatus = environment->step(reward, nextState, action);
 				++numSteps;
+				++stats.m_numSteps;
 				totalReward += reward;
-				if (EnvironmentStatus::es_normal == envStatus)
+				if (EnvironmentStatus::es_normal == envStatus && !exhausted())
 				{
-					action = agent.nextStep(reward, nextState);
+					action = agent->nextStep(reward, nextState);
 					if (callback)
 					{
 						callback->endStep(episode, numSteps, reward);
@@ -113,7 +350,8 @@ public:
 				}
 				else
 				{
-					agent.lastStep(reward, nextState, envStatus == EnvironmentStatus::es_terminated);
+					agent->lastStep(reward, nextState, envStatus == EnvironmentStatus::es_terminated);
+					++stats.m_numEpisodes;
 					if (callback)
 					{
 						callback->endStep(episode, numSteps, reward);
@@ -123,12 +361,18 @@ public:
 				}
 			}
 		}
+		stats.m_numUpdates = agent->learnCount() - startLearnCount;
+		stats.m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
 		if (callback)
 		{
 			callback->endTrain();
 		}
+		return stats;
+	}
+	static TrainStats TrainSteps(Agent_t* agent, Environment_t* environment, uint64_t maxSteps, Callback* callback)
+	{
+		return TrainSteps(agent, environment, TrainBudget().maxSteps(maxSteps), callback);
 	}
-
 };
 
 
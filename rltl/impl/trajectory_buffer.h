@@ -2,57 +2,253 @@
 #include "utility.h"
 #include "random.h"
 #include "neural_network.h"
+#include "mapped_file.h"
+#include "chunked_array.h"
+#include "sum_tree.h"
+#include <memory>
 
 BEGIN_RLTL_IMPL
 
-template<typename State_t, typename Action_t, typename Priority_t = float, typename PrioritySum_t = double>
+//transitions staged by the batched steps of an agent, appended to a TrajectoryBuffer in one call
+template<typename State_t, typename Action_t>
+class TransitionBatch
+{
+public:
+	size_t size() const
+	{
+		return m_states.size();
+	}
+	void clear()
+	{
+		m_states.clear();
+		m_actions.clear();
+		m_rewards.clear();
+		m_nextStates.clear();
+		m_nextDiscounts.clear();
+		m_nextActions.clear();
+	}
+	void append(
+		const State_t& state,
+		const Action_t& action,
+		float reward,
+		const State_t& nextState,
+		float nextDiscount)
+	{
+		m_states.push_back(state);
+		m_actions.push_back(action);
+		m_rewards.push_back(reward);
+		m_nextStates.push_back(nextState);
+		m_nextDiscounts.push_back(nextDiscount);
+	}
+	void append(
+		const State_t& state,
+		const Action_t& action,
+		float reward,
+		const State_t& nextState,
+		float nextDiscount,
+		const Action_t& nextAction)
+	{
+		append(state, action, reward, nextState, nextDiscount);
+		m_nextActions.push_back(nextAction);
+	}
+public:
+	std::vector<State_t> m_states;
+	std::vector<Action_t> m_actions;
+	std::vector<float> m_rewards;
+	std::vector<State_t> m_nextStates;
+	std::vector<float> m_nextDiscounts;
+	std::vector<Action_t> m_nextActions;
+};
+
+//SumTree_t is PrioritySumTree or WidePrioritySumTree, it is only allocated for prioritized replay
+template<typename State_t, typename Action_t, typename Priority_t = float, typename PrioritySum_t = double, typename SumTree_t = PrioritySumTree<Priority_t, PrioritySum_t>>
 class TrajectoryBuffer
 {
+protected:
+	//file layout of initializeMapped: this header in the first page,
+	//then every column starting on its own 4096 byte boundary in the order of MappedLayout
+	struct MappedHeader
+	{
+		MappedHeader(uint32_t capacity, bool needNextAction) :
+			m_capacity(capacity),
+			m_stateSize(uint32_t(Array_Size<State_t>::size())),
+			m_actionSize(uint32_t(Array_Size<Action_t>::size())),
+			m_needNextAction(needNextAction ? 1 : 0)
+		{}
+		bool compatible(uint32_t capacity, bool needNextAction) const
+		{
+			return t_magic == m_magic && t_version == m_version && capacity == m_capacity
+				&& Array_Size<State_t>::size() == m_stateSize && Array_Size<Action_t>::size() == m_actionSize
+				&& (needNextAction ? 1u : 0u) == m_needNextAction
+				&& m_size <= m_capacity && m_begin < m_capacity && m_end < m_capacity;
+		}
+		static constexpr uint64_t t_magic = 0x31464255424c5452;//"RLTLBUF1"
+		static constexpr uint32_t t_version = 1;
+		uint64_t m_magic{ t_magic };
+		uint32_t m_version{ t_version };
+		uint32_t m_capacity;
+		uint32_t m_stateSize;
+		uint32_t m_actionSize;
+		uint32_t m_needNextAction;
+		uint32_t m_size{};
+		uint32_t m_begin{};
+		uint32_t m_end{};
+	};
+	struct MappedLayout
+	{
+		MappedLayout(uint32_t capacity, bool needNextAction)
+		{
+			uint64_t offset = align(sizeof(MappedHeader));
+			m_stateOffset = offset;
+			offset = align(offset + uint64_t(capacity) * Array_Size<State_t>::size() * sizeof(float));
+			m_actionOffset = offset;
+			offset = align(offset + uint64_t(capacity) * Array_Size<Action_t>::size() * sizeof(int64_t));
+			m_rewardOffset = offset;
+			offset = align(offset + uint64_t(capacity) * sizeof(float));
+			m_nextStateOffset = offset;
+			offset = align(offset + uint64_t(capacity) * Array_Size<State_t>::size() * sizeof(float));
+			m_nextDiscountOffset = offset;
+			offset = align(offset + uint64_t(capacity) * sizeof(float));
+			m_nextActionOffset = offset;
+			if (needNextAction)
+			{
+				offset = align(offset + uint64_t(capacity) * Array_Size<Action_t>::size() * sizeof(int64_t));
+			}
+			m_fileSize = offset;
+		}
+		static uint64_t align(uint64_t offset)
+		{
+			return (offset + 4095) / 4096 * 4096;
+		}
+		uint64_t m_stateOffset;
+		uint64_t m_actionOffset;
+		uint64_t m_rewardOffset;
+		uint64_t m_nextStateOffset;
+		uint64_t m_nextDiscountOffset;
+		uint64_t m_nextActionOffset;
+		uint64_t m_fileSize;
+	};
 public:
 	~TrajectoryBuffer()
 	{
-		delete[]m_prioritySums;
-		delete[]m_priorities;
-		delete[]m_nextActions;
-		delete[]m_nextDiscounts;
-		delete[]m_nextStates;
-		delete[]m_rewards;
-		delete[]m_actions;
-		delete[]m_states;
+		if (m_mappedFile)
+		{
+			return;
+		}
+		delete[]m_nextActionData;
+		delete[]m_nextDiscountData;
+		delete[]m_nextStateData;
+		delete[]m_rewardData;
+		delete[]m_actionData;
+		delete[]m_stateData;
 	}
 public:
+	//columnar keeps every field in a flat float/int64 array viewed as a [capacity, ...] tensor,
+	//batches are then gathered with index_select instead of per scalar Tensor_Assign
 	void initialize(
 		uint32_t capacity,
 		bool needNextAction,
-		bool needPriority)
+		bool needPriority,
+		bool columnar = false)
 	{
 		if (needPriority)
 		{
-			size_t alignedCapacity = 2;
-			while (alignedCapacity < capacity)
+			capacity = SumTree_t::AlignCapacity(capacity);
+		}
+
+		m_capacity = capacity;
+		if (columnar)
+		{
+			initializeColumns(capacity, needNextAction);
+		}
+		else
+		{
+			//chunks are allocated as the buffer fills, not up front
+			m_states.initialize(capacity);
+			m_actions.initialize(capacity);
+			m_rewards.initialize(capacity);
+			m_nextStates.initialize(capacity);
+			m_nextDiscounts.initialize(capacity);
+			if (needNextAction)
 			{
-				alignedCapacity *= 2;
+				//for sarsa
+				m_nextActions.initialize(capacity);
 			}
-			capacity = alignedCapacity;
 		}
-
+		if (needPriority)
+		{
+			m_sumTree.initialize(capacity);
+			m_serials.initialize(capacity);
+		}
+	}
+	//columnar storage inside a memory-mapped file, so the capacity is bounded by disk instead of RAM.
+	//with resume an existing file of the same layout keeps its transitions, the priorities live in RAM
+	//and restart at the max priority. returns false if the file can not be mapped
+	bool initializeMapped(
+		const std::string& filename,
+		uint32_t capacity,
+		bool needNextAction,
+		bool needPriority,
+		bool resume)
+	{
+		if (needPriority)
+		{
+			capacity = SumTree_t::AlignCapacity(capacity);
+		}
+		MappedLayout layout(capacity, needNextAction);
+		std::unique_ptr<MappedFile> mappedFile(new MappedFile());
+		if (!mappedFile->open(filename, layout.m_fileSize))
+		{
+			return false;
+		}
+		char* base = static_cast<char*>(mappedFile->data());
+		MappedHeader* header = reinterpret_cast<MappedHeader*>(base);
+		bool resumed = resume && mappedFile->existed() && header->compatible(capacity, needNextAction);
+		if (!resumed)
+		{
+			*header = MappedHeader(capacity, needNextAction);
+		}
 		m_capacity = capacity;
-		m_states = new State_t[capacity];
-		m_actions = new Action_t[capacity];
-		m_rewards = new float[capacity];
-		m_nextStates = new State_t[capacity];
-		m_nextDiscounts = new float[capacity];
+		m_mappedFile = std::move(mappedFile);
+		m_mappedHeader = header;
+		m_stateData = reinterpret_cast<float*>(base + layout.m_stateOffset);
+		m_actionData = reinterpret_cast<int64_t*>(base + layout.m_actionOffset);
+		m_rewardData = reinterpret_cast<float*>(base + layout.m_rewardOffset);
+		m_nextStateData = reinterpret_cast<float*>(base + layout.m_nextStateOffset);
+		m_nextDiscountData = reinterpret_cast<float*>(base + layout.m_nextDiscountOffset);
 		if (needNextAction)
 		{
-			//for sarsa
-			m_nextActions = new Action_t[capacity];
+			m_nextActionData = reinterpret_cast<int64_t*>(base + layout.m_nextActionOffset);
 		}
+		viewColumns(capacity);
+		//replay touches records in random order, readahead would only evict useful pages
+		m_mappedFile->advise(MappedAccess::random, layout.m_stateOffset);
 		if (needPriority)
 		{
-			m_priorities = new Priority_t[capacity];
-			std::memset(m_priorities, 0, sizeof(Priority_t)*(capacity));
-			m_prioritySums = new PrioritySum_t[capacity - 1];
-			std::memset(m_prioritySums, 0, sizeof(PrioritySum_t)*(capacity - 1));
+			m_sumTree.initialize(capacity);
+			m_serials.initialize(capacity);
+		}
+		if (resumed)
+		{
+			m_size = header->m_size;
+			m_begin = header->m_begin;
+			m_end = header->m_end;
+			if (m_sumTree)
+			{
+				for (uint32_t i = 0; i < m_size; ++i)
+				{
+					updatePriority((m_begin + i) % m_capacity, m_sumTree.maxPriority());
+				}
+			}
+		}
+		return true;
+	}
+	//writes the mapped transitions back to the file, a no-op for heap storage
+	void flush()
+	{
+		if (m_mappedFile)
+		{
+			m_mappedFile->flush();
 		}
 	}
 public:
@@ -60,6 +256,53 @@ public:
 	{
 		return m_size;
 	}
+	uint32_t capacity() const
+	{
+		return m_capacity;
+	}
+	//only with prioritized replay
+	PrioritySum_t totalPriority() const
+	{
+		return m_sumTree.total();
+	}
+	Priority_t minPriority() const
+	{
+		return m_sumTree.minPriority();
+	}
+	//bytes held by the transitions and the sum tree: the chunked storage grows with the fill level,
+	//the columns are allocated up front and mapped storage counts the whole mapping, which is page cache rather than heap
+	size_t allocatedBytes() const
+	{
+		size_t bytes = m_states.allocatedBytes() + m_actions.allocatedBytes() + m_rewards.allocatedBytes()
+			+ m_nextStates.allocatedBytes() + m_nextDiscounts.allocatedBytes() + m_nextActions.allocatedBytes()
+			+ m_sumTree.allocatedBytes() + m_serials.allocatedBytes();
+		if (m_mappedFile)
+		{
+			bytes += m_mappedFile->size();
+		}
+		else if (columnar())
+		{
+			size_t rowBytes = 2 * Array_Size<State_t>::size() * sizeof(float) + Array_Size<Action_t>::size() * sizeof(int64_t) + 2 * sizeof(float);
+			if (m_nextActionData)
+			{
+				rowBytes += Array_Size<Action_t>::size() * sizeof(int64_t);
+			}
+			bytes += size_t(m_capacity) * rowBytes;
+		}
+		return bytes;
+	}
+	bool mapped() const
+	{
+		return nullptr != m_mappedHeader;
+	}
+	bool columnar() const
+	{
+		return m_stateColumn.defined();
+	}
+	bool needNextAction() const
+	{
+		return bool(m_nextActions) || nullptr != m_nextActionData;
+	}
 
 	uint32_t append(
 		const State_t& state, 
@@ -68,16 +311,12 @@ public:
 		const State_t& nextState, 
 		float nextDiscount)
 	{
-		assert(nullptr == m_nextActions);
+		assert(!needNextAction());
 		uint32_t index = m_end;
-		m_states[index] = state;
-		m_actions[index] = action;
-		m_rewards[index] = reward;
-		m_nextStates[index] = nextState;
-		m_nextDiscounts[index] = nextDiscount;
-		if (m_priorities)
+		store(index, state, action, reward, nextState, nextDiscount);
+		if (m_sumTree)
 		{
-			updatePriority(index, m_maxPriority);
+			updatePriority(index, m_sumTree.maxPriority());
 		}
 		m_end = (m_end + 1) % m_capacity;
 		if (m_size < m_capacity)
@@ -89,6 +328,7 @@ public:
 			m_begin = (m_begin + 1) % m_capacity;
 		}
 		assert((m_begin + m_size) % m_capacity == m_end);
+		saveRingState();
 		return index;
 	}
 
@@ -100,17 +340,13 @@ public:
 		float nextDiscount, 
 		const Action_t& nextAction)
 	{
-		assert(nullptr != m_nextActions);
+		assert(needNextAction());
 		uint32_t index = m_end;
-		m_states[index] = state;
-		m_actions[index] = action;
-		m_rewards[index] = reward;
-		m_nextStates[index] = nextState;
-		m_nextDiscounts[index] = nextDiscount;
-		m_nextActions[index] = nextAction;
-		if (m_priorities)
+		store(index, state, action, reward, nextState, nextDiscount);
+		storeNextAction(index, nextAction);
+		if (m_sumTree)
 		{
-			updatePriority(index, m_maxPriority);
+			updatePriority(index, m_sumTree.maxPriority());
 		}
 		m_end = (m_end + 1) % m_capacity;
 		if (m_size < m_capacity)
@@ -122,9 +358,37 @@ public:
 			m_begin = (m_begin + 1) % m_capacity;
 		}
 		assert((m_begin + m_size) % m_capacity == m_end);
+		saveRingState();
 		return index;
 	}
 
+	//bulk append, the ring indices are advanced once for the whole batch
+	void append(const TransitionBatch<State_t, Action_t>& batch)
+	{
+		uint32_t count = batch.size();
+		assert(count <= m_capacity);
+		assert(needNextAction() == (batch.m_nextActions.size() == count));
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint32_t index = (m_end + i) % m_capacity;
+			store(index, batch.m_states[i], batch.m_actions[i], batch.m_rewards[i], batch.m_nextStates[i], batch.m_nextDiscounts[i]);
+			if (needNextAction())
+			{
+				storeNextAction(index, batch.m_nextActions[i]);
+			}
+			if (m_sumTree)
+			{
+				updatePriority(index, m_sumTree.maxPriority());
+			}
+		}
+		m_end = (m_end + count) % m_capacity;
+		uint32_t overflow = m_size + count > m_capacity ? m_size + count - m_capacity : 0;
+		m_size += count - overflow;
+		m_begin = (m_begin + overflow) % m_capacity;
+		assert((m_begin + m_size) % m_capacity == m_end);
+		saveRingState();
+	}
+
 public:
 	//for sequential retrive
 	void pop(
@@ -135,9 +399,19 @@ public:
 		Tensor& nextDiscountTensor, 
 		uint32_t batchSize)
 	{
-		assert(nullptr == m_priorities);
-		assert(nullptr == m_nextActions);
+		assert(!m_sumTree);
+		assert(!needNextAction());
 		assert(0 < batchSize && batchSize <= m_size);
+		if (columnar())
+		{
+			copyColumnRange(stateTensor, m_stateColumn, batchSize);
+			copyColumnRange(actionTensor, m_actionColumn, batchSize);
+			copyColumnRange(rewardTensor, m_rewardColumn, batchSize);
+			copyColumnRange(nextStateTensor, m_nextStateColumn, batchSize);
+			copyColumnRange(nextDiscountTensor, m_nextDiscountColumn, batchSize);
+			popRange(batchSize);
+			return;
+		}
 		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
 		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
 		auto rewards = rewardTensor.accessor<float, 2>();
@@ -152,9 +426,7 @@ public:
 			Tensor_Assign(nextStates[i], m_nextStates[index]);
 			Tensor_Assign(nextDiscounts[i], m_nextDiscounts[index]);
 		}
-		m_begin = (m_begin + batchSize) % m_capacity;
-		m_size -= batchSize;
-		assert((m_begin + m_size) % m_capacity == m_end);
+		popRange(batchSize);
 	}
 
 	void pop(
@@ -166,9 +438,20 @@ public:
 		Tensor& nextActionTensor, 
 		uint32_t batchSize)
 	{
-		assert(nullptr == m_priorities);
-		assert(nullptr != m_nextActions);
+		assert(!m_sumTree);
+		assert(needNextAction());
 		assert(0 < batchSize && batchSize <= m_size);
+		if (columnar())
+		{
+			copyColumnRange(stateTensor, m_stateColumn, batchSize);
+			copyColumnRange(actionTensor, m_actionColumn, batchSize);
+			copyColumnRange(rewardTensor, m_rewardColumn, batchSize);
+			copyColumnRange(nextStateTensor, m_nextStateColumn, batchSize);
+			copyColumnRange(nextDiscountTensor, m_nextDiscountColumn, batchSize);
+			copyColumnRange(nextActionTensor, m_nextActionColumn, batchSize);
+			popRange(batchSize);
+			return;
+		}
 		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
 		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
 		auto rewards = rewardTensor.accessor<float, 2>();
@@ -185,23 +468,32 @@ public:
 			Tensor_Assign(nextDiscounts[i], m_nextDiscounts[index]);
 			Tensor_Assign(nextActions[i], m_nextActions[index]);
 		}
-		m_begin = (m_begin + batchSize) % m_capacity;
-		m_size -= batchSize;
-		assert((m_begin + m_size) % m_capacity == m_end);
+		popRange(batchSize);
 	}
 
 public:
-	//for experience replay
+	//for experience replay. the sample functions are not const, they fill the index tensor and the batch
+	//priorities kept as scratch in the buffer, so a buffer is sampled by one thread at a time
 	void sample(
 		Tensor& stateTensor, 
 		Tensor& actionTensor, 
 		Tensor& rewardTensor, 
 		Tensor& nextStateTensor, 
 		Tensor& nextDiscountTensor, 
-		uint32_t batchSize) const
+		uint32_t batchSize)
 	{
-		assert(nullptr == m_nextActions);
+		assert(!needNextAction());
 		assert(0 < batchSize && 0 < m_size);
+		if (columnar())
+		{
+			auto indices = indexTensor(batchSize).template accessor<int64_t, 1>();
+			for (uint32_t i = 0; i < batchSize; ++i)
+			{
+				indices[i] = Random::randuint(m_size);
+			}
+			gatherColumns(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor);
+			return;
+		}
 		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
 		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
 		auto rewards = rewardTensor.accessor<float, 2>();
@@ -225,10 +517,21 @@ public:
 		Tensor& nextStateTensor, 
 		Tensor& nextDiscountTensor, 
 		Tensor& nextActionTensor, 
-		uint32_t batchSize) const
+		uint32_t batchSize)
 	{
-		assert(nullptr != m_nextActions);
+		assert(needNextAction());
 		assert(0 < batchSize && 0 < m_size);
+		if (columnar())
+		{
+			auto indices = indexTensor(batchSize).template accessor<int64_t, 1>();
+			for (uint32_t i = 0; i < batchSize; ++i)
+			{
+				indices[i] = Random::randuint(m_size);
+			}
+			gatherColumns(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor);
+			torch::index_select_out(nextActionTensor, m_nextActionColumn, 0, m_indexTensor);
+			return;
+		}
 		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
 		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
 		auto rewards = rewardTensor.accessor<float, 2>();
@@ -258,27 +561,30 @@ public:
 		Tensor& nextDiscountTensor, 
 		Tensor& weightTensor, 
 		uint32_t batchSize,
-		float prioritizedBeta) const
+		float prioritizedBeta)
 	{
-		assert(nullptr == m_nextActions);
+		assert(!needNextAction());
 		assert(0 < batchSize && 0 < m_size);
+		if (columnar())
+		{
+			samplePrioritizedIndices(indices, weightTensor, batchSize, prioritizedBeta);
+			gatherColumns(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor);
+			return;
+		}
 		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
 		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
 		auto rewards = rewardTensor.accessor<float, 2>();
 		auto nextStates = nextStateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
 		auto nextDiscounts = nextDiscountTensor.accessor<float, 2>();
-		auto weights = weightTensor.accessor<float, 2>();
+		samplePrioritizedBatch(indices, weightTensor, batchSize, prioritizedBeta);
 		for (uint32_t i = 0; i < batchSize; ++i)
 		{
-			uint32_t index = sampleIndexSumTree();
-			assert(index < m_size);
-			indices[i] = index;
+			uint32_t index = indices[i];
 			Tensor_Assign(states[i], m_states[index]);
 			Tensor_Assign(actions[i], m_actions[index]);
 			Tensor_Assign(rewards[i], m_rewards[index]);
 			Tensor_Assign(nextStates[i], m_nextStates[index]);
 			Tensor_Assign(nextDiscounts[i], m_nextDiscounts[index]);
-			weights[i][0] = std::pow(m_minPriority / m_priorities[index], prioritizedBeta);
 		}
 	}
 
@@ -292,112 +598,277 @@ public:
 		Tensor& nextActionTensor, 
 		Tensor& weightTensor, 
 		uint32_t batchSize,
-		float prioritizedBeta) const
+		float prioritizedBeta)
 	{
-		assert(nullptr != m_nextActions);
+		assert(needNextAction());
 		assert(0 < batchSize && 0 < m_size);
+		if (columnar())
+		{
+			samplePrioritizedIndices(indices, weightTensor, batchSize, prioritizedBeta);
+			gatherColumns(stateTensor, actionTensor, rewardTensor, nextStateTensor, nextDiscountTensor);
+			torch::index_select_out(nextActionTensor, m_nextActionColumn, 0, m_indexTensor);
+			return;
+		}
 		auto states = stateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
 		auto actions = actionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
 		auto rewards = rewardTensor.accessor<float, 2>();
 		auto nextStates = nextStateTensor.accessor<float, Array_Dimension<State_t>::dim() + 1>();
 		auto nextDiscounts = nextDiscountTensor.accessor<float, 2>();
 		auto nextActions = nextActionTensor.accessor<int64_t, Array_Dimension<Action_t>::dim() + 1>();
-		auto weights = weightTensor.accessor<float, 2>();
+		samplePrioritizedBatch(indices, weightTensor, batchSize, prioritizedBeta);
 		for (uint32_t i = 0; i < batchSize; ++i)
 		{
-			uint32_t index = sampleIndexSumTree();
-			assert(index < m_size);
-			indices[i] = index;
+			uint32_t index = indices[i];
 			Tensor_Assign(states[i], m_states[index]);
 			Tensor_Assign(actions[i], m_actions[index]);
 			Tensor_Assign(rewards[i], m_rewards[index]);
 			Tensor_Assign(nextStates[i], m_nextStates[index]);
 			Tensor_Assign(nextDiscounts[i], m_nextDiscounts[index]);
 			Tensor_Assign(nextActions[i], m_nextActions[index]);
-			weights[i][0] = std::pow(m_minPriority / m_priorities[index], prioritizedBeta);
 		}
 	}
 
 	void updatePriorities(const std::vector<uint32_t>& indices, const Tensor& deltaTensor, uint32_t batchSize, float prioritizedAlpha, float prioritizedEpsilon)
 	{
-		assert(indices.size() == batchSize);
-		auto deltas = deltaTensor.accessor<float, 2>();
+		assert(indices.size() >= batchSize);
+		NN_prioritiesFromDeltas(m_priorityTensor, deltaTensor, prioritizedAlpha, prioritizedEpsilon);
+		auto priorities = m_priorityTensor.accessor<float, 2>();
+		m_batchPriorities.resize(batchSize);
 		for (uint32_t i = 0; i < batchSize; ++i)
 		{
-			size_t index = indices[i];
-			assert(index < m_size);
-			float delta = std::abs(deltas[i][0]);
-			float priority = std::pow(delta + prioritizedEpsilon, prioritizedAlpha);
-			updatePriority(index, priority);
+			assert(indices[i] < m_size);
+			m_batchPriorities[i] = priorities[i][0];
 		}
+		m_sumTree.update(indices.data(), m_batchPriorities.data(), batchSize);
+	}
+	//write serials of the sampled slots, read under the same lock as the sample. a batch which is used
+	//several samples later, as with prefetching, passes them back to updatePriorities with serials
+	void serials(const std::vector<uint32_t>& indices, std::vector<uint64_t>& serials, uint32_t batchSize) const
+	{
+		serials.resize(batchSize);
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			serials[i] = m_serials[indices[i]];
+		}
+	}
+	//skips the slots which were overwritten since they were sampled, they keep the max priority of their new transition
+	void updatePriorities(const std::vector<uint32_t>& indices, const std::vector<uint64_t>& serials, const Tensor& deltaTensor, uint32_t batchSize, float prioritizedAlpha, float prioritizedEpsilon)
+	{
+		assert(indices.size() >= batchSize && serials.size() >= batchSize);
+		NN_prioritiesFromDeltas(m_priorityTensor, deltaTensor, prioritizedAlpha, prioritizedEpsilon);
+		auto priorities = m_priorityTensor.accessor<float, 2>();
+		m_batchPriorities.resize(batchSize);
+		m_updateIndices.resize(batchSize);
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			if (m_serials[indices[i]] == serials[i])
+			{
+				m_updateIndices[count] = indices[i];
+				m_batchPriorities[count] = priorities[i][0];
+				++count;
+			}
+		}
+		m_sumTree.update(m_updateIndices.data(), m_batchPriorities.data(), count);
 	}
 protected:
-	void updatePriority(size_t index, float priority)
+	void initializeColumns(uint32_t capacity, bool needNextAction)
 	{
-		m_priorities[index] = priority;
-		if (m_prioritySums)
+		m_stateData = new float[size_t(capacity) * Array_Size<State_t>::size()];
+		m_actionData = new int64_t[size_t(capacity) * Array_Size<Action_t>::size()];
+		m_rewardData = new float[capacity];
+		m_nextStateData = new float[size_t(capacity) * Array_Size<State_t>::size()];
+		m_nextDiscountData = new float[capacity];
+		if (needNextAction)
 		{
-			updateSumTree(index);
+			m_nextActionData = new int64_t[size_t(capacity) * Array_Size<Action_t>::size()];
 		}
-		if (m_minPriority > priority)
+		viewColumns(capacity);
+	}
+	//the columns do not own their memory, it belongs to the *Data arrays
+	void viewColumns(uint32_t capacity)
+	{
+		m_stateColumn = torch::from_blob(m_stateData, columnShape<State_t>(capacity), torch::kFloat32);
+		m_actionColumn = torch::from_blob(m_actionData, columnShape<Action_t>(capacity), torch::kInt64);
+		m_rewardColumn = torch::from_blob(m_rewardData, { int64_t(capacity), 1 }, torch::kFloat32);
+		m_nextStateColumn = torch::from_blob(m_nextStateData, columnShape<State_t>(capacity), torch::kFloat32);
+		m_nextDiscountColumn = torch::from_blob(m_nextDiscountData, { int64_t(capacity), 1 }, torch::kFloat32);
+		if (m_nextActionData)
 		{
-			m_minPriority = priority;
+			m_nextActionColumn = torch::from_blob(m_nextActionData, columnShape<Action_t>(capacity), torch::kInt64);
 		}
-		if (m_maxPriority < priority)
+	}
+	template<typename Element_t>
+	static std::vector<int64_t> columnShape(uint32_t capacity)
+	{
+		auto shape = Array_Shape<Element_t>::shape();
+		std::vector<int64_t> tensorShape(shape.size() + 1);
+		tensorShape[0] = capacity;
+		for (size_t i = 0; i < shape.size(); ++i)
 		{
-			m_maxPriority = priority;
+			tensorShape[i + 1] = shape[i];
 		}
+		return tensorShape;
 	}
-	void updateSumTree(size_t index)
+	void store(uint32_t index, const State_t& state, const Action_t& action, float reward, const State_t& nextState, float nextDiscount)
 	{
-		size_t parent = (index + m_capacity) / 2 - 1;
-		m_prioritySums[parent] = m_priorities[index] + m_priorities[index ^ 1];
-		while (parent)
+		if (m_serials)
 		{
-			parent = (parent - 1) / 2;
-			m_prioritySums[parent] = m_prioritySums[parent * 2 + 1] + m_prioritySums[parent * 2 + 2];
-			assert(m_prioritySums[parent] >= m_prioritySums[parent * 2 + 1] && m_prioritySums[parent] >= m_prioritySums[parent * 2 + 2]);
+			m_serials[index] = ++m_serial;
+		}
+		if (columnar())
+		{
+			//straight into the flat arrays behind the columns, building accessors per append costs more than the copy
+			storeElement(m_stateData + size_t(index) * Array_Size<State_t>::size(), state);
+			storeElement(m_actionData + size_t(index) * Array_Size<Action_t>::size(), action);
+			m_rewardData[index] = reward;
+			storeElement(m_nextStateData + size_t(index) * Array_Size<State_t>::size(), nextState);
+			m_nextDiscountData[index] = nextDiscount;
+		}
+		else
+		{
+			m_states[index] = state;
+			m_actions[index] = action;
+			m_rewards[index] = reward;
+			m_nextStates[index] = nextState;
+			m_nextDiscounts[index] = nextDiscount;
 		}
 	}
-	uint32_t sampleIndexSumTree() const
+	void storeNextAction(uint32_t index, const Action_t& nextAction)
 	{
-		Priority_t priority = Random::rand() * m_prioritySums[0];
-		uint32_t leftNode = 1;
-		while (leftNode < m_capacity - 1)
+		if (columnar())
 		{
-			if (m_prioritySums[leftNode] > priority)
-			{
-				leftNode = leftNode * 2 + 1;
-			}
-			else
+			storeElement(m_nextActionData + size_t(index) * Array_Size<Action_t>::size(), nextAction);
+		}
+		else
+		{
+			m_nextActions[index] = nextAction;
+		}
+	}
+	//a scalar or the row-major elements of an Array, converted to the column type
+	template<typename Column_t, typename Element_t>
+	static void storeElement(Column_t* dst, const Element_t& element)
+	{
+		if constexpr (std::is_arithmetic_v<Element_t>)
+		{
+			*dst = Column_t(element);
+		}
+		else
+		{
+			for (size_t i = 0; i < Element_t::t_size; ++i)
 			{
-				priority -= m_prioritySums[leftNode];
-				leftNode = (leftNode + 1) * 2 + 1;
+				dst[i] = Column_t(element.m_elements[i]);
 			}
 		}
-		leftNode -= (m_capacity - 1);
-		uint32_t index = m_priorities[leftNode] > priority ? leftNode : leftNode + 1;
-		if (index >= m_size)
+	}
+	void popRange(uint32_t batchSize)
+	{
+		m_begin = (m_begin + batchSize) % m_capacity;
+		m_size -= batchSize;
+		assert((m_begin + m_size) % m_capacity == m_end);
+		saveRingState();
+	}
+	void saveRingState()
+	{
+		if (m_mappedHeader)
 		{
-			index = m_size - 1;
+			m_mappedHeader->m_size = m_size;
+			m_mappedHeader->m_begin = m_begin;
+			m_mappedHeader->m_end = m_end;
 		}
-		return index;
+	}
+	//copies the batchSize rows starting at m_begin, in at most two slices when the range wraps
+	void copyColumnRange(Tensor& dst, const Tensor& column, uint32_t batchSize) const
+	{
+		uint32_t count = std::min(batchSize, m_capacity - m_begin);
+		dst.narrow(0, 0, count).copy_(column.narrow(0, m_begin, count));
+		if (count < batchSize)
+		{
+			dst.narrow(0, count, batchSize - count).copy_(column.narrow(0, 0, batchSize - count));
+		}
+	}
+	Tensor& indexTensor(uint32_t batchSize)
+	{
+		if (!m_indexTensor.defined() || m_indexTensor.size(0) != batchSize)
+		{
+			m_indexTensor = torch::empty({ int64_t(batchSize) }, torch::TensorOptions().dtype(torch::kInt64));
+		}
+		return m_indexTensor;
+	}
+	void samplePrioritizedIndices(std::vector<uint32_t>& indices, Tensor& weightTensor, uint32_t batchSize, float prioritizedBeta)
+	{
+		samplePrioritizedBatch(indices, weightTensor, batchSize, prioritizedBeta);
+		auto indexAccessor = indexTensor(batchSize).template accessor<int64_t, 1>();
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			indexAccessor[i] = indices[i];
+		}
+	}
+	//stratified batch from the sum tree, the indices are sorted so the gather walks the storage forward.
+	//the weights (minPriority / priority)^beta are computed in place on the whole weight tensor
+	void samplePrioritizedBatch(std::vector<uint32_t>& indices, Tensor& weightTensor, uint32_t batchSize, float prioritizedBeta)
+	{
+		assert(indices.size() >= batchSize);
+		m_batchPriorities.resize(batchSize);
+		m_sumTree.sample(indices.data(), m_batchPriorities.data(), batchSize, m_size);
+		auto weights = weightTensor.accessor<float, 2>();
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			assert(indices[i] < m_size);
+			weights[i][0] = m_batchPriorities[i];
+		}
+		weightTensor.reciprocal_().mul_(m_sumTree.minPriority()).pow_(prioritizedBeta);
+	}
+	//one index_select per field over the indices in m_indexTensor
+	void gatherColumns(Tensor& stateTensor, Tensor& actionTensor, Tensor& rewardTensor, Tensor& nextStateTensor, Tensor& nextDiscountTensor)
+	{
+		torch::index_select_out(stateTensor, m_stateColumn, 0, m_indexTensor);
+		torch::index_select_out(actionTensor, m_actionColumn, 0, m_indexTensor);
+		torch::index_select_out(rewardTensor, m_rewardColumn, 0, m_indexTensor);
+		torch::index_select_out(nextStateTensor, m_nextStateColumn, 0, m_indexTensor);
+		torch::index_select_out(nextDiscountTensor, m_nextDiscountColumn, 0, m_indexTensor);
+	}
+protected:
+	void updatePriority(size_t index, float priority)
+	{
+		m_sumTree.update(index, priority);
+	}
+	uint32_t sampleIndexSumTree() const
+	{
+		return m_sumTree.sample(m_size);
 	}
 protected:
 	uint32_t m_capacity{ 0 };
 	uint32_t m_size{ 0 };
 	uint32_t m_begin{ 0 };
 	uint32_t m_end{ 0 };
-	State_t* m_states{ nullptr };
-	Action_t* m_actions{ nullptr };
-	float* m_rewards{ nullptr };
-	State_t* m_nextStates{ nullptr };
-	float* m_nextDiscounts{ nullptr };
-	Action_t* m_nextActions{ nullptr };
-	Priority_t* m_priorities{};
-	PrioritySum_t* m_prioritySums{};
-	Priority_t m_minPriority{ FLT_MAX };
-	Priority_t m_maxPriority{ 1.0f };
+	ChunkedArray<State_t> m_states;
+	ChunkedArray<Action_t> m_actions;
+	ChunkedArray<float> m_rewards;
+	ChunkedArray<State_t> m_nextStates;
+	ChunkedArray<float> m_nextDiscounts;
+	ChunkedArray<Action_t> m_nextActions;
+	float* m_stateData{};
+	int64_t* m_actionData{};
+	float* m_rewardData{};
+	float* m_nextStateData{};
+	float* m_nextDiscountData{};
+	int64_t* m_nextActionData{};
+	Tensor m_stateColumn;
+	Tensor m_actionColumn;
+	Tensor m_rewardColumn;
+	Tensor m_nextStateColumn;
+	Tensor m_nextDiscountColumn;
+	Tensor m_nextActionColumn;
+	Tensor m_indexTensor;
+	std::unique_ptr<MappedFile> m_mappedFile;
+	MappedHeader* m_mappedHeader{};
+	SumTree_t m_sumTree;
+	ChunkedArray<uint64_t> m_serials;//only with prioritized replay
+	uint64_t m_serial{ 0 };
+	std::vector<uint32_t> m_updateIndices;
+	std::vector<Priority_t> m_batchPriorities;
+	Tensor m_priorityTensor;
 };
 
 END_RLTL_IMPL
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <assert.h>
 #include <vector>
+#include <stdexcept>
 #include  "../../../paf/pafcore/SmartPtr.h"
 #include <torch/torch.h>
 
@@ -164,6 +165,15 @@ public:
 	virtual Action_t maxAction(const State_t& state, bool firstMax = true) = 0;
 	virtual void getValues(std::vector<float>& values, const State_t& state) = 0;
 	virtual uint32_t actionCount() const = 0;
+	virtual void maxActions(std::vector<Action_t>& actions, const std::vector<State_t>& states, bool firstMax = true)
+	{
+		size_t count = states.size();
+		actions.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			actions[i] = maxAction(states[i], firstMax);
+		}
+	}
 };
 
 //template<typename State_t, typename Action_t>
@@ -191,6 +201,15 @@ public:
 public:
 	virtual Action_t takeAction(const State_t& state) = 0;
 	virtual uint32_t actionCount() const = 0;
+	virtual void takeActions(std::vector<Action_t>& actions, const std::vector<State_t>& states)
+	{
+		size_t count = states.size();
+		actions.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			actions[i] = takeAction(states[i]);
+		}
+	}
 };
 
 template<typename State_t, typename Action_t>
@@ -248,6 +267,73 @@ public:
 	virtual Action_t firstStep(const State_t& firstState) = 0;
 	virtual Action_t nextStep(float reward, const State_t& nextState) = 0;
 	virtual void lastStep(float reward, const State_t& nextState, bool terminated) = 0;
+public:
+	//batched steps for VectorEnvironment, one slot per environment
+	//a slot whose status is not es_normal ends its episode and starts a new one from resetStates[i].
+	//the defaults only drive a single slot, agents without their own per-slot state can not interleave
+	//several episodes, so more slots throw instead of leaving actions short in release builds
+	virtual void firstSteps(std::vector<Action_t>& actions, const std::vector<State_t>& firstStates)
+	{
+		if (firstStates.size() != 1)
+		{
+			throw std::logic_error("this agent does not override firstSteps and can only drive one environment");
+		}
+		actions.resize(1);
+		actions[0] = firstStep(firstStates[0]);
+	}
+	virtual void nextSteps(
+		std::vector<Action_t>& actions,
+		const std::vector<float>& rewards,
+		const std::vector<State_t>& nextStates,
+		const std::vector<EnvironmentStatus>& statuses,
+		const std::vector<State_t>& resetStates)
+	{
+		if (nextStates.size() != 1 || actions.size() != 1)
+		{
+			throw std::logic_error("this agent does not override nextSteps and can only drive one environment");
+		}
+		if (EnvironmentStatus::es_normal == statuses[0])
+		{
+			actions[0] = nextStep(rewards[0], nextStates[0]);
+		}
+		else
+		{
+			lastStep(rewards[0], nextStates[0], EnvironmentStatus::es_terminated == statuses[0]);
+			actions[0] = firstStep(resetStates[0]);
+		}
+	}
+public:
+	//per-slot steps for AsyncEnvironmentPool, one slot is stepped at a time as its environment finishes and keeps
+	//its own episode. nextSlotStep ends the episode of a slot whose status is not es_normal and starts the next
+	//one from resetState. the defaults only drive a single slot, like firstSteps and nextSteps
+	virtual void beginSlotSteps(size_t count)
+	{
+		if (count != 1)
+		{
+			throw std::logic_error("this agent does not override the slot steps and can only drive one environment");
+		}
+	}
+	virtual Action_t firstSlotStep(size_t slot, const State_t& firstState)
+	{
+		assert(0 == slot);
+		return firstStep(firstState);
+	}
+	virtual Action_t nextSlotStep(size_t slot, float reward, const State_t& nextState, EnvironmentStatus status, const State_t& resetState)
+	{
+		assert(0 == slot);
+		if (EnvironmentStatus::es_normal == status)
+		{
+			return nextStep(reward, nextState);
+		}
+		lastStep(reward, nextState, EnvironmentStatus::es_terminated == status);
+		return firstStep(resetState);
+	}
+public:
+	//number of parameter updates so far, 0 for agents which do not count them
+	virtual uint64_t learnCount() const
+	{
+		return 0;
+	}
 };
 
 class Callback : public paf::Introspectable
@@ -0,0 +1,101 @@
+#pragma once
+#include "utility.h"
+#include <vector>
+
+BEGIN_RLTL_IMPL
+
+//steps N copies of an environment in lockstep, finished copies are reset automatically
+template<typename State_t, typename Action_t>
+class VectorEnvironment : public paf::Introspectable
+{
+public:
+	typedef Environment<State_t, Action_t> Environment_t;
+	typedef paf::SharedPtr<Environment_t> EnvironmentPtr;
+	typedef typename Environment_t::StateSpacePtr StateSpacePtr;
+	typedef typename Environment_t::ActionSpacePtr ActionSpacePtr;
+	typedef paf::SharedPtr<VectorEnvironment> VectorEnvironmentPtr;
+public:
+	VectorEnvironment(const std::vector<EnvironmentPtr>& environments) :
+		m_environments(environments)
+	{
+		assert(!m_environments.empty());
+	}
+public:
+	size_t size() const
+	{
+		return m_environments.size();
+	}
+	Environment_t* environment(size_t index)
+	{
+		assert(index < m_environments.size());
+		return m_environments[index].get();
+	}
+	StateSpacePtr stateSpace()
+	{
+		return m_environments[0]->stateSpace();
+	}
+	ActionSpacePtr actionSpace()
+	{
+		return m_environments[0]->actionSpace();
+	}
+	void reset(std::vector<State_t>& states, int seed = 0)
+	{
+		size_t count = m_environments.size();
+		states.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			states[i] = m_environments[i]->reset(seed == 0 ? 0 : seed + int(i));
+		}
+	}
+	//nextStates[i] is the last state of an episode if statuses[i] != es_normal,
+	//in that case the environment has been reset and its first state is written to resetStates[i]
+	void step(
+		std::vector<float>& rewards,
+		std::vector<State_t>& nextStates,
+		std::vector<EnvironmentStatus>& statuses,
+		std::vector<State_t>& resetStates,
+		const std::vector<Action_t>& actions)
+	{
+		size_t count = m_environments.size();
+		assert(actions.size() == count);
+		rewards.resize(count);
+		nextStates.resize(count);
+		statuses.resize(count);
+		resetStates.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			statuses[i] = m_environments[i]->step(rewards[i], nextStates[i], actions[i]);
+			if (EnvironmentStatus::es_normal != statuses[i])
+			{
+				resetStates[i] = m_environments[i]->reset();
+			}
+		}
+	}
+	void close()
+	{
+		for (auto& environment : m_environments)
+		{
+			environment->close();
+		}
+	}
+protected:
+	std::vector<EnvironmentPtr> m_environments;
+public:
+	static VectorEnvironmentPtr Make(const std::vector<EnvironmentPtr>& environments)
+	{
+		return VectorEnvironmentPtr::Make(environments);
+	}
+	template<typename ConcreteEnvironment_t, typename... Args_t>
+	static VectorEnvironmentPtr Make(size_t count, Args_t&&... args)
+	{
+		std::vector<EnvironmentPtr> environments;
+		environments.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			environments.push_back(paf::SharedPtr<ConcreteEnvironment_t>::Make(args...));
+		}
+		return VectorEnvironmentPtr::Make(environments);
+	}
+};
+
+END_RLTL_IMPL
@@ -5,9 +5,12 @@
 #include "../rltl/impl/expected_sarsa.h"
 #include "../rltl/impl/q_learning.h"
 #include "../rltl/impl/deep_q_network.h"
+#include "../rltl/impl/deep_q_network_actor_learner.h"
 #include "../rltl/impl/deep_reinforce.h"
 #include "../rltl/impl/deep_actor_critic.h"
 #include "../rltl/impl/deep_actor_critic2.h"
+#include "../rltl/impl/concurrent_trajectory_buffer.h"
+#include "../rltl/impl/batch_prefetcher.h"
 
 #include "../rltl/impl/action_value_net.h"
 #include "../rltl/impl/state_value_net.h"
@@ -20,6 +23,11 @@
 #include "env/mountain_car.h"
 #include "env/cart_pole.h"
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <random>
 
 template<typename Agent_t>
 class RewardStat
@@ -196,6 +204,470 @@ void test_dqn(const std::string& filename)
 
 }
 
+void test_dqn_vector()
+{
+	typedef CartPole Env;
+	typedef rltl::impl::VectorEnvironment<Env::State_t, Env::Action_t> VectorEnv;
+
+	auto env = VectorEnv::Make<Env>(64);
+	Env::ConcreteStateSpacePtr stateSpacePtr = env->stateSpace();
+	Env::ConcreteActionSpacePtr actionSpacePtr = env->actionSpace();
+
+	auto actionValueNet = rltl::impl::MLPActionValueNet<Env::State_t, Env::Action_t>::Make(rltl::impl::Vector_dimension(stateSpacePtr->low()), actionSpacePtr->count(), 128, 1, false);
+	std::shared_ptr<torch::optim::AdamW> optimizer(new torch::optim::AdamW((*actionValueNet)->parameters(), torch::optim::AdamWOptions(1e-3)));
+
+	auto greedyAction = rltl::impl::GreedyAction<Env::State_t, Env::Action_t>::Make(actionValueNet);
+	auto epsilonGreedy = rltl::impl::EpsilonGreedy<Env::State_t, Env::Action_t>::Make(greedyAction, 0.1f);
+	rltl::impl::DeepQLearningOptions options(0.98, 64, false);
+	options.targetNetwork(5);
+	options.experienceReplay(10000, 500, 5);
+
+	auto agent = rltl::impl::MakeDQN(actionValueNet, optimizer, epsilonGreedy, options);
+	uint32_t numEpisodes = 1500;
+	RewardStat2 rewardStat(numEpisodes);
+	rltl::impl::Trainer<Env::State_t, Env::Action_t>::TrainVectorEpisodes(agent.get(), env.get(), numEpisodes, &rewardStat);
+}
+
+void test_dqn_steps()
+{
+	typedef CartPole Env;
+	auto env = paf::SharedPtr<Env>::Make();
+	Env::ConcreteStateSpacePtr stateSpacePtr = env->stateSpace();
+	Env::ConcreteActionSpacePtr actionSpacePtr = env->actionSpace();
+
+	auto actionValueNet = rltl::impl::MLPActionValueNet<Env::State_t, Env::Action_t>::Make(rltl::impl::Vector_dimension(stateSpacePtr->low()), actionSpacePtr->count(), 128, 1, false);
+	std::shared_ptr<torch::optim::AdamW> optimizer(new torch::optim::AdamW((*actionValueNet)->parameters(), torch::optim::AdamWOptions(1e-3)));
+
+	auto greedyAction = rltl::impl::GreedyAction<Env::State_t, Env::Action_t>::Make(actionValueNet);
+	auto epsilonGreedy = rltl::impl::EpsilonGreedy<Env::State_t, Env::Action_t>::Make(greedyAction, 0.1f);
+	rltl::impl::DeepQLearningOptions options(0.98, 64, false);
+	options.targetNetwork(5);
+	options.experienceReplay(10000, 500, 5);
+
+	auto agent = rltl::impl::MakeDQN(actionValueNet, optimizer, epsilonGreedy, options);
+	rltl::impl::TrainBudget budget;
+	budget.maxSteps(100000).maxSeconds(60).maxUpdates(10000);
+	auto stats = rltl::impl::Trainer<Env::State_t, Env::Action_t>::TrainSteps(agent.get(), env.get(), budget, nullptr);
+	std::cout << "steps: " << stats.m_numSteps << " episodes: " << stats.m_numEpisodes << " updates: " << stats.m_numUpdates
+		<< " steps/sec: " << stats.stepsPerSecond() << " updates/sec: " << stats.updatesPerSecond() << std::endl;
+}
+
+void test_dqn_actor_learner()
+{
+	typedef CartPole Env;
+	typedef rltl::impl::DeepQNetworkActorLearner<rltl::impl::TargetEvaluationMethod::q_learning, rltl::impl::MLPActionValueNet<Env::State_t, Env::Action_t>> ActorLearner;
+
+	uint32_t numActors = 8;
+	std::vector<ActorLearner::EnvironmentPtr> environments;
+	for (uint32_t i = 0; i < numActors; ++i)
+	{
+		environments.push_back(paf::SharedPtr<Env>::Make());
+	}
+	Env::ConcreteStateSpacePtr stateSpacePtr = environments[0]->stateSpace();
+	Env::ConcreteActionSpacePtr actionSpacePtr = environments[0]->actionSpace();
+
+	auto actionValueNet = rltl::impl::MLPActionValueNet<Env::State_t, Env::Action_t>::Make(rltl::impl::Vector_dimension(stateSpacePtr->low()), actionSpacePtr->count(), 128, 1, false);
+	std::shared_ptr<torch::optim::AdamW> optimizer(new torch::optim::AdamW((*actionValueNet)->parameters(), torch::optim::AdamWOptions(1e-3)));
+
+	rltl::impl::DeepQLearningOptions options(0.98, 64, false);
+	options.targetNetwork(5);
+	options.experienceReplay(10000, 500, 1);
+	rltl::impl::ActorLearnerOptions actorLearnerOptions(numActors);
+	actorLearnerOptions.publishInterval(50);
+	actorLearnerOptions.samplesPerInsert(4);
+
+	auto actorLearner = ActorLearner::Make(actionValueNet, optimizer, environments, options, actorLearnerOptions);
+	actorLearner->train(20000);
+	std::cout << "steps: " << actorLearner->numSteps() << " episodes: " << actorLearner->numEpisodes() << " updates: " << actorLearner->numUpdates() << std::endl;
+	const rltl::impl::RateLimiter& rateLimiter = actorLearner->rateLimiter();
+	std::cout << "samples/insert: " << rateLimiter.ratio() << " actor waits: " << rateLimiter.insertWaitCount() << " (" << rateLimiter.insertWaitSeconds() << "s)"
+		<< " learner waits: " << rateLimiter.sampleWaitCount() << " (" << rateLimiter.sampleWaitSeconds() << "s)" << std::endl;
+}
+
+//writers append transitions whose fields can be checked against each other while one thread samples and
+//updates priorities, a torn transition or a priority tree which no longer sums its leaves is reported
+bool test_concurrent_trajectory_buffer(uint32_t numWriters)
+{
+	typedef rltl::impl::Array<float, 2> State_t;
+	typedef uint32_t Action_t;
+	const uint32_t capacity = 10000;
+	const uint32_t appendsPerWriter = 100000;
+	const uint32_t batchSize = 64;
+	rltl::impl::ConcurrentTrajectoryBuffer<State_t, Action_t> buffer;
+	buffer.initialize(capacity, true);
+
+	std::atomic<uint32_t> finishedWriters{ 0 };
+	std::vector<std::thread> writers;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < numWriters; ++i)
+	{
+		writers.emplace_back([&buffer, &finishedWriters, i, appendsPerWriter]()
+			{
+				rltl::impl::TransitionBatch<State_t, Action_t> batch;
+				for (uint32_t j = 0; j < appendsPerWriter; ++j)
+				{
+					State_t state{ { float(i), float(j) } };
+					State_t nextState{ { float(i), float(j + 1) } };
+					batch.append(state, Action_t(j % 3), float(i * appendsPerWriter + j), nextState, 0.5f);
+					if (batch.size() == 8)
+					{
+						buffer.append(batch);
+						batch.clear();
+					}
+				}
+				buffer.append(batch);
+				++finishedWriters;
+			});
+	}
+
+	std::vector<uint32_t> indices;
+	rltl::impl::ReplayBatch tensors;
+	tensors.allocate<State_t, Action_t>(batchSize, false);
+	uint64_t numBatches = 0;
+	uint64_t numTorn = 0;
+	while (finishedWriters < numWriters)
+	{
+		if (buffer.size() < batchSize)
+		{
+			continue;
+		}
+		buffer.sample(indices, tensors.m_stateTensor, tensors.m_actionTensor, tensors.m_rewardTensor, tensors.m_nextStateTensor, tensors.m_nextDiscountTensor, tensors.m_weightTensor, batchSize, 0.4f);
+		auto states = tensors.m_stateTensor.accessor<float, 2>();
+		auto actions = tensors.m_actionTensor.accessor<int64_t, 2>();
+		auto rewards = tensors.m_rewardTensor.accessor<float, 2>();
+		auto nextStates = tensors.m_nextStateTensor.accessor<float, 2>();
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			uint32_t writer = uint32_t(states[i][0]);
+			uint32_t step = uint32_t(states[i][1]);
+			if (rewards[i][0] != float(writer * appendsPerWriter + step) || actions[i][0] != step % 3 ||
+				nextStates[i][0] != states[i][0] || nextStates[i][1] != float(step + 1))
+			{
+				++numTorn;
+			}
+		}
+		buffer.updatePriorities(indices, torch::rand({ int64_t(batchSize), 1 }), batchSize, 0.6f, 1e-3f);
+		++numBatches;
+	}
+	for (std::thread& writer : writers)
+	{
+		writer.join();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double leafSum = 0;
+	for (uint32_t i = 0; i < capacity; ++i)
+	{
+		leafSum += buffer.priority(i);
+	}
+	//the tree sums are exact in fixed point, only the float conversions differ
+	bool sumsMatch = std::abs(leafSum - buffer.totalPriority()) <= 1e-6 * leafSum;
+	std::cout << "writers: " << numWriters << " appends/sec: " << numWriters * appendsPerWriter / seconds << " batches: " << numBatches
+		<< " torn: " << numTorn << " tree: " << buffer.totalPriority() << " leaves: " << leafSum << std::endl;
+	return buffer.appendCount() == uint64_t(numWriters) * appendsPerWriter && 0 == numTorn && sumsMatch;
+}
+
+//brute force over a plain vector of the leaves: totals, minimum, single and bulk updates with repeated indices,
+//the prefix sum search and the stratified batch, whose i-th index must cover the i-th of count equal segments
+template<typename SumTree_t>
+bool test_sum_tree(const char* name, uint32_t capacity)
+{
+	capacity = SumTree_t::AlignCapacity(capacity);
+	SumTree_t tree;
+	tree.initialize(capacity);
+	std::vector<float> leaves(capacity, 0);
+	std::default_random_engine engine(17);
+	std::uniform_real_distribution<float> priorityDistribution(0.01f, 2.0f);
+	std::uniform_int_distribution<uint32_t> indexDistribution(0, capacity - 1);
+	uint32_t numErrors = 0;
+	auto prefixBefore = [&leaves](uint32_t index)
+	{
+		double sum = 0;
+		for (uint32_t i = 0; i < index; ++i)
+		{
+			sum += leaves[i];
+		}
+		return sum;
+	};
+	auto check = [&]()
+	{
+		double total = 0;
+		float minPriority = 0;
+		for (uint32_t i = 0; i < capacity; ++i)
+		{
+			total += leaves[i];
+			if (leaves[i] > 0 && (0 == minPriority || leaves[i] < minPriority))
+			{
+				minPriority = leaves[i];
+			}
+			if (tree.priority(i) != leaves[i])
+			{
+				++numErrors;
+			}
+		}
+		if (std::abs(total - double(tree.total())) > 1e-9 * capacity * total || tree.minPriority() != minPriority)
+		{
+			++numErrors;
+		}
+		return total;
+	};
+
+	for (uint32_t i = 0; i < capacity; i += 2)
+	{
+		leaves[i] = priorityDistribution(engine);
+		tree.update(i, leaves[i]);
+	}
+	check();
+	std::vector<uint32_t> indices(64);
+	std::vector<float> priorities(64);
+	for (uint32_t round = 0; round < 50; ++round)
+	{
+		for (uint32_t i = 0; i < 64; ++i)
+		{
+			//repeats and zeros included, the last priority of a repeated index wins
+			indices[i] = i % 16 == 15 ? indices[i - 1] : indexDistribution(engine);
+			priorities[i] = i % 8 == 7 ? 0.0f : priorityDistribution(engine);
+			leaves[indices[i]] = priorities[i];
+		}
+		tree.update(indices.data(), priorities.data(), 64);
+	}
+	double total = check();
+
+	const double tolerance = 1e-6 * total;
+	std::uniform_real_distribution<double> targetDistribution(0, total);
+	for (uint32_t i = 0; i < 1000; ++i)
+	{
+		double target = targetDistribution(engine);
+		uint32_t index = tree.find(target, capacity);
+		double before = prefixBefore(index);
+		if (0 == leaves[index] || before > target + tolerance || before + leaves[index] < target - tolerance)
+		{
+			++numErrors;
+		}
+	}
+	for (uint32_t batch = 0; batch < 20; ++batch)
+	{
+		tree.sample(indices.data(), priorities.data(), 64, capacity);
+		double segment = total / 64;
+		for (uint32_t i = 0; i < 64; ++i)
+		{
+			double before = prefixBefore(indices[i]);
+			if ((i > 0 && indices[i] < indices[i - 1]) || priorities[i] != leaves[indices[i]] || 0 == leaves[indices[i]]
+				|| before > (i + 1) * segment + tolerance || before + leaves[indices[i]] < i * segment - tolerance)
+			{
+				++numErrors;
+			}
+		}
+	}
+	std::cout << name << " capacity: " << capacity << " errors: " << numErrors << std::endl;
+	return 0 == numErrors;
+}
+
+bool test_sum_trees()
+{
+	bool passed = true;
+	for (uint32_t capacity : { 1000, 4096, 100000 })
+	{
+		passed = test_sum_tree<rltl::impl::PrioritySumTree<float, double>>("PrioritySumTree", capacity) && passed;
+		passed = test_sum_tree<rltl::impl::WidePrioritySumTree<float, double>>("WidePrioritySumTree", capacity) && passed;
+	}
+	return passed;
+}
+
+//several streams interleave episodes in the ring, a state carries (episode, step), so every sampled transition is
+//checked against the episode log: n-step return, next state and discount, and no window crossing an episode.
+//some episodes are abandoned without endEpisode, the next one of the stream must not be linked onto them
+bool test_sequential_trajectory_buffer(uint32_t multiStep, bool prioritized)
+{
+	typedef rltl::impl::Array<float, 2> State_t;
+	typedef uint32_t Action_t;
+	struct Episode
+	{
+		uint32_t m_length;
+		bool m_terminated;
+		bool m_abandoned;
+	};
+	const uint32_t capacity = 4096;
+	const uint32_t numStreams = 4;
+	const uint32_t batchSize = 64;
+	const float discountRate = 0.5f;
+	rltl::impl::SequentialTrajectoryBuffer<State_t, Action_t> buffer;
+	buffer.initialize(capacity, multiStep, false, discountRate, prioritized);
+	buffer.numStreams(numStreams);
+
+	std::default_random_engine engine(14);
+	std::vector<Episode> episodes;
+	std::vector<uint32_t> currentEpisodes(numStreams);
+	std::vector<uint32_t> steps(numStreams);
+	auto reward = [](uint32_t episode, uint32_t step)
+	{
+		return float(episode % 7) + 0.25f * float(step % 5);
+	};
+	auto beginEpisode = [&](uint32_t stream)
+	{
+		currentEpisodes[stream] = uint32_t(episodes.size());
+		episodes.push_back(Episode{ 1 + uint32_t(engine() % 12), 0 == engine() % 2, 0 == engine() % 5 });
+		steps[stream] = 0;
+		buffer.beginEpisode(stream);
+	};
+	for (uint32_t stream = 0; stream < numStreams; ++stream)
+	{
+		beginEpisode(stream);
+	}
+	for (uint32_t i = 0; i < 3 * capacity; ++i)
+	{
+		uint32_t stream = uint32_t(engine() % numStreams);
+		uint32_t episode = currentEpisodes[stream];
+		uint32_t step = steps[stream];
+		State_t state{ { float(episode), float(step) } };
+		if (step < episodes[episode].m_length)
+		{
+			buffer.append(stream, state, Action_t(step), reward(episode, step));
+			++steps[stream];
+		}
+		else
+		{
+			if (!episodes[episode].m_abandoned)
+			{
+				buffer.endEpisode(stream, state, episodes[episode].m_terminated);
+			}
+			beginEpisode(stream);
+		}
+	}
+
+	std::vector<uint32_t> indices(batchSize);
+	rltl::impl::ReplayBatch tensors;
+	tensors.allocate<State_t, Action_t>(batchSize, false);
+	uint32_t numErrors = 0;
+	for (uint32_t batch = 0; batch < 200; ++batch)
+	{
+		if (prioritized)
+		{
+			buffer.sample(indices, tensors.m_stateTensor, tensors.m_actionTensor, tensors.m_rewardTensor, tensors.m_nextStateTensor, tensors.m_nextDiscountTensor, tensors.m_weightTensor, batchSize, 0.4f);
+		}
+		else
+		{
+			buffer.sample(tensors.m_stateTensor, tensors.m_actionTensor, tensors.m_rewardTensor, tensors.m_nextStateTensor, tensors.m_nextDiscountTensor, batchSize);
+		}
+		auto states = tensors.m_stateTensor.accessor<float, 2>();
+		auto actions = tensors.m_actionTensor.accessor<int64_t, 2>();
+		auto rewards = tensors.m_rewardTensor.accessor<float, 2>();
+		auto nextStates = tensors.m_nextStateTensor.accessor<float, 2>();
+		auto nextDiscounts = tensors.m_nextDiscountTensor.accessor<float, 2>();
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			uint32_t episode = uint32_t(states[i][0]);
+			uint32_t step = uint32_t(states[i][1]);
+			const Episode& e = episodes[episode];
+			uint32_t nextStep = uint32_t(nextStates[i][1]);
+			//an abandoned episode stored only its steps, the last observation is missing
+			uint32_t depth = e.m_abandoned ? multiStep : std::min(multiStep, e.m_length - step);
+			float expectedReward = 0;
+			float discount = 1;
+			for (uint32_t j = 0; j < depth; ++j)
+			{
+				expectedReward += discount * reward(episode, step + j);
+				discount *= discountRate;
+			}
+			float expectedDiscount = !e.m_abandoned && e.m_terminated && step + depth == e.m_length ? 0.0f : discount;
+			if (nextStates[i][0] != states[i][0] || nextStep != step + depth || actions[i][0] != step
+				|| (e.m_abandoned && nextStep >= e.m_length)
+				|| std::abs(rewards[i][0] - expectedReward) > 1e-4f || nextDiscounts[i][0] != expectedDiscount)
+			{
+				++numErrors;
+			}
+		}
+		if (prioritized)
+		{
+			buffer.updatePriorities(indices, torch::rand({ int64_t(batchSize), 1 }), batchSize, 0.6f, 1e-3f);
+		}
+	}
+	std::cout << "sequential multiStep: " << multiStep << " prioritized: " << prioritized << " ready: " << buffer.size() << " errors: " << numErrors << std::endl;
+	return 0 == numErrors;
+}
+
+//a mapped buffer closed and opened again with resume keeps its ring and continues it,
+//another capacity or resume off start empty
+bool test_mapped_trajectory_buffer(const std::string& filename)
+{
+	typedef rltl::impl::Array<float, 2> State_t;
+	typedef uint32_t Action_t;
+	typedef rltl::impl::TrajectoryBuffer<State_t, Action_t> Buffer_t;
+	const uint32_t capacity = 1024;
+	const uint32_t numAppends = 1500;
+	const uint32_t batchSize = 64;
+	auto append = [](Buffer_t& buffer, uint32_t j)
+	{
+		buffer.append(State_t{ { float(j), 1 } }, Action_t(j % 3), 0.5f * j, State_t{ { float(j + 1), 1 } }, 0.5f);
+	};
+	std::remove(filename.c_str());
+	uint32_t numErrors = 0;
+	{
+		Buffer_t buffer;
+		if (!buffer.initializeMapped(filename, capacity, false, true, true))
+		{
+			std::cout << "can not map " << filename << std::endl;
+			return false;
+		}
+		for (uint32_t j = 0; j < numAppends; ++j)
+		{
+			append(buffer, j);
+		}
+		buffer.flush();
+	}
+	for (uint32_t reopen = 0; reopen < 2; ++reopen)
+	{
+		Buffer_t buffer;
+		if (!buffer.initializeMapped(filename, capacity, false, true, true) || buffer.size() != capacity)
+		{
+			++numErrors;
+			continue;
+		}
+		//the second reopen sees the append made after the first one
+		uint32_t end = numAppends + reopen;
+		std::vector<uint32_t> indices(batchSize);
+		rltl::impl::ReplayBatch tensors;
+		tensors.allocate<State_t, Action_t>(batchSize, false);
+		for (uint32_t batch = 0; batch < 20; ++batch)
+		{
+			buffer.sample(indices, tensors.m_stateTensor, tensors.m_actionTensor, tensors.m_rewardTensor, tensors.m_nextStateTensor, tensors.m_nextDiscountTensor, tensors.m_weightTensor, batchSize, 0.4f);
+			auto states = tensors.m_stateTensor.accessor<float, 2>();
+			auto actions = tensors.m_actionTensor.accessor<int64_t, 2>();
+			auto rewards = tensors.m_rewardTensor.accessor<float, 2>();
+			auto nextStates = tensors.m_nextStateTensor.accessor<float, 2>();
+			auto weights = tensors.m_weightTensor.accessor<float, 2>();
+			for (uint32_t i = 0; i < batchSize; ++i)
+			{
+				uint32_t j = uint32_t(states[i][0]);
+				//resumed priorities all restart at the max priority, so every weight is 1
+				if (j + capacity < end || j >= end || actions[i][0] != j % 3 || rewards[i][0] != 0.5f * j
+					|| nextStates[i][0] != float(j + 1) || std::abs(weights[i][0] - 1.0f) > 1e-6f)
+				{
+					++numErrors;
+				}
+			}
+		}
+		append(buffer, end);
+		buffer.flush();
+	}
+	{
+		Buffer_t buffer;
+		if (!buffer.initializeMapped(filename, capacity, false, true, false) || 0 != buffer.size())
+		{
+			++numErrors;
+		}
+	}
+	{
+		Buffer_t buffer;
+		if (!buffer.initializeMapped(filename, capacity * 2, false, true, true) || 0 != buffer.size())
+		{
+			++numErrors;
+		}
+	}
+	std::remove(filename.c_str());
+	std::cout << "mapped resume errors: " << numErrors << std::endl;
+	return 0 == numErrors;
+}
+
 //void test_deep_sarsa()
 //{
 //	//rltl::impl::Callback* stepCallback = new TestStepCallback;
@@ -299,6 +771,106 @@ void test_actor_critic()
 
 }
 
+#ifndef _WIN32
+//a server and two clients in this process: an actor inserting and a learner sampling, then the server goes away
+bool test_replay_service(const std::string& socketPath)
+{
+	typedef rltl::impl::Array<float, 2> State_t;
+	typedef uint32_t Action_t;
+	const uint32_t numAppends = 300;
+	const uint32_t batchSize = 64;
+	rltl::impl::ReplayServer<State_t, Action_t> server;
+	if (!server.start(socketPath, 1024, true))
+	{
+		std::cout << "can not listen on " << socketPath << std::endl;
+		return false;
+	}
+	uint32_t numErrors = 0;
+	rltl::impl::ReplayClient<State_t, Action_t> actor;
+	rltl::impl::ReplayClient<State_t, Action_t> learner;
+	if (!actor.connect(socketPath, 4, batchSize) || !learner.connect(socketPath, 2, batchSize))
+	{
+		std::cout << "can not connect to " << socketPath << std::endl;
+		return false;
+	}
+	rltl::impl::TransitionBatch<State_t, Action_t> transitions;
+	for (uint32_t j = 0; j < numAppends; ++j)
+	{
+		transitions.append(State_t{ { float(j), 1 } }, Action_t(j % 3), 0.5f * j, State_t{ { float(j + 1), 1 } }, 0.5f);
+	}
+	actor.appendTransitions(transitions);
+	//the size request waits for the pipelined inserts
+	if (actor.size() != numAppends)
+	{
+		++numErrors;
+	}
+	//the ring a client asks for is bounded by the server
+	rltl::impl::ReplayClient<State_t, Action_t> greedy;
+	if (greedy.connect(socketPath, 1u << 20, 1u << 16))
+	{
+		++numErrors;
+	}
+	std::vector<uint32_t> indices(batchSize);
+	rltl::impl::ReplayBatch tensors;
+	tensors.allocate<State_t, Action_t>(batchSize, false);
+	torch::Tensor deltaTensor = torch::ones({ int64_t(batchSize), 1 });
+	for (uint32_t batch = 0; batch < 10; ++batch)
+	{
+		if (!learner.sample(indices, tensors.m_stateTensor, tensors.m_actionTensor, tensors.m_rewardTensor, tensors.m_nextStateTensor, tensors.m_nextDiscountTensor, tensors.m_weightTensor, batchSize, 0.4f))
+		{
+			++numErrors;
+			continue;
+		}
+		auto states = tensors.m_stateTensor.accessor<float, 2>();
+		auto actions = tensors.m_actionTensor.accessor<int64_t, 2>();
+		auto rewards = tensors.m_rewardTensor.accessor<float, 2>();
+		auto nextStates = tensors.m_nextStateTensor.accessor<float, 2>();
+		auto nextDiscounts = tensors.m_nextDiscountTensor.accessor<float, 2>();
+		for (uint32_t i = 0; i < batchSize; ++i)
+		{
+			uint32_t j = uint32_t(states[i][0]);
+			if (j >= numAppends || indices[i] != j || actions[i][0] != j % 3 || rewards[i][0] != 0.5f * j
+				|| nextStates[i][0] != float(j + 1) || nextDiscounts[i][0] != 0.5f)
+			{
+				++numErrors;
+			}
+		}
+		learner.updatePriorities(indices, deltaTensor, batchSize, 0.6f, 1e-3f);
+	}
+	if (!learner.connected() || learner.size() != numAppends)
+	{
+		++numErrors;
+	}
+	//once the server is gone sampling fails instead of leaving the last batch in place
+	server.stop();
+	if (learner.sample(indices, tensors.m_stateTensor, tensors.m_actionTensor, tensors.m_rewardTensor, tensors.m_nextStateTensor, tensors.m_nextDiscountTensor, tensors.m_weightTensor, batchSize, 0.4f) || learner.connected())
+	{
+		++numErrors;
+	}
+	//a server without priorities refuses the prioritized requests and keeps serving
+	if (!server.start(socketPath, 1024, false) || !actor.connect(socketPath, 4, batchSize) || !learner.connect(socketPath, 2, batchSize))
+	{
+		std::cout << "can not restart " << socketPath << std::endl;
+		return false;
+	}
+	actor.appendTransitions(transitions);
+	if (actor.size() != numAppends
+		|| learner.sample(indices, tensors.m_stateTensor, tensors.m_actionTensor, tensors.m_rewardTensor, tensors.m_nextStateTensor, tensors.m_nextDiscountTensor, tensors.m_weightTensor, batchSize, 0.4f)
+		|| !learner.sample(tensors.m_stateTensor, tensors.m_actionTensor, tensors.m_rewardTensor, tensors.m_nextStateTensor, tensors.m_nextDiscountTensor, batchSize))
+	{
+		++numErrors;
+	}
+	learner.updatePriorities(indices, deltaTensor, batchSize, 0.6f, 1e-3f);
+	if (!learner.connected() || learner.size() != numAppends)
+	{
+		++numErrors;
+	}
+	server.stop();
+	std::cout << "replay service errors: " << numErrors << std::endl;
+	return 0 == numErrors;
+}
+#endif
+
 int main()
 {
 	//test_dqn();
@@ -306,6 +878,21 @@ int main()
 	//test_table();
 	try
 	{
+		bool passed = test_sum_trees();
+		for (uint32_t multiStep : { 1, 3 })
+		{
+			passed = test_sequential_trajectory_buffer(multiStep, false) && passed;
+			passed = test_sequential_trajectory_buffer(multiStep, true) && passed;
+		}
+		passed = test_mapped_trajectory_buffer("./replay_test.bin") && passed;
+#ifndef _WIN32
+		passed = test_replay_service("/tmp/rltl_test_replay.sock") && passed;
+#endif
+		for (uint32_t numWriters : { 1, 8, 32 })
+		{
+			passed = test_concurrent_trajectory_buffer(numWriters) && passed;
+		}
+		std::cout << (passed ? "buffer tests passed" : "buffer tests failed") << std::endl;
 		test_dqn("./bb.pth");
 		//test_actor_critic();
 	}